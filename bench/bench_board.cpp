@@ -0,0 +1,167 @@
+#include <benchmark/benchmark.h>
+
+#include "bench_util.h"
+#include "board.h"
+#include "gtp.h"
+
+// Board benchmarks take the board size as their first argument.
+
+static void BM_BoardCopy(benchmark::State &state) {
+    int size = static_cast<int>(state.range(0));
+    auto board = randomBoard(size, size * size / 2);
+    for (auto _: state) {
+        auto copy = board->Copy();
+        benchmark::DoNotOptimize(copy);
+    }
+}
+BENCHMARK(BM_BoardCopy)->Arg(9)->Arg(13)->Arg(19)->Arg(52);
+
+static void BM_BoardEquals(benchmark::State &state) {
+    int size = static_cast<int>(state.range(0));
+    auto board = randomBoard(size, size * size / 2);
+    auto copy = board->Copy();
+    for (auto _: state) {
+        benchmark::DoNotOptimize(board->Equals(*copy));
+    }
+}
+BENCHMARK(BM_BoardEquals)->Arg(9)->Arg(13)->Arg(19)->Arg(52);
+
+// BM_BoardPlay plays a whole random game, with captures, through the public
+// PlayColour API, which checks legality and parses SGF points.
+static void BM_BoardPlay(benchmark::State &state) {
+    int size = static_cast<int>(state.range(0));
+    auto moves = randomMoves(size, size * size * 2);
+    std::vector<std::string> points;
+    for (int i: moves) {
+        points.push_back(Point(i % size, i / size));
+    }
+    for (auto _: state) {
+        Board board(size);
+        for (auto &p: points) {
+            board.PlayColour(p, board.player);
+        }
+        benchmark::DoNotOptimize(board.hash);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(points.size()));
+}
+BENCHMARK(BM_BoardPlay)->Arg(9)->Arg(13)->Arg(19);
+
+// BM_BoardPlaySuperko is BM_BoardPlay with positional superko checking.
+static void BM_BoardPlaySuperko(benchmark::State &state) {
+    int size = static_cast<int>(state.range(0));
+    auto moves = randomMoves(size, size * size * 2);
+    for (auto _: state) {
+        Board board(size);
+        board.superko = Superko::POSITIONAL;
+        board.RecordHistory();
+        for (int i: moves) {
+            if (board.legal(i, board.player)) {
+                board.playMove(i, board.player);
+            }
+        }
+        benchmark::DoNotOptimize(board.hash);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(moves.size()));
+}
+BENCHMARK(BM_BoardPlaySuperko)->Arg(9)->Arg(19);
+
+// BM_CanonicalHash plays a game and takes the canonical hash after every move,
+// from the incremental symmetry hashes (second argument 1) or from the stones.
+static void BM_CanonicalHash(benchmark::State &state) {
+    int size = static_cast<int>(state.range(0));
+    bool tracked = state.range(1) != 0;
+    auto moves = randomMoves(size, size * size);
+    for (auto _: state) {
+        Board board(size);
+        if (tracked) {
+            board.TrackSymmetries();
+        }
+        for (int i: moves) {
+            board.playMove(i, board.player);
+            benchmark::DoNotOptimize(board.CanonicalHash());
+        }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(moves.size()));
+}
+BENCHMARK(BM_CanonicalHash)->ArgsProduct({{9, 19}, {0, 1}});
+
+// BM_BoardLegal tests every point of a half-full board for both colours.
+static void BM_BoardLegal(benchmark::State &state) {
+    int size = static_cast<int>(state.range(0));
+    auto board = randomBoard(size, size * size / 2);
+    for (auto _: state) {
+        int n = 0;
+        for (int i = 0; i < size * size; i++) {
+            n += board->legal(i, Colour::BLACK) + board->legal(i, Colour::WHITE);
+        }
+        benchmark::DoNotOptimize(n);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * 2 * size * size);
+}
+BENCHMARK(BM_BoardLegal)->Arg(9)->Arg(13)->Arg(19);
+
+// bitboardKernels picks the kernels for a benchmark from its second argument:
+// 0 for scalar and 1 for AVX2, which is skipped where the CPU lacks it.
+static const BitboardKernels *bitboardKernels(benchmark::State &state) {
+    const BitboardKernels *k = state.range(1) ? AVX2Kernels() : &ScalarKernels();
+    if (!k) {
+        state.SkipWithError("kernels not supported on this CPU");
+    }
+    return k;
+}
+
+static void BM_Dilate(benchmark::State &state) {
+    int size = static_cast<int>(state.range(0));
+    const BitboardKernels *k = bitboardKernels(state);
+    if (!k) {
+        return;
+    }
+    auto board = randomBoard(size, size * size / 2);
+    const EdgeMasks &e = Edges(size);
+    for (auto _: state) {
+        benchmark::DoNotOptimize(k->dilate(board->black, e));
+    }
+}
+BENCHMARK(BM_Dilate)->ArgsProduct({{9, 19, 52}, {0, 1}});
+
+// BM_FloodFill grows black's stones through every point not held by white, as
+// area scoring does to find the territory each side reaches.
+static void BM_FloodFill(benchmark::State &state) {
+    int size = static_cast<int>(state.range(0));
+    const BitboardKernels *k = bitboardKernels(state);
+    if (!k) {
+        return;
+    }
+    auto board = randomBoard(size, size * size / 2);
+    const EdgeMasks &e = Edges(size);
+    Bitboard within;
+    for (int w = 0; w < e.nwords; w++) {
+        within.words[w] = e.onBoard.words[w] & ~board->white.words[w];
+    }
+    for (auto _: state) {
+        benchmark::DoNotOptimize(k->floodFill(board->black, within, e));
+    }
+}
+BENCHMARK(BM_FloodFill)->ArgsProduct({{9, 19, 52}, {0, 1}});
+
+// BM_GTPPlayUndo sends a game to a GTP engine move by move and takes it back
+// with undo, as a tournament manager or analysis GUI would.
+static void BM_GTPPlayUndo(benchmark::State &state) {
+    int size = static_cast<int>(state.range(0));
+    GTPEngine gtp(size);
+    std::vector<std::string> commands;
+    const char *colours[] = {"play b ", "play w "};
+    for (int i: randomMoves(size, size * size / 2)) {
+        commands.push_back(colours[commands.size() % 2] + GTPVertex(i, size));
+    }
+    for (auto _: state) {
+        for (auto &c: commands) {
+            benchmark::DoNotOptimize(gtp.Execute(c));
+        }
+        for (size_t k = 0; k < commands.size(); k++) {
+            benchmark::DoNotOptimize(gtp.Execute("undo"));
+        }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(2 * commands.size()));
+}
+BENCHMARK(BM_GTPPlayUndo)->Arg(9)->Arg(19);
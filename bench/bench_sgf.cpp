@@ -0,0 +1,257 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "bench_util.h"
+#include "binary.h"
+#include "book.h"
+#include "dedup.h"
+#include "estimate.h"
+#include "gamedb.h"
+#include "io.h"
+#include "score.h"
+#include "search.h"
+
+static void BM_LoadSGFCollection(benchmark::State &state) {
+    auto sgf = syntheticCollection(static_cast<int>(state.range(0)), 250);
+    for (auto _: state) {
+        auto roots = LoadSGFCollection(sgf);
+        benchmark::DoNotOptimize(roots);
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(sgf.size()));
+}
+BENCHMARK(BM_LoadSGFCollection)->Arg(1)->Arg(100);
+
+static void BM_LoadSGFCollectionArena(benchmark::State &state) {
+    auto sgf = syntheticCollection(static_cast<int>(state.range(0)), 250);
+    for (auto _: state) {
+        auto roots = LoadSGFCollection(sgf, NodeArena::Create());
+        benchmark::DoNotOptimize(roots);
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(sgf.size()));
+}
+BENCHMARK(BM_LoadSGFCollectionArena)->Arg(100);
+
+// BM_LoadBinaryCollection loads the games of BM_LoadSGFCollection from the
+// binary game format, and reports how much smaller than the SGF it is.
+static void BM_LoadBinaryCollection(benchmark::State &state) {
+    auto sgf = syntheticCollection(static_cast<int>(state.range(0)), 250);
+    auto data = EncodeBinaryCollection(LoadSGFCollection(sgf));
+    for (auto _: state) {
+        auto roots = DecodeBinaryCollection(data, state.range(1) ? NodeArena::Create() : nullptr);
+        benchmark::DoNotOptimize(roots);
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(sgf.size()));
+    state.counters["sgf_ratio"] = static_cast<double>(sgf.size()) / static_cast<double>(data.size());
+}
+BENCHMARK(BM_LoadBinaryCollection)->Args({100, 0})->Args({100, 1});
+
+// BM_EncodeBinaryCollection writes the games of BM_LoadSGFCollection in the
+// binary game format.
+static void BM_EncodeBinaryCollection(benchmark::State &state) {
+    auto sgf = syntheticCollection(static_cast<int>(state.range(0)), 250);
+    auto roots = LoadSGFCollection(sgf);
+    for (auto _: state) {
+        benchmark::DoNotOptimize(EncodeBinaryCollection(roots));
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(sgf.size()));
+}
+BENCHMARK(BM_EncodeBinaryCollection)->Arg(100);
+
+static void BM_LoadMappedFile(benchmark::State &state) {
+    auto sgf = syntheticCollection(static_cast<int>(state.range(0)), 250);
+    std::string path = "bench_sgf_" + std::to_string(state.range(0)) + ".sgf";
+    std::ofstream(path, std::ios::binary) << sgf;
+    for (auto _: state) {
+        auto roots = LoadCollection(path);
+        benchmark::DoNotOptimize(roots);
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(sgf.size()));
+    std::remove(path.c_str());
+}
+BENCHMARK(BM_LoadMappedFile)->Arg(100);
+
+// gameDBFile returns the path of a game database of a million short games,
+// with 500 players and dates over ten years. It is written on first use, as
+// benchmark functions run more than once, and removed at exit.
+static const std::string &gameDBFile() {
+    static struct file {
+        std::string path = "bench_games.db";
+
+        file() {
+            GameDBWriter writer;
+            std::mt19937 rng(1);
+            for (int g = 0; g < 1000000; g++) {
+                auto root = Node::NewNode(nullptr);
+                root->SetValue(Key::PB, "player " + std::to_string(rng() % 500));
+                root->SetValue(Key::PW, "player " + std::to_string(rng() % 500));
+                root->SetValue(Key::KM, g % 3 ? "6.5" : "7.5");
+                root->SetValue(Key::DT,
+                               std::to_string(2010 + rng() % 10) + "-0" + std::to_string(1 + rng() % 9) + "-15");
+                root->SetValue(Key::RE, rng() % 2 ? "B+R" : "W+2.5");
+                Node::NewNode(root)->SetValue(Key::B, "pd");
+                writer.Add(*root);
+            }
+            writer.Save(this->path);
+        }
+
+        ~file() { std::remove(this->path.c_str()); }
+    } f;
+    return f.path;
+}
+
+// BM_GameDBOpen maps a game database of a million games.
+static void BM_GameDBOpen(benchmark::State &state) {
+    auto &path = gameDBFile();
+    for (auto _: state) {
+        GameDB db(path);
+        benchmark::DoNotOptimize(db.Size());
+    }
+}
+BENCHMARK(BM_GameDBOpen)->Unit(benchmark::kMicrosecond);
+
+// BM_GameDBFind finds one player's games since 2015 with 6.5 komi in a game
+// database of a million games.
+static void BM_GameDBFind(benchmark::State &state) {
+    GameDB db(gameDBFile());
+    GameQuery q;
+    q.player = "player 7";
+    q.minKomi = 6.5f;
+    q.maxKomi = 6.5f;
+    q.fromDate = 20150000;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(db.Find(q));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(db.Size()));
+}
+BENCHMARK(BM_GameDBFind)->Unit(benchmark::kMillisecond);
+
+static void BM_LoadBulk(benchmark::State &state) {
+    std::vector<std::string> paths;
+    for (int f = 0; f < 16; f++) {
+        paths.push_back("bench_bulk_" + std::to_string(f) + ".sgf");
+        std::ofstream(paths.back(), std::ios::binary) << syntheticCollection(50, 250);
+    }
+    int64_t bytes = 0;
+    for (auto &p: paths) {
+        bytes += MappedFile(p).View().size();
+    }
+    BulkOptions opts;
+    opts.threads = static_cast<unsigned>(state.range(0));
+    for (auto _: state) {
+        auto results = LoadBulk(paths, opts);
+        benchmark::DoNotOptimize(results);
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * bytes);
+    for (auto &p: paths) {
+        std::remove(p.c_str());
+    }
+}
+BENCHMARK(BM_LoadBulk)->Arg(1)->Arg(2)->Arg(4)->UseRealTime();
+
+static void BM_SignGame(benchmark::State &state) {
+    auto roots = LoadSGFCollection(syntheticCollection(static_cast<int>(state.range(0)), 250), NodeArena::Create());
+    for (auto _: state) {
+        for (auto &root: roots) {
+            auto sig = SignGame(*root);
+            benchmark::DoNotOptimize(sig);
+        }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(roots.size()));
+}
+BENCHMARK(BM_SignGame)->Arg(100);
+
+// BM_OpeningBookAdd merges the first 40 moves of each game into an opening
+// book, and reports the positions it ends up with.
+static void BM_OpeningBookAdd(benchmark::State &state) {
+    auto roots = LoadSGFCollection(syntheticCollection(static_cast<int>(state.range(0)), 250), NodeArena::Create());
+    size_t positions = 0;
+    for (auto _: state) {
+        OpeningBook book(19, 40);
+        for (auto &root: roots) {
+            book.Add(*root);
+        }
+        positions = book.Positions();
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(roots.size()));
+    state.counters["positions"] = static_cast<double>(positions);
+}
+BENCHMARK(BM_OpeningBookAdd)->Arg(100);
+
+static void BM_GameSearchBuild(benchmark::State &state) {
+    auto roots = LoadSGFCollection(syntheticCollection(static_cast<int>(state.range(0)), 250), NodeArena::Create());
+    for (auto _: state) {
+        GameSearch search(roots);
+        benchmark::DoNotOptimize(search);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(roots.size()));
+}
+BENCHMARK(BM_GameSearchBuild)->Arg(100)->UseRealTime();
+
+static void BM_FindPattern(benchmark::State &state) {
+    GameSearch search(LoadSGFCollection(syntheticCollection(100, 250), NodeArena::Create()));
+    auto pattern = Pattern::Parse("X.O/.X./O.X");
+    for (auto _: state) {
+        auto hits = search.FindPattern(pattern);
+        benchmark::DoNotOptimize(hits);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(search.Games()));
+}
+BENCHMARK(BM_FindPattern)->UseRealTime();
+
+static void BM_Estimate19(benchmark::State &state) {
+    auto root = LoadSGF(syntheticCollection(1, 60));
+    auto board = root->GetEnd()->GetBoard()->Copy();
+    EstimateOptions opts;
+    opts.playouts = static_cast<int>(state.range(0));
+    for (auto _: state) {
+        benchmark::DoNotOptimize(Estimate(*board, opts));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * opts.playouts);
+}
+BENCHMARK(BM_Estimate19)->Arg(1000)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_ScoreGame(benchmark::State &state) {
+    auto roots = LoadSGFCollection(syntheticCollection(100, 250), NodeArena::Create());
+    for (auto _: state) {
+        for (auto &root: roots) {
+            benchmark::DoNotOptimize(ScoreGame(*root, ScoringRule::AREA));
+        }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(roots.size()));
+}
+BENCHMARK(BM_ScoreGame);
+
+static void BM_ScoreBoard(benchmark::State &state) {
+    auto board = LoadSGF(syntheticCollection(1, 250))->GetEnd()->GetBoard()->Copy();
+    for (auto _: state) {
+        benchmark::DoNotOptimize(ScoreBoard(*board, ScoringRule::AREA));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()));
+}
+BENCHMARK(BM_ScoreBoard);
+
+static void BM_SaveTree(benchmark::State &state) {
+    auto root = LoadSGF(syntheticCollection(1, static_cast<int>(state.range(0))), NodeArena::Create());
+    size_t bytes = 0;
+    for (auto _: state) {
+        auto sgf = root->Save();
+        bytes = sgf.size();
+        benchmark::DoNotOptimize(sgf);
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(bytes));
+}
+BENCHMARK(BM_SaveTree)->Arg(100000);
+
+static void BM_WriteSGFFile(benchmark::State &state) {
+    auto root = LoadSGF(syntheticCollection(1, static_cast<int>(state.range(0))), NodeArena::Create());
+    std::string path = "bench_save_" + std::to_string(state.range(0)) + ".sgf";
+    for (auto _: state) {
+        SaveFile(path, root);
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(root->Save().size()));
+    std::remove(path.c_str());
+}
+BENCHMARK(BM_WriteSGFFile)->Arg(100000);
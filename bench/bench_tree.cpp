@@ -0,0 +1,204 @@
+#include <benchmark/benchmark.h>
+
+#include "bench_util.h"
+#include "concurrent.h"
+#include "cursor.h"
+#include "node.h"
+
+// Tree benchmarks take a tree shape as {depth, branching}: {N, 1} is a single
+// line of N moves, larger branching gives a complete tree.
+
+static void BM_NodePlayColour(benchmark::State &state) {
+    int size = 19;
+    auto moves = randomMoves(size, static_cast<int>(state.range(0)));
+    std::vector<std::string> points;
+    for (int i: moves) {
+        points.push_back(Point(i % size, i / size));
+    }
+    for (auto _: state) {
+        auto node = NodeArena::Create()->NewRoot();
+        Colour c = Colour::BLACK;
+        for (auto &p: points) {
+            node = node->PlayColour(p, c, true);
+            c = Opponent(c);
+        }
+        benchmark::DoNotOptimize(node);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(points.size()));
+}
+BENCHMARK(BM_NodePlayColour)->Arg(100)->Arg(300);
+
+// BM_GetBoardCold builds the board at the end of a line with an empty cache.
+static void BM_GetBoardCold(benchmark::State &state) {
+    auto root = bushyTree(static_cast<int>(state.range(0)), 1);
+    auto end = root->GetEnd();
+    for (auto _: state) {
+        root->clearBoardCacheRecursive();
+        benchmark::DoNotOptimize(end->GetBoard());
+    }
+}
+BENCHMARK(BM_GetBoardCold)->Arg(100)->Arg(1000);
+
+// BM_GetBoardWalk asks for the board of every node of a line in order, as a
+// viewer stepping through a game does.
+static void BM_GetBoardWalk(benchmark::State &state) {
+    auto root = bushyTree(static_cast<int>(state.range(0)), 1);
+    auto nodes = root->GetEnd()->GetLine();
+    for (auto _: state) {
+        root->clearBoardCacheRecursive();
+        for (auto &node: nodes) {
+            benchmark::DoNotOptimize(node->GetBoard());
+        }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(nodes.size()));
+}
+BENCHMARK(BM_GetBoardWalk)->Arg(300);
+
+// BM_CursorWalk steps a cursor down a line and back to the root, or across a
+// bushy tree between its last and first leaves.
+static void BM_CursorWalk(benchmark::State &state) {
+    auto root = bushyTree(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    auto end = root->GetEnd();
+    Node *first = root.get();
+    while (Node *child = first->firstChild()) {
+        first = child;
+    }
+    Cursor cursor(root);
+    int64_t steps = 0;
+    for (auto _: state) {
+        cursor.Jump(*end);
+        cursor.Jump(end.get() == first ? *root : *first);
+        steps += 2 * static_cast<int64_t>(end->Depth());
+    }
+    state.SetItemsProcessed(steps);
+}
+BENCHMARK(BM_CursorWalk)->Args({300, 1})->Args({8, 3});
+
+// BM_GetBoardEveryNode caches a board at every node of a line, and reports
+// the bytes each cached board adds.
+static void BM_GetBoardEveryNode(benchmark::State &state) {
+    auto root = bushyTree(static_cast<int>(state.range(0)), 1);
+    root->SetBoardCache(1, SIZE_MAX);
+    auto nodes = root->GetEnd()->GetLine();
+    size_t bytes = 0;
+    for (auto _: state) {
+        root->clearBoardCacheRecursive();
+        bytes = 0;
+        for (auto &node: nodes) {
+            bytes += node->GetBoard()->MemoryUsage();
+        }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(nodes.size()));
+    state.counters["bytes_per_node"] = static_cast<double>(bytes) / static_cast<double>(nodes.size());
+}
+BENCHMARK(BM_GetBoardEveryNode)->Arg(300);
+
+static void BM_GetLine(benchmark::State &state) {
+    auto root = bushyTree(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    auto end = root->GetEnd();
+    for (auto _: state) {
+        benchmark::DoNotOptimize(end->GetLine());
+    }
+}
+BENCHMARK(BM_GetLine)->Args({300, 1})->Args({3000, 1})->Args({8, 3});
+
+// BM_Walk visits every node of a tree with Node::Walk, pre and post.
+static void BM_Walk(benchmark::State &state) {
+    auto root = bushyTree(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    int64_t nodes = 0;
+    for (auto _: state) {
+        nodes = 0;
+        root->Walk([&nodes](Node *) { nodes++; }, [](Node *node) { benchmark::DoNotOptimize(node); });
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * nodes);
+}
+BENCHMARK(BM_Walk)->Args({3000, 1})->Args({8, 3})->Args({5, 8});
+
+// BM_CommonAncestor finds where the first and last leaves of a tree branch.
+static void BM_CommonAncestor(benchmark::State &state) {
+    auto root = bushyTree(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    Node *first = root.get();
+    while (Node *child = first->firstChild()) {
+        first = child;
+    }
+    auto last = root->GetEnd();
+    for (auto _: state) {
+        benchmark::DoNotOptimize(last->commonAncestor(first));
+    }
+}
+BENCHMARK(BM_CommonAncestor)->Args({3000, 1})->Args({8, 3});
+
+// BM_ReplayFrom moves a board between the ends of the first and last
+// variations of a tree.
+static void BM_ReplayFrom(benchmark::State &state) {
+    auto root = bushyTree(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    Node *from = root.get();
+    for (Node *node: root->MainLine()) {
+        from = node;
+    }
+    auto to = root->GetEnd();
+    auto board = from->GetBoard()->Copy();
+    for (auto _: state) {
+        benchmark::DoNotOptimize(to->ReplayFrom(*from, board));
+    }
+}
+BENCHMARK(BM_ReplayFrom)->Args({8, 3})->Args({6, 8});
+
+// BM_SharedTreeWalk walks every published node of a tree shared with
+// SharedTree, as a reader thread does.
+static void BM_SharedTreeWalk(benchmark::State &state) {
+    auto root = bushyTree(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    SharedTree tree(root);
+    size_t nodes = 0;
+    for (auto _: state) {
+        SharedTree::Reader reader(tree);
+        std::vector<SharedNode> stack{reader.Root()};
+        nodes = 0;
+        while (!stack.empty()) {
+            SharedNode n = stack.back();
+            stack.pop_back();
+            nodes++;
+            for (size_t i = 0; i < n.ChildCount(); i++) {
+                stack.push_back(n.Child(i));
+            }
+        }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(nodes));
+}
+BENCHMARK(BM_SharedTreeWalk)->Args({3000, 1})->Args({8, 3});
+
+// BM_SharedTreeSetValue rewrites a comment through a SharedTree, which
+// publishes a new version of the node and retires the old one.
+static void BM_SharedTreeSetValue(benchmark::State &state) {
+    auto root = bushyTree(300, 1);
+    SharedTree tree(root);
+    auto node = root->MainChild();
+    for (auto _: state) {
+        tree.SetValue(*node, Key::C, "a comment");
+    }
+}
+BENCHMARK(BM_SharedTreeSetValue);
+
+static void BM_SubtreeSize(benchmark::State &state) {
+    auto root = bushyTree(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _: state) {
+        benchmark::DoNotOptimize(root->SubtreeSize());
+    }
+}
+BENCHMARK(BM_SubtreeSize)->Args({3000, 1})->Args({8, 3})->Args({4, 10});
+
+static void BM_Dyer(benchmark::State &state) {
+    auto root = bushyTree(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _: state) {
+        benchmark::DoNotOptimize(root->Dyer());
+    }
+}
+BENCHMARK(BM_Dyer)->Args({300, 1})->Args({8, 3});
+
+static void BM_SaveShape(benchmark::State &state) {
+    auto root = bushyTree(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)));
+    for (auto _: state) {
+        benchmark::DoNotOptimize(root->Save());
+    }
+}
+BENCHMARK(BM_SaveShape)->Args({3000, 1})->Args({8, 3});
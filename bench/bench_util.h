@@ -0,0 +1,101 @@
+#ifndef CONSOLEGO_BENCH_UTIL_H
+#define CONSOLEGO_BENCH_UTIL_H
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "board.h"
+#include "node.h"
+
+// syntheticCollection returns an SGF collection of games with the given
+// number of moves each, with a comment every ten moves and a short variation
+// every fifty.
+inline std::string syntheticCollection(int games, int moves) {
+    std::mt19937 rng(1);
+    std::string sgf;
+    for (int g = 0; g < games; g++) {
+        sgf += "(;GM[1]FF[4]SZ[19]KM[6.5]PB[Black player]PW[White player]RE[B+R]\n";
+        int open = 0;
+        for (int m = 0; m < moves; m++) {
+            sgf += m % 2 == 0 ? ";B[" : ";W[";
+            sgf += alpha[rng() % 19];
+            sgf += alpha[rng() % 19];
+            sgf += "]";
+            if (m % 10 == 9) {
+                sgf += "C[a comment with an escaped \\] bracket]";
+            }
+            if (m % 50 == 49) {
+                sgf += "(;B[aa];W[bb])(";
+                open++;
+            }
+            if (m % 20 == 19) {
+                sgf += "\n";
+            }
+        }
+        for (int i = 0; i <= open; i++) {
+            sgf += ")";
+        }
+        sgf += "\n";
+    }
+    return sgf;
+}
+
+// randomMoves plays random legal moves on a fresh board of the given size and
+// returns their point indexes; a player with no legal move ends the list.
+inline std::vector<int> randomMoves(int size, int moves, uint32_t seed = 1) {
+    std::mt19937 rng(seed);
+    Board board(size);
+    std::vector<int> ret;
+    for (int m = 0; m < moves; m++) {
+        int points = size * size;
+        int start = static_cast<int>(rng() % points);
+        int played = noPoint;
+        for (int k = 0; k < points && played == noPoint; k++) {
+            int i = (start + k) % points;
+            if (board.legal(i, board.player)) {
+                played = i;
+            }
+        }
+        if (played == noPoint) {
+            break;
+        }
+        board.playMove(played, board.player);
+        ret.push_back(played);
+    }
+    return ret;
+}
+
+// randomBoard returns the position after randomMoves.
+inline std::shared_ptr<Board> randomBoard(int size, int moves, uint32_t seed = 1) {
+    auto board = std::make_shared<Board>(size);
+    for (int i: randomMoves(size, moves, seed)) {
+        board->playMove(i, board->player);
+    }
+    return board;
+}
+
+// bushyTree builds a tree in an arena in which every node down to the given
+// depth has the given number of children. Branching 1 gives a single line.
+inline std::shared_ptr<Node> bushyTree(int depth, int branching, int size = 19) {
+    auto root = NodeArena::Create()->NewRoot();
+    root->SetValue(Key::SZ, std::to_string(size));
+    std::vector<std::shared_ptr<Node>> level{root};
+    std::mt19937 rng(1);
+    for (int d = 0; d < depth; d++) {
+        std::vector<std::shared_ptr<Node>> next;
+        for (auto &node: level) {
+            for (int b = 0; b < branching; b++) {
+                auto child = Node::NewNode(node);
+                std::string mv{alpha[rng() % size], alpha[rng() % size]};
+                child->SetValue(d % 2 == 0 ? Key::B : Key::W, mv);
+                next.push_back(child);
+            }
+        }
+        level = std::move(next);
+    }
+    return root;
+}
+
+#endif // CONSOLEGO_BENCH_UTIL_H
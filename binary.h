@@ -0,0 +1,496 @@
+#ifndef CONSOLEGO_BINARY_H
+#define CONSOLEGO_BINARY_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "io.h"
+#include "node.h"
+#include "utils.h"
+
+// The binary game format stores Node trees losslessly, several times smaller
+// than SGF and much faster to load. A file is binaryMagic followed by games,
+// each a varint byte length and then:
+//
+//   varint size                 board size the moves are coded for
+//   varint keys, keys           the property identifiers used below, each a
+//                               varint length and the bytes
+//   record                      the root's properties
+//   varint tokens, varint bytes then the tokens, packed into bytes
+//   side                        records and fork counts, in tree order
+//
+// Every node but the root is one token of tokenBits(size) bits: 9 bits on
+// 19x19 and 7 on 9x9. A node that is just a move of the expected colour is
+// the point, or binaryPass for an empty value; the expected colour is
+// black, or the root's PL, and after a move the other colour. Any other node
+// is binaryRecord, and its properties are the next record of the side
+// stream: a varint count of properties, each a varint key index, a varint
+// count of values, and each value as a varint length and the bytes.
+//
+// Nodes are in preorder. A node without children is followed by binaryEnd,
+// and a node with more than one by binaryFork, its number of children being
+// the next varint of the side stream. All varints are LEB128.
+constexpr char binaryMagic[8] = {'W', 'G', 'O', 'B', 'I', 'N', '\0', '\1'};
+
+enum : uint32_t {
+    binaryPass = 0,
+    binaryRecord = 1,
+    binaryEnd = 2,
+    binaryFork = 3,
+    binaryCodes = 4,
+};
+
+// tokenBits returns the width of the tokens of a game on a board of the given
+// size: enough for every point, after the binaryCodes special tokens.
+inline int tokenBits(int size) {
+    uint32_t codes = static_cast<uint32_t>(size * size) + binaryCodes;
+    int bits = 1;
+    while ((1u << bits) < codes) {
+        bits++;
+    }
+    return bits;
+}
+
+inline void putVarint(std::string &out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+// BinaryWriter encodes game trees in the binary game format.
+class BinaryWriter {
+public:
+    // Write appends the game containing node to out, without the file magic.
+    void Write(std::string &out, const Node &node) {
+        const Node *root = &node;
+        while (Node *p = root->parentNode()) {
+            root = p;
+        }
+        auto sz = root->GetValueView(Key::SZ);
+        this->size = sz.empty() ? 19 : std::atoi(std::string(sz).c_str());
+        if (this->size < 1 || this->size > maxBoardSize) {
+            this->size = 19;
+        }
+        this->bits = tokenBits(this->size);
+        this->keys.clear();
+        this->keyIndex.clear();
+        this->tokens.clear();
+        this->side.clear();
+        this->acc = 0;
+        this->pending = 0;
+        this->count = 0;
+
+        std::string rootRecord;
+        this->record(rootRecord, *root);
+        // Each entry is a node to write and the colour expected to move at it.
+        std::vector<std::pair<const Node *, Colour>> stack;
+        Colour expected = root->GetValueView(Key::PL) == "W" ? Colour::WHITE : Colour::BLACK;
+        this->structure(*root, nextColour(*root, expected), stack);
+        while (!stack.empty()) {
+            auto [n, colour] = stack.back();
+            stack.pop_back();
+            this->token(nodeToken(*n, colour));
+            this->structure(*n, nextColour(*n, colour), stack);
+        }
+        if (this->pending > 0) {
+            this->tokens.push_back(static_cast<char>(this->acc));
+        }
+
+        std::string body;
+        putVarint(body, static_cast<uint64_t>(this->size));
+        putVarint(body, this->keys.size());
+        for (auto &k: this->keys) {
+            putVarint(body, k.size());
+            body += k;
+        }
+        body += rootRecord;
+        putVarint(body, this->count);
+        putVarint(body, this->tokens.size());
+        body += this->tokens;
+        body += this->side;
+        putVarint(out, body.size());
+        out += body;
+    }
+
+    // nextColour returns the colour expected to move after n, if colour was
+    // expected to move at it.
+    static Colour nextColour(const Node &n, Colour colour) {
+        if (n.key_index(Key::B) != -1) {
+            return Colour::WHITE;
+        }
+        if (n.key_index(Key::W) != -1) {
+            return Colour::BLACK;
+        }
+        return colour;
+    }
+
+private:
+    int size = 19;
+    int bits = 0;
+    std::vector<std::string> keys;
+    std::unordered_map<PropKey, uint32_t> keyIndex;
+    std::string tokens;
+    std::string side;
+    uint64_t acc = 0;
+    int pending = 0;
+    uint64_t count = 0;
+
+    void token(uint32_t t) {
+        this->acc |= static_cast<uint64_t>(t) << this->pending;
+        this->pending += this->bits;
+        while (this->pending >= 8) {
+            this->tokens.push_back(static_cast<char>(this->acc));
+            this->acc >>= 8;
+            this->pending -= 8;
+        }
+        this->count++;
+    }
+
+    // structure writes how many children n has and pushes them to be written
+    // next, in order.
+    void structure(const Node &n, Colour colour, std::vector<std::pair<const Node *, Colour>> &stack) {
+        size_t first = stack.size();
+        n.eachChild([&](Node *child) { stack.emplace_back(child, colour); });
+        size_t children = stack.size() - first;
+        if (children == 0) {
+            this->token(binaryEnd);
+        } else if (children > 1) {
+            this->token(binaryFork);
+            putVarint(this->side, children);
+        }
+        std::reverse(stack.begin() + static_cast<std::ptrdiff_t>(first), stack.end());
+    }
+
+    // nodeToken returns the token of n, and writes its record to the side
+    // stream if it is not just a move of the expected colour.
+    uint32_t nodeToken(const Node &n, Colour colour) {
+        if (n.props.size() == 1 && n.props[0].values.size() == 1 &&
+            n.props[0].key == (colour == Colour::WHITE ? Key::W : Key::B)) {
+            auto v = n.props[0].values[0].view();
+            if (v.empty()) {
+                return binaryPass;
+            }
+            auto [x, y, onboard] = ParsePoint(v, this->size);
+            if (onboard) {
+                return binaryCodes + static_cast<uint32_t>(y * this->size + x);
+            }
+        }
+        this->record(this->side, n);
+        return binaryRecord;
+    }
+
+    void record(std::string &out, const Node &n) {
+        putVarint(out, n.props.size());
+        for (auto &prop: n.props) {
+            auto [it, added] = this->keyIndex.emplace(prop.key, static_cast<uint32_t>(this->keys.size()));
+            if (added) {
+                this->keys.push_back(KeyName(prop.key));
+            }
+            putVarint(out, it->second);
+            putVarint(out, prop.values.size());
+            for (auto &val: prop.values) {
+                auto v = val.view();
+                putVarint(out, v.size());
+                out.append(v.data(), v.size());
+            }
+        }
+    }
+};
+
+// BinaryParser builds Node trees from the games of a binary game file. Nodes
+// are created directly under their parents without taking handles to them,
+// and move values come from a table of point names, so loading costs little
+// more than allocating the nodes. If an arena is given, the trees are built
+// in it.
+class BinaryParser {
+public:
+    // BinaryParser takes the whole file, including the magic, or if magic is
+    // false just games, as written by BinaryWriter::Write.
+    explicit BinaryParser(std::string_view data, std::shared_ptr<NodeArena> arena = nullptr, bool magic = true) :
+        in(data), arena(std::move(arena)) {
+        if (!magic) {
+            return;
+        }
+        if (in.size() < sizeof(binaryMagic) || std::memcmp(in.data(), binaryMagic, sizeof(binaryMagic)) != 0) {
+            throw std::runtime_error("binary game: bad magic");
+        }
+        pos = sizeof(binaryMagic);
+    }
+
+    // Next parses the next game, or returns nullptr at the end of the file.
+    std::shared_ptr<Node> Next() {
+        if (this->pos >= this->in.size()) {
+            return nullptr;
+        }
+        uint64_t length = this->varint();
+        if (length > this->in.size() - this->pos) {
+            throw this->error("truncated game");
+        }
+        size_t end = this->pos + length;
+        auto root = this->game(end);
+        if (this->pos != end) {
+            throw this->error("trailing bytes in game");
+        }
+        return root;
+    }
+
+private:
+    struct fork {
+        Node *node;
+        uint64_t remaining;
+        Colour colour;
+    };
+
+    std::string_view in;
+    std::shared_ptr<NodeArena> arena;
+    size_t pos = 0;
+    std::vector<PropKey> keys;
+    std::vector<std::array<char, 2>> names;
+    std::vector<fork> forks;
+
+    std::shared_ptr<Node> game(size_t end) {
+        uint64_t size = this->varint();
+        if (size < 1 || size > maxBoardSize) {
+            throw this->error("board size not supported");
+        }
+        int sz = static_cast<int>(size);
+        uint64_t nkeys = this->varint();
+        this->keys.clear();
+        for (uint64_t k = 0; k < nkeys; k++) {
+            this->keys.push_back(InternKey(this->bytes()));
+        }
+        if (this->names.size() != size * size) {
+            this->names.resize(size * size);
+            for (int i = 0; i < sz * sz; i++) {
+                auto p = Point(i % sz, i / sz);
+                this->names[i] = {p[0], p[1]};
+            }
+        }
+
+        auto root = this->arena ? this->arena->NewRoot() : Node::NewNode(nullptr);
+        this->record(*root);
+        uint64_t count = this->varint();
+        uint64_t tokenBytes = this->varint();
+        if (tokenBytes > end - this->pos || count > tokenBytes * 8 / tokenBits(sz)) {
+            throw this->error("truncated tokens");
+        }
+        const auto *tok = reinterpret_cast<const unsigned char *>(this->in.data() + this->pos);
+        size_t tokPos = 0;
+        this->pos += tokenBytes;
+
+        int bits = tokenBits(sz);
+        uint32_t mask = (1u << bits) - 1;
+        uint64_t acc = 0;
+        int avail = 0;
+        auto next = [&]() -> uint32_t {
+            if (count == 0) {
+                throw this->error("truncated tokens");
+            }
+            count--;
+            while (avail < bits) {
+                acc |= static_cast<uint64_t>(tok[tokPos++]) << avail;
+                avail += 8;
+            }
+            auto t = static_cast<uint32_t>(acc) & mask;
+            acc >>= bits;
+            avail -= bits;
+            return t;
+        };
+
+        Colour expected = root->GetValueView(Key::PL) == "W" ? Colour::WHITE : Colour::BLACK;
+        Node *parent = root.get();
+        Colour colour = BinaryWriter::nextColour(*parent, expected);
+        this->forks.clear();
+        for (;;) {
+            uint32_t t = next();
+            if (t == binaryEnd) {
+                while (!this->forks.empty() && this->forks.back().remaining == 0) {
+                    this->forks.pop_back();
+                }
+                if (this->forks.empty()) {
+                    break;
+                }
+                parent = this->forks.back().node;
+                colour = this->forks.back().colour;
+                this->forks.back().remaining--;
+                t = next();
+            } else if (t == binaryFork) {
+                uint64_t n = this->varint();
+                if (n < 2) {
+                    throw this->error("bad fork");
+                }
+                this->forks.push_back(fork{parent, n - 1, colour});
+                t = next();
+            }
+            if (t == binaryEnd || t == binaryFork) {
+                throw this->error("misplaced token");
+            }
+            Node *child = this->attach(parent);
+            PropKey key = colour == Colour::WHITE ? Key::W : Key::B;
+            if (t == binaryPass) {
+                child->props.push_back(Property{key, {ShortString()}});
+            } else if (t == binaryRecord) {
+                this->record(*child);
+            } else if (t - binaryCodes < size * size) {
+                auto &p = this->names[t - binaryCodes];
+                child->props.push_back(Property{key, {ShortString(std::string_view(p.data(), 2))}});
+            } else {
+                throw this->error("bad point");
+            }
+            colour = BinaryWriter::nextColour(*child, colour);
+            parent = child;
+        }
+        if (count != 0) {
+            throw this->error("trailing tokens");
+        }
+        return root;
+    }
+
+    // attach creates a node as the last child of parent.
+    Node *attach(Node *parent) {
+        Node *node;
+        if (this->arena) {
+            node = this->arena->allocate();
+            parent->linkChild(node, false);
+        } else {
+            parent->children.push_back(std::make_shared<Node>());
+            node = parent->children.back().get();
+            node->parent = parent->weak_from_this();
+        }
+        node->cache = parent->cache;
+        node->placeUnder(parent);
+        return node;
+    }
+
+    void record(Node &node) {
+        uint64_t nprops = this->varint();
+        for (uint64_t p = 0; p < nprops; p++) {
+            uint64_t k = this->varint();
+            if (k >= this->keys.size()) {
+                throw this->error("bad key index");
+            }
+            uint64_t nvalues = this->varint();
+            if (nvalues == 0) {
+                throw this->error("property without values");
+            }
+            for (uint64_t v = 0; v < nvalues; v++) {
+                node.appendValue(this->keys[k], this->bytes());
+            }
+        }
+    }
+
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (this->pos >= this->in.size()) {
+                throw this->error("truncated varint");
+            }
+            auto b = static_cast<unsigned char>(this->in[this->pos++]);
+            v |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if (!(b & 0x80)) {
+                return v;
+            }
+        }
+        throw this->error("bad varint");
+    }
+
+    std::string_view bytes() {
+        uint64_t n = this->varint();
+        if (n > this->in.size() - this->pos) {
+            throw this->error("truncated value");
+        }
+        auto ret = this->in.substr(this->pos, n);
+        this->pos += n;
+        return ret;
+    }
+
+    std::runtime_error error(const std::string &what) const {
+        return std::runtime_error("binary game: " + what + " at offset " + std::to_string(this->pos));
+    }
+};
+
+// EncodeBinaryCollection returns a binary game file holding the whole trees of
+// the given nodes.
+inline std::string EncodeBinaryCollection(const std::vector<std::shared_ptr<Node>> &nodes) {
+    std::string out(binaryMagic, sizeof(binaryMagic));
+    BinaryWriter w;
+    for (auto &node: nodes) {
+        if (node) {
+            w.Write(out, *node);
+        }
+    }
+    return out;
+}
+
+// EncodeBinary returns a binary game file holding the whole tree containing
+// node.
+inline std::string EncodeBinary(const std::shared_ptr<Node> &node) { return EncodeBinaryCollection({node}); }
+
+// DecodeBinaryCollection parses every game of a binary game file.
+inline std::vector<std::shared_ptr<Node>> DecodeBinaryCollection(std::string_view data,
+                                                                 std::shared_ptr<NodeArena> arena = nullptr) {
+    BinaryParser parser(data, std::move(arena));
+    std::vector<std::shared_ptr<Node>> ret;
+    while (auto root = parser.Next()) {
+        ret.push_back(std::move(root));
+    }
+    return ret;
+}
+
+// DecodeBinary parses a binary game file and returns the root of its first
+// game.
+inline std::shared_ptr<Node> DecodeBinary(std::string_view data, std::shared_ptr<NodeArena> arena = nullptr) {
+    auto root = BinaryParser(data, std::move(arena)).Next();
+    if (!root) {
+        throw std::runtime_error("binary game: no game");
+    }
+    return root;
+}
+
+// LoadBinaryCollection memory-maps a binary game file and parses every game in
+// it.
+inline std::vector<std::shared_ptr<Node>> LoadBinaryCollection(const std::string &path,
+                                                               std::shared_ptr<NodeArena> arena = nullptr) {
+    MappedFile file(path);
+    return DecodeBinaryCollection(file.View(), std::move(arena));
+}
+
+// LoadBinary memory-maps a binary game file and returns the root of its first
+// game.
+inline std::shared_ptr<Node> LoadBinary(const std::string &path, std::shared_ptr<NodeArena> arena = nullptr) {
+    MappedFile file(path);
+    return DecodeBinary(file.View(), std::move(arena));
+}
+
+// SaveBinaryCollectionFile saves the whole trees of the given nodes to a
+// binary game file.
+inline void SaveBinaryCollectionFile(const std::string &path, const std::vector<std::shared_ptr<Node>> &nodes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("SaveBinaryCollectionFile(): cannot open " + path);
+    }
+    auto data = EncodeBinaryCollection(nodes);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!out.flush()) {
+        throw std::runtime_error("SaveBinaryCollectionFile(): write failed");
+    }
+}
+
+// SaveBinaryFile saves the whole tree containing node to a binary game file.
+inline void SaveBinaryFile(const std::string &path, const std::shared_ptr<Node> &node) {
+    SaveBinaryCollectionFile(path, {node});
+}
+
+#endif // CONSOLEGO_BINARY_H
@@ -0,0 +1,304 @@
+#ifndef CONSOLEGO_BITBOARD_H
+#define CONSOLEGO_BITBOARD_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Boards are at most 52x52, the limit of the SGF coordinate alphabet.
+constexpr int maxBoardSize = 52;
+constexpr int maxPoints = maxBoardSize * maxBoardSize;
+
+// noPoint is the integer point index used for "no point", e.g. no ko.
+constexpr int noPoint = -1;
+
+// 2704 bits rounded up to a whole number of 256-bit lanes.
+constexpr int bitboardWords = 44;
+
+// PointIndex converts 0-based x, y coordinates to a row-major point index.
+inline int PointIndex(int x, int y, int size) { return y * size + x; }
+
+// Bitboard is a fixed-size bitset with one bit per point of a board, indexed by
+// PointIndex(). Only the first WordsFor(size) words are ever non-zero.
+struct Bitboard {
+    std::array<uint64_t, bitboardWords> words{};
+
+    static int WordsFor(int size) { return (size * size + 63) / 64; }
+
+    bool Test(int i) const { return (words[i >> 6] >> (i & 63)) & 1; }
+
+    void Set(int i) { words[i >> 6] |= uint64_t(1) << (i & 63); }
+
+    void Reset(int i) { words[i >> 6] &= ~(uint64_t(1) << (i & 63)); }
+
+    void Clear() { words.fill(0); }
+
+    // Equals compares the first nwords words.
+    bool Equals(const Bitboard &other, int nwords) const {
+        return std::memcmp(words.data(), other.words.data(), nwords * sizeof(uint64_t)) == 0;
+    }
+
+    // Range returns the n <= 64 bits starting at bit start, lowest first. A row
+    // of a board of up to 64 columns is Range(PointIndex(0, y, size), size).
+    uint64_t Range(int start, int n) const {
+        int w = start >> 6;
+        int off = start & 63;
+        uint64_t v = words[w] >> off;
+        if (off + n > 64) {
+            v |= words[w + 1] << (64 - off);
+        }
+        return n == 64 ? v : v & ((uint64_t(1) << n) - 1);
+    }
+
+    int Count(int nwords) const {
+        int n = 0;
+        for (int i = 0; i < nwords; i++) {
+            n += __builtin_popcountll(words[i]);
+        }
+        return n;
+    }
+};
+
+// Adjacent lists the on-board orthogonal neighbours of one point.
+struct Adjacent {
+    std::array<int16_t, 4> n;
+    uint8_t count;
+};
+
+// NeighbourTable holds the Adjacent list of every point of a board size, so
+// that hot loops never divide a point index back into x and y.
+struct NeighbourTable {
+    int size;
+    std::vector<Adjacent> adj;
+
+    explicit NeighbourTable(int sz) : size(sz), adj(sz * sz) {
+        for (int y = 0; y < sz; y++) {
+            for (int x = 0; x < sz; x++) {
+                Adjacent &a = adj[PointIndex(x, y, sz)];
+                a.count = 0;
+                if (x > 0) {
+                    a.n[a.count++] = PointIndex(x - 1, y, sz);
+                }
+                if (x < sz - 1) {
+                    a.n[a.count++] = PointIndex(x + 1, y, sz);
+                }
+                if (y > 0) {
+                    a.n[a.count++] = PointIndex(x, y - 1, sz);
+                }
+                if (y < sz - 1) {
+                    a.n[a.count++] = PointIndex(x, y + 1, sz);
+                }
+            }
+        }
+    }
+
+    const Adjacent &operator[](int i) const { return adj[i]; }
+};
+
+// Neighbours returns the shared NeighbourTable for a board size, building it on
+// first use.
+inline const NeighbourTable &Neighbours(int size) {
+    static std::array<std::once_flag, maxBoardSize + 1> once;
+    static std::array<std::unique_ptr<NeighbourTable>, maxBoardSize + 1> tables;
+    std::call_once(once[size], [size] { tables[size] = std::make_unique<NeighbourTable>(size); });
+    return *tables[size];
+}
+
+// EdgeMasks holds the masks that keep shifted bitboards on one board size.
+struct EdgeMasks {
+    int size;
+    int nwords;
+    Bitboard onBoard;
+    Bitboard notFirstColumn;
+    Bitboard notLastColumn;
+
+    explicit EdgeMasks(int sz) : size(sz), nwords(Bitboard::WordsFor(sz)) {
+        for (int y = 0; y < sz; y++) {
+            for (int x = 0; x < sz; x++) {
+                int i = PointIndex(x, y, sz);
+                onBoard.Set(i);
+                if (x > 0) {
+                    notFirstColumn.Set(i);
+                }
+                if (x < sz - 1) {
+                    notLastColumn.Set(i);
+                }
+            }
+        }
+    }
+};
+
+// Edges returns the shared EdgeMasks for a board size, building them on first
+// use.
+inline const EdgeMasks &Edges(int size) {
+    static std::array<std::once_flag, maxBoardSize + 1> once;
+    static std::array<std::unique_ptr<EdgeMasks>, maxBoardSize + 1> masks;
+    std::call_once(once[size], [size] { masks[size] = std::make_unique<EdgeMasks>(size); });
+    return *masks[size];
+}
+
+// dilateScalar returns x plus the orthogonal neighbours of every point in x.
+// Points move by one bit to the left and right neighbours and by a whole row
+// up and down; the edge masks drop the bits that would wrap to another row or
+// fall off the board.
+inline Bitboard dilateScalar(const Bitboard &x, const EdgeMasks &e) {
+    Bitboard ret;
+    int n = e.nwords;
+    int row = e.size;
+    for (int w = 0; w < n; w++) {
+        uint64_t v = x.words[w];
+        uint64_t left = v << 1 | (w > 0 ? x.words[w - 1] >> 63 : 0);
+        uint64_t right = v >> 1 | (w + 1 < n ? x.words[w + 1] << 63 : 0);
+        uint64_t down = v << row | (w > 0 ? x.words[w - 1] >> (64 - row) : 0);
+        uint64_t up = v >> row | (w + 1 < n ? x.words[w + 1] << (64 - row) : 0);
+        ret.words[w] = (v | (left & e.notFirstColumn.words[w]) | (right & e.notLastColumn.words[w]) | down | up) &
+                       e.onBoard.words[w];
+    }
+    return ret;
+}
+
+// floodFillScalar returns the points of within that are connected to seed
+// through within.
+inline Bitboard floodFillScalar(const Bitboard &seed, const Bitboard &within, const EdgeMasks &e) {
+    Bitboard region = seed;
+    for (;;) {
+        Bitboard grown = dilateScalar(region, e);
+        bool changed = false;
+        for (int w = 0; w < e.nwords; w++) {
+            grown.words[w] &= within.words[w];
+            changed |= grown.words[w] != region.words[w];
+        }
+        if (!changed) {
+            return region;
+        }
+        region = grown;
+    }
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CONSOLEGO_AVX2_KERNELS 1
+
+// The AVX2 kernels work on four words at a time. A bitboard is copied into a
+// buffer with zero words on either side, so the words before and after each
+// group of four are plain unaligned loads, with no edge cases.
+constexpr int paddedFront = 4;
+constexpr int paddedWords = bitboardWords + 2 * paddedFront;
+
+__attribute__((target("avx2"))) inline void dilateAVX2(const uint64_t *x, uint64_t *out, const EdgeMasks &e) {
+    const __m128i one = _mm_cvtsi32_si128(1);
+    const __m128i carry = _mm_cvtsi32_si128(63);
+    const __m128i row = _mm_cvtsi32_si128(e.size);
+    const __m128i rowCarry = _mm_cvtsi32_si128(64 - e.size);
+    for (int w = 0; w < e.nwords; w += 4) {
+        __m256i v = _mm256_load_si256(reinterpret_cast<const __m256i *>(x + w));
+        __m256i prev = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + w - 1));
+        __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + w + 1));
+        __m256i left = _mm256_or_si256(_mm256_sll_epi64(v, one), _mm256_srl_epi64(prev, carry));
+        __m256i right = _mm256_or_si256(_mm256_srl_epi64(v, one), _mm256_sll_epi64(next, carry));
+        __m256i down = _mm256_or_si256(_mm256_sll_epi64(v, row), _mm256_srl_epi64(prev, rowCarry));
+        __m256i up = _mm256_or_si256(_mm256_srl_epi64(v, row), _mm256_sll_epi64(next, rowCarry));
+        left = _mm256_and_si256(left, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&e.notFirstColumn.words[w])));
+        right = _mm256_and_si256(right, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&e.notLastColumn.words[w])));
+        __m256i all = _mm256_or_si256(_mm256_or_si256(v, left), _mm256_or_si256(right, _mm256_or_si256(down, up)));
+        all = _mm256_and_si256(all, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&e.onBoard.words[w])));
+        _mm256_store_si256(reinterpret_cast<__m256i *>(out + w), all);
+    }
+}
+
+__attribute__((target("avx2"))) inline Bitboard dilateAVX2(const Bitboard &x, const EdgeMasks &e) {
+    // Only the groups of four words that dilateAVX2 reads need copying, and
+    // only the words either side of them need zeroing.
+    int n = (e.nwords + 3) & ~3;
+    alignas(32) uint64_t in[paddedWords];
+    alignas(32) uint64_t out[paddedWords];
+    in[paddedFront - 1] = 0;
+    in[paddedFront + n] = 0;
+    std::memcpy(in + paddedFront, x.words.data(), n * sizeof(uint64_t));
+    dilateAVX2(in + paddedFront, out + paddedFront, e);
+    Bitboard ret;
+    std::memcpy(ret.words.data(), out + paddedFront, e.nwords * sizeof(uint64_t));
+    return ret;
+}
+
+// floodFillAVX2 dilates in place in the padded buffers, and stops when a
+// round adds nothing.
+__attribute__((target("avx2"))) inline Bitboard floodFillAVX2(const Bitboard &seed, const Bitboard &within,
+                                                              const EdgeMasks &e) {
+    alignas(32) uint64_t a[paddedWords] = {};
+    alignas(32) uint64_t b[paddedWords] = {};
+    std::memcpy(a + paddedFront, seed.words.data(), sizeof(seed.words));
+    uint64_t *region = a + paddedFront;
+    uint64_t *grown = b + paddedFront;
+    for (;;) {
+        dilateAVX2(region, grown, e);
+        __m256i changed = _mm256_setzero_si256();
+        for (int w = 0; w < e.nwords; w += 4) {
+            __m256i g = _mm256_and_si256(_mm256_load_si256(reinterpret_cast<const __m256i *>(grown + w)),
+                                         _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&within.words[w])));
+            _mm256_store_si256(reinterpret_cast<__m256i *>(grown + w), g);
+            __m256i r = _mm256_load_si256(reinterpret_cast<const __m256i *>(region + w));
+            changed = _mm256_or_si256(changed, _mm256_xor_si256(g, r));
+        }
+        std::swap(region, grown);
+        if (_mm256_testz_si256(changed, changed)) {
+            break;
+        }
+    }
+    Bitboard ret;
+    std::memcpy(ret.words.data(), region, e.nwords * sizeof(uint64_t));
+    return ret;
+}
+#endif
+
+// BitboardKernels is one implementation of the bitboard kernels.
+struct BitboardKernels {
+    const char *name;
+    Bitboard (*dilate)(const Bitboard &x, const EdgeMasks &e);
+    Bitboard (*floodFill)(const Bitboard &seed, const Bitboard &within, const EdgeMasks &e);
+};
+
+// ScalarKernels returns the portable kernels, which work a word at a time.
+inline const BitboardKernels &ScalarKernels() {
+    static const BitboardKernels k{"scalar", dilateScalar, floodFillScalar};
+    return k;
+}
+
+// AVX2Kernels returns the AVX2 kernels, or nullptr if they were not built or
+// the CPU lacks AVX2.
+inline const BitboardKernels *AVX2Kernels() {
+#ifdef CONSOLEGO_AVX2_KERNELS
+    static const BitboardKernels k{"avx2", dilateAVX2, floodFillAVX2};
+    static const bool supported = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+    }();
+    return supported ? &k : nullptr;
+#else
+    return nullptr;
+#endif
+}
+
+// Kernels returns the fastest kernels the CPU supports, picked on first use.
+inline const BitboardKernels &Kernels() {
+    static const BitboardKernels &k = AVX2Kernels() ? *AVX2Kernels() : ScalarKernels();
+    return k;
+}
+
+// Dilate returns x plus the orthogonal neighbours of every point in x.
+inline Bitboard Dilate(const Bitboard &x, const EdgeMasks &e) { return Kernels().dilate(x, e); }
+
+// FloodFill returns the points of within that are connected to seed through
+// within.
+inline Bitboard FloodFill(const Bitboard &seed, const Bitboard &within, const EdgeMasks &e) {
+    return Kernels().floodFill(seed, within, e);
+}
+
+#endif // CONSOLEGO_BITBOARD_H
@@ -1,24 +1,177 @@
 #ifndef CONSOLEGO_BOARD_H
 #define CONSOLEGO_BOARD_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
 #include <iostream>
-#include <map>
+#include <memory>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 
+#include "bitboard.h"
 #include "colour.h"
+#include "symmetry.h"
 #include "utils.h"
+#include "zobrist.h"
 
 struct BoardMove {};
 
+// Superko selects which repetition rule, if any, LegalColour() enforces on top
+// of simple ko.
+enum class Superko : int8_t {
+    NONE = 0,
+    POSITIONAL = 1, // a move may not recreate any earlier stone arrangement
+    SITUATIONAL = 2 // as POSITIONAL, but only with the same player to move
+};
+
+// HashHistory is one entry of the per-line list of positions that led to a
+// board. Entries are immutable and shared, so copying a board copies a single
+// pointer.
+struct HashHistory {
+    uint64_t position; // stones only
+    Colour player;     // player to move in that position
+    std::shared_ptr<const HashHistory> prev;
+};
+
+// ChainLink is the per-point chain bookkeeping of a Board. Stones of a chain
+// form a circular list through next; libs and stones are only maintained at the
+// chain's head. Entries for empty points are stale and must not be read.
+struct ChainLink {
+    uint16_t head;
+    uint16_t next;
+    uint16_t libs;
+    uint16_t stones;
+};
+
+// CowArray is a fixed-length array of at most maxLength elements, kept in
+// chunks of 2^chunkBits elements with their own reference counts. Copying it
+// copies only the chunk pointers, so the copy shares every chunk with the
+// original; a chunk is cloned the first time either side writes to it while it
+// is shared. The chunk table lives inside the array, so a read costs the same
+// two loads as indexing a std::vector. Reads go through operator[], writes
+// through mut(), which is what decides whether to clone.
+template <typename T, size_t maxLength, int chunkBits = 6>
+class CowArray {
+public:
+    CowArray() = default;
+
+    explicit CowArray(size_t n) {
+        if (n > maxLength) {
+            throw std::length_error("CowArray: too many elements");
+        }
+        for (; this->nchunks * chunkSize < n; this->nchunks++) {
+            this->chunks[this->nchunks] = new Chunk();
+            this->owned.set(this->nchunks);
+        }
+    }
+
+    CowArray(const CowArray &other) : nchunks(other.nchunks) {
+        for (size_t c = 0; c < this->nchunks; c++) {
+            this->chunks[c] = other.chunks[c];
+            this->chunks[c]->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    CowArray(CowArray &&other) noexcept : nchunks(other.nchunks), owned(other.owned) {
+        std::copy(other.chunks, other.chunks + other.nchunks, this->chunks);
+        other.nchunks = 0;
+        other.owned.reset();
+    }
+
+    CowArray &operator=(CowArray other) noexcept {
+        std::swap(this->chunks, other.chunks);
+        std::swap(this->nchunks, other.nchunks);
+        std::swap(this->owned, other.owned);
+        return *this;
+    }
+
+    ~CowArray() {
+        for (size_t c = 0; c < this->nchunks; c++) {
+            release(this->chunks[c]);
+        }
+    }
+
+    const T &operator[](size_t i) const { return this->chunks[i >> chunkBits]->items[i & (chunkSize - 1)]; }
+
+    // mut returns element i for writing, cloning its chunk first if the chunk
+    // is shared with another array.
+    T &mut(size_t i) {
+        Chunk *&chunk = this->chunks[i >> chunkBits];
+        if (chunk->refs.load(std::memory_order_acquire) != 1) {
+            Chunk *clone = new Chunk();
+            clone->items = chunk->items;
+            release(chunk);
+            chunk = clone;
+            this->owned.set(i >> chunkBits);
+        }
+        return chunk->items[i & (chunkSize - 1)];
+    }
+
+    // MemoryUsage returns the bytes of the chunks this array allocated itself,
+    // which leaves out the ones it shares with the array it was copied from.
+    size_t MemoryUsage() const { return this->owned.count() * sizeof(Chunk); }
+
+private:
+    static constexpr size_t chunkSize = size_t(1) << chunkBits;
+    static constexpr size_t maxChunks = (maxLength + chunkSize - 1) / chunkSize;
+
+    struct Chunk {
+        std::atomic<uint32_t> refs{1};
+        std::array<T, chunkSize> items{};
+    };
+
+    static void release(Chunk *chunk) {
+        if (chunk->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete chunk;
+        }
+    }
+
+    Chunk *chunks[maxChunks];
+    size_t nchunks = 0;
+    // owned marks the chunks this array allocated itself.
+    std::bitset<maxChunks> owned;
+};
+
+// CaptureCount holds the number of stones captured by each colour. It replaces
+// a std::map so that boards copy and compare without touching the heap.
+struct CaptureCount {
+    int black = 0;
+    int white = 0;
+
+    int &operator[](Colour c) { return c == Colour::WHITE ? white : black; }
+    int at(Colour c) const { return c == Colour::WHITE ? white : black; }
+    bool operator==(const CaptureCount &other) const { return black == other.black && white == other.white; }
+    bool operator!=(const CaptureCount &other) const { return !(*this == other); }
+};
+
+// UndoMark is the start of one step of a Board's undo log: the scalar state
+// before the step, and the lengths of the point and chain logs at that time.
+struct UndoMark {
+    int ko;
+    Colour player;
+    int step;
+    int bContinuePass;
+    int wContinuePass;
+    uint64_t hash;
+    CaptureCount captureBy;
+    std::shared_ptr<const HashHistory> history;
+    uint32_t stones;
+    uint32_t chains;
+};
+
 struct Board {
     int size;
     Colour player;
-    std::string ko;
+    // ko is the point index of the ko square, or noPoint.
+    int ko;
     float km;
     int step;
-    std::vector<std::vector<Colour>> state;
-    std::map<Colour, int> captureBy;
+    Bitboard black;
+    Bitboard white;
+    CaptureCount captureBy;
     bool paused;
     std::vector<std::shared_ptr<BoardMove>> move;
     int bContinuePass;
@@ -26,7 +179,29 @@ struct Board {
     float bScore;
     float wScore;
     int controversyCount;
+    // ownership is filled in by Estimate(); it is empty until then.
     std::vector<float> ownership;
+    // hash is the Zobrist hash of the stones, the ko square and the player to
+    // move. It is kept up to date by set(), setKo() and SetPlayer().
+    uint64_t hash = 0;
+    Superko superko = Superko::NONE;
+    std::shared_ptr<const HashHistory> history;
+    // symmetry is set by TrackSymmetries(), after which symHash[s] is kept up
+    // to date by set() as the stone hash of the position under symmetry s.
+    const SymmetryTable *symmetry = nullptr;
+    std::array<uint64_t, symmetries> symHash{};
+    // chains tracks groups and their exact liberty counts incrementally, so
+    // that playing a move only touches the neighbouring groups. It is shared
+    // copy-on-write between a board and its copies, so a copy costs a chunk
+    // table and each move clones only the chunks it writes to.
+    CowArray<ChainLink, maxPoints> chains;
+    const NeighbourTable *nbr = nullptr;
+    // The undo log: one UndoMark per step, plus the old colour of every point
+    // and the old value of every chain entry written since the first mark.
+    // Nothing is logged while there is no mark.
+    std::vector<UndoMark> undoMarks;
+    std::vector<std::pair<int16_t, Colour>> stoneLog;
+    std::vector<std::pair<int16_t, ChainLink>> chainLog;
 
     Board() = default;
     Board(const Board &) = delete;
@@ -34,41 +209,35 @@ struct Board {
     ~Board() = default;
 
     Board(int sz) :
-        size(sz), player(Colour::BLACK), ko(""), km(0.0f), step(0), state(sz, std::vector<Colour>(sz, Colour::EMPTY)),
-        paused(false), bContinuePass(0), wContinuePass(0), bScore(0.0f), wScore(0.0f), controversyCount(0) {
-        if (sz < 1 || sz > 52) {
+        size(sz), player(Colour::BLACK), ko(noPoint), km(0.0f), step(0), paused(false), bContinuePass(0),
+        wContinuePass(0), bScore(0.0f), wScore(0.0f), controversyCount(0) {
+        if (sz < 1 || sz > maxBoardSize) {
             throw std::invalid_argument("NewBoard(): bad size " + std::to_string(sz));
         }
         move.clear();
-        captureBy[Colour::BLACK] = 0;
-        captureBy[Colour::WHITE] = 0;
-        for (int i = 0; i < sz * sz; i++) {
-            ownership.push_back(0.0f);
-        }
+        chains = CowArray<ChainLink, maxPoints>(sz * sz);
+        nbr = &Neighbours(sz);
     };
 
     // Equals returns true if the two boards are the same, including ko status,
     // captures, and next player to move.
 
-    bool Equals(const Board &other) {
-        if (this->size != other.size || this->player != other.player || this->ko != other.ko) {
+    bool Equals(const Board &other) const {
+        if (this->hash != other.hash) {
             return false;
         }
-        if (this->captureBy[Colour::BLACK] != other.captureBy.at(Colour::BLACK) ||
-            this->captureBy[Colour::WHITE] != other.captureBy.at(Colour::WHITE)) {
+        if (this->size != other.size || this->player != other.player || this->ko != other.ko) {
             return false;
         }
-        for (int i = 0; i < this->state.size(); i++) {
-            for (int j = 0; j < this->state[i].size(); j++) {
-                if (this->state[i][j] != other.state[i][j]) {
-                    return false;
-                }
-            }
+        if (this->captureBy != other.captureBy) {
+            return false;
         }
-        return true;
+        int nwords = Bitboard::WordsFor(this->size);
+        return this->black.Equals(other.black, nwords) && this->white.Equals(other.white, nwords);
     };
 
-    // Copy returns a deep copy of the board.
+    // Copy returns a copy of the board. The chain table is shared with this
+    // board until one of them changes it, chunk by chunk.
     std::shared_ptr<Board> Copy() {
         auto ret = std::make_shared<Board>();
         ret->size = this->size;
@@ -76,7 +245,8 @@ struct Board {
         ret->ko = this->ko;
         ret->km = this->km;
         ret->step = this->step;
-        ret->state = this->state;
+        ret->black = this->black;
+        ret->white = this->white;
         ret->captureBy = this->captureBy;
         ret->paused = this->paused;
         ret->bContinuePass = this->bContinuePass;
@@ -85,39 +255,260 @@ struct Board {
         ret->wScore = this->wScore;
         ret->controversyCount = this->controversyCount;
         ret->ownership = this->ownership;
-        // Deep copy of move vector
-        for (const auto &m: this->move) {
-            ret->move.push_back(m); // Assuming BoardMove is immutable or handled elsewhere
-        }
+        ret->hash = this->hash;
+        ret->superko = this->superko;
+        ret->history = this->history;
+        ret->symmetry = this->symmetry;
+        ret->symHash = this->symHash;
+        ret->chains = this->chains;
+        ret->nbr = this->nbr;
+        ret->move = this->move;
         return ret;
     };
 
+    // MemoryUsage returns the approximate number of bytes owned by the board,
+    // excluding the shared hash history and the chain chunks it shares with
+    // the board it was copied from.
+    size_t MemoryUsage() const {
+        return sizeof(Board) + this->chains.MemoryUsage() + this->ownership.capacity() * sizeof(float) +
+               this->move.capacity() * sizeof(this->move[0]) + this->undoMarks.capacity() * sizeof(UndoMark) +
+               this->stoneLog.capacity() * sizeof(this->stoneLog[0]) +
+               this->chainLog.capacity() * sizeof(this->chainLog[0]);
+    }
+
+    // At returns the colour at the given point index.
+    Colour At(int i) const {
+        if (this->black.Test(i)) {
+            return Colour::BLACK;
+        }
+        if (this->white.Test(i)) {
+            return Colour::WHITE;
+        }
+        return Colour::EMPTY;
+    }
+
+    // Index converts an SGF coordinate to a point index, or noPoint if the point
+    // is not on the board.
+    int Index(std::string_view p) const {
+        auto [x, y, onboard] = ParsePoint(p, this->size);
+        return onboard ? PointIndex(x, y, this->size) : noPoint;
+    }
+
+    // PointName converts a point index back to an SGF coordinate.
+    std::string PointName(int i) const { return Point(i % this->size, i / this->size); }
+
     // Get returns the colour at the specified point. The argument should be an SGF
     // coordinate, e.g. "dd".
     Colour Get(std::string p) {
-        auto [x, y, onboard] = ParsePoint(p, this->size);
-        if (!onboard) {
+        int i = this->Index(p);
+        if (i == noPoint) {
             throw std::invalid_argument("Get(): point not on board: " + p);
         }
-        return this->state[y][x];
+        return this->At(i);
     }
 
     // getFast is for trusted input
-    Colour getFast(std::string p) {
-        int x = static_cast<int>(p[0]) - 97;
-        int y = static_cast<int>(p[1]) - 97;
-        if (p[0] <= 'Z') {
-            x = static_cast<int>(p[0]) - 39;
+    Colour getFast(std::string p) { return this->At(PointIndex(alphaIndex(p[0]), alphaIndex(p[1]), this->size)); }
+
+    // Set sets the colour at the specified point, without any legality checks or
+    // captures. The argument should be an SGF coordinate, e.g. "dd".
+    void Set(std::string p, Colour c) {
+        int i = this->Index(p);
+        if (i == noPoint) {
+            throw std::invalid_argument("Set(): point not on board: " + p);
+        }
+        if (c == Colour::EMPTY) {
+            this->removeStone(i);
+        } else {
+            this->addStone(i, c);
+        }
+    }
+
+    void set(int i, Colour c) {
+        if (!this->undoMarks.empty()) {
+            this->stoneLog.emplace_back(i, this->At(i));
+        }
+        this->hash ^= Zobrist().Stone(i, this->At(i)) ^ Zobrist().Stone(i, c);
+        if (this->symmetry) {
+            this->symmetryUpdate(i, this->At(i), c);
+        }
+        this->black.Reset(i);
+        this->white.Reset(i);
+        if (c == Colour::BLACK) {
+            this->black.Set(i);
+        } else if (c == Colour::WHITE) {
+            this->white.Set(i);
+        }
+    }
+
+    void setKo(int i) {
+        if (this->ko != noPoint) {
+            this->hash ^= Zobrist().ko[this->ko];
+        }
+        this->ko = i;
+        if (i != noPoint) {
+            this->hash ^= Zobrist().ko[i];
+        }
+    }
+
+    // SetPlayer sets the player to move.
+    void SetPlayer(Colour c) {
+        if ((this->player == Colour::WHITE) != (c == Colour::WHITE)) {
+            this->hash ^= Zobrist().whiteToMove;
+        }
+        this->player = c;
+    }
+
+    // PositionHash returns the Zobrist hash of the stones alone, ignoring ko and
+    // the player to move.
+    uint64_t PositionHash() const {
+        uint64_t h = this->hash;
+        if (this->ko != noPoint) {
+            h ^= Zobrist().ko[this->ko];
+        }
+        if (this->player == Colour::WHITE) {
+            h ^= Zobrist().whiteToMove;
+        }
+        return h;
+    }
+
+    // TrackSymmetries keeps the stone hash of the position under every symmetry
+    // up to date from now on, at the cost of a few more XORs per changed point,
+    // so CanonicalSymmetry() is O(1) for the rest of the board's life.
+    void TrackSymmetries() {
+        this->symHash = this->SymmetryHashes();
+        this->symmetry = &Symmetries(this->size);
+    }
+
+    void symmetryUpdate(int i, Colour from, Colour to) {
+        for (int s = 0; s < symmetries; s++) {
+            this->symHash[s] ^= this->symmetry->Key(s, i, from) ^ this->symmetry->Key(s, i, to);
+        }
+    }
+
+    // SymmetryHashes returns the stone hash of the position under each symmetry.
+    // Entry 0 is PositionHash(), and entry s is the PositionHash() of
+    // Transformed(s). Boards that do not track symmetries work it out from the
+    // stones.
+    std::array<uint64_t, symmetries> SymmetryHashes() const {
+        if (this->symmetry) {
+            return this->symHash;
+        }
+        const SymmetryTable &t = Symmetries(this->size);
+        std::array<uint64_t, symmetries> ret{};
+        int nwords = Bitboard::WordsFor(this->size);
+        for (int w = 0; w < nwords; w++) {
+            for (Colour c: {Colour::BLACK, Colour::WHITE}) {
+                uint64_t bits = (c == Colour::BLACK ? this->black : this->white).words[w];
+                for (; bits; bits &= bits - 1) {
+                    int i = w * 64 + __builtin_ctzll(bits);
+                    for (int s = 0; s < symmetries; s++) {
+                        ret[s] ^= t.Key(s, i, c);
+                    }
+                }
+            }
+        }
+        return ret;
+    }
+
+    // CanonicalSymmetry returns the symmetry that maps the position to its
+    // canonical form: the one with the smallest stone hash, the lowest such
+    // symmetry on a tie. The eight positions symmetric to each other have the
+    // same canonical form.
+    int CanonicalSymmetry() const {
+        auto h = this->SymmetryHashes();
+        return static_cast<int>(std::min_element(h.begin(), h.end()) - h.begin());
+    }
+
+    // CanonicalHash returns the stone hash of the canonical form of the
+    // position, which is the same for all eight symmetric positions.
+    uint64_t CanonicalHash() const {
+        auto h = this->SymmetryHashes();
+        return *std::min_element(h.begin(), h.end());
+    }
+
+    // Transformed returns a copy of the board mapped through a symmetry. The
+    // hash history is not carried over, since it holds hashes of untransformed
+    // positions, and neither is the undo log.
+    std::shared_ptr<Board> Transformed(int s) const {
+        if (s < 0 || s >= symmetries) {
+            throw std::invalid_argument("Transformed(): bad symmetry " + std::to_string(s));
+        }
+        const SymmetryTable &t = Symmetries(this->size);
+        auto ret = std::make_shared<Board>(this->size);
+        for (int i = 0; i < this->size * this->size; i++) {
+            Colour c = this->At(i);
+            if (c != Colour::EMPTY) {
+                ret->placeStone(t.Map(i, s), c);
+            }
+        }
+        ret->setKo(t.Map(this->ko, s));
+        ret->SetPlayer(this->player);
+        ret->km = this->km;
+        ret->step = this->step;
+        ret->captureBy = this->captureBy;
+        ret->paused = this->paused;
+        ret->bContinuePass = this->bContinuePass;
+        ret->wContinuePass = this->wContinuePass;
+        ret->bScore = this->bScore;
+        ret->wScore = this->wScore;
+        ret->controversyCount = this->controversyCount;
+        if (!this->ownership.empty()) {
+            ret->ownership.resize(this->ownership.size());
+            for (size_t i = 0; i < this->ownership.size(); i++) {
+                ret->ownership[t.Map(static_cast<int>(i), s)] = this->ownership[i];
+            }
+        }
+        ret->superko = this->superko;
+        ret->move = this->move;
+        if (this->symmetry) {
+            ret->TrackSymmetries();
+        }
+        return ret;
+    }
+
+    // RecordHistory appends the current position to the line's hash history.
+    // Moves and passes call it automatically while a superko rule is set.
+    void RecordHistory() {
+        this->history = std::make_shared<const HashHistory>(
+                HashHistory{this->PositionHash(), this->player, std::move(this->history)});
+    }
+
+    // Repeats returns true if a position with the given stone hash, and player
+    // to move, occurs in the history under the board's superko rule. It always
+    // returns false when superko is disabled.
+    bool Repeats(uint64_t position, Colour toMove) const {
+        if (this->superko == Superko::NONE) {
+            return false;
         }
-        if (p[1] <= 'Z') {
-            y = static_cast<int>(p[1]) - 39;
+        for (auto h = this->history.get(); h; h = h->prev.get()) {
+            if (h->position == position && (this->superko == Superko::POSITIONAL || h->player == toMove)) {
+                return true;
+            }
         }
-        return state[x][y];
+        return false;
     }
 
     // HasKo returns true if the board has a ko square, on which capture by the
     // current player to move is prohibited.
-    bool HasKo() { return this->ko != ""; };
+    bool HasKo() { return this->ko != noPoint; };
+
+    // SetKo sets the ko square. The argument should be an SGF coordinate, or ""
+    // to clear it.
+    void SetKo(std::string p) {
+        if (p.empty()) {
+            this->ClearKo();
+            return;
+        }
+        int i = this->Index(p);
+        if (i == noPoint) {
+            throw std::invalid_argument("SetKo(): point not on board: " + p);
+        }
+        this->setKo(i);
+    }
+
+    // GetKo returns the ko square as an SGF coordinate, or "" if there is none.
+    std::string GetKo() { return this->ko == noPoint ? "" : this->PointName(this->ko); }
 
     // Dump prints the board, and some information about captures and next player.
     void Dump() {
@@ -133,22 +524,15 @@ struct Board {
     // String returns an ASCII representation of the board.
     std::string String() {
         std::ostringstream b;
-        int ko_x = -1, ko_y = -1;
-        if (!this->ko.empty()) {
-            auto [x, y, onboard] = ParsePoint(this->ko, this->size);
-            if (onboard) {
-                ko_x = x;
-                ko_y = y;
-            }
-        }
         for (int y = 0; y < this->size; y++) {
             for (int x = 0; x < this->size; x++) {
-                Colour c = this->state[x][y];
+                int i = PointIndex(x, y, this->size);
+                Colour c = this->At(i);
                 if (c == Colour::BLACK) {
                     b << " X";
                 } else if (c == Colour::WHITE) {
                     b << " O";
-                } else if (ko_x == x && ko_y == y) {
+                } else if (this->ko == i) {
                     b << " :";
                 } else {
                     if (IsStarPoint(Point(x, y), this->size)) {
@@ -163,25 +547,391 @@ struct Board {
         return b.str();
     }
 
+    // koSquareFinder returns the only empty neighbour of a point, and throws if
+    // it has none or several.
     std::string koSquareFinder(std::string p) {
-        std::vector<std::string> hits;
-        for (auto &a: AdjacentPoints(p, this->size)) {
-            if (this->Get(a) == Colour::EMPTY) {
-                hits.push_back(a);
+        int i = this->Index(p);
+        if (i == noPoint) {
+            throw std::invalid_argument("koSquareFinder(): bad point: " + p);
+        }
+        const EdgeMasks &e = Edges(this->size);
+        Bitboard point;
+        point.Set(i);
+        Bitboard around = Dilate(point, e);
+        int hit = noPoint;
+        int hits = 0;
+        for (int w = 0; w < e.nwords; w++) {
+            uint64_t empty = around.words[w] & ~point.words[w] & ~(this->black.words[w] | this->white.words[w]);
+            if (empty) {
+                hits += __builtin_popcountll(empty);
+                hit = w * 64 + __builtin_ctzll(empty);
             }
         }
-        if (hits.size() != 1) {
+        if (hits != 1) {
             throw std::invalid_argument("koSquareFinder(): bad point: " + p);
         }
-        return hits[0];
+        return this->PointName(hit);
     };
 
-    void ClearKo() {
+    void ClearKo() { this->setKo(noPoint); };
 
-    };
-    std::string String() { return ""; };
-    // TODO: complete this function
-    bool LegalColour(std::string p, Colour color) { return true; }
+    // LegalColour returns true if the given colour may play at the specified
+    // point: it must be empty, not the ko square, not suicide and, if a superko
+    // rule is set, must not repeat an earlier position.
+    bool LegalColour(std::string p, Colour color) {
+        int i = this->Index(p);
+        if (i == noPoint || (color != Colour::BLACK && color != Colour::WHITE)) {
+            return false;
+        }
+        return this->legal(i, color);
+    }
+
+    // Legal is like LegalColour, for the player to move.
+    bool Legal(std::string p) { return this->LegalColour(p, this->player); }
+
+    // PlayColour plays a move of the given colour, making captures and updating
+    // the ko square and player to move. It throws if the move is illegal.
+    void PlayColour(std::string p, Colour colour) {
+        if (!this->LegalColour(p, colour)) {
+            throw std::runtime_error("Illegal move: " + p);
+        }
+        this->playMove(this->Index(p), colour);
+    }
+
+    // Play is like PlayColour, for the player to move.
+    void Play(std::string p) { this->PlayColour(p, this->player); }
+
+    // PassColour passes for the given colour.
+    void PassColour(Colour colour) {
+        if (colour == Colour::BLACK) {
+            this->bContinuePass++;
+        } else {
+            this->wContinuePass++;
+        }
+        this->setKo(noPoint);
+        this->SetPlayer(Opponent(colour));
+        if (this->superko != Superko::NONE) {
+            this->RecordHistory();
+        }
+    }
+
+    void Pass() { this->PassColour(this->player); }
+
+    // Stones returns the stones of the chain at the specified point.
+    std::vector<std::string> Stones(std::string p) {
+        std::vector<std::string> ret;
+        int i = this->Index(p);
+        if (i == noPoint || this->At(i) == Colour::EMPTY) {
+            return ret;
+        }
+        int s = i;
+        do {
+            ret.push_back(this->PointName(s));
+            s = this->chains[s].next;
+        } while (s != i);
+        return ret;
+    }
+
+    // Liberties returns the number of liberties of the chain at the specified
+    // point, or 0 if the point is empty.
+    int Liberties(std::string p) {
+        int i = this->Index(p);
+        if (i == noPoint || this->At(i) == Colour::EMPTY) {
+            return 0;
+        }
+        return this->libsOf(i);
+    }
+
+    // Singleton returns true if the point holds a stone with no friendly
+    // neighbours.
+    bool Singleton(std::string p) {
+        int i = this->Index(p);
+        return i != noPoint && this->At(i) != Colour::EMPTY && this->chains[this->chains[i].head].stones == 1;
+    }
+
+    int libsOf(int i) const { return this->chains[this->chains[i].head].libs; }
+
+    // legal is LegalColour for a point index. It only looks at the neighbouring
+    // chains, plus the stones they would lose if a superko rule is set.
+    bool legal(int i, Colour c) {
+        if (this->At(i) != Colour::EMPTY) {
+            return false;
+        }
+        if (i == this->ko && c == this->player) {
+            return false;
+        }
+        const Adjacent &adj = (*this->nbr)[i];
+        bool breathes = false;
+        int captured[4];
+        int ncaptured = 0;
+        for (int k = 0; k < adj.count; k++) {
+            int n = adj.n[k];
+            Colour nc = this->At(n);
+            if (nc == Colour::EMPTY) {
+                breathes = true;
+            } else if (nc == c) {
+                breathes |= this->libsOf(n) > 1;
+            } else if (this->libsOf(n) == 1) {
+                breathes = true;
+                int h = this->chains[n].head;
+                if (std::find(captured, captured + ncaptured, h) == captured + ncaptured) {
+                    captured[ncaptured++] = h;
+                }
+            }
+        }
+        if (!breathes) {
+            return false;
+        }
+        if (this->superko != Superko::NONE) {
+            uint64_t after = this->PositionHash() ^ Zobrist().Stone(i, c);
+            for (int k = 0; k < ncaptured; k++) {
+                int s = captured[k];
+                do {
+                    after ^= Zobrist().Stone(s, Opponent(c));
+                    s = this->chains[s].next;
+                } while (s != captured[k]);
+            }
+            if (this->Repeats(after, Opponent(c))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // playMove plays a trusted move at a point index, which must be empty. It
+    // makes captures, removes the moving chain if it is left without liberties,
+    // sets the ko square, and passes the turn. It returns the number of stones
+    // captured.
+    int playMove(int i, Colour c) {
+        this->placeStone(i, c);
+        const Adjacent &adj = (*this->nbr)[i];
+        int captured = 0;
+        int lastCaptured = noPoint;
+        for (int k = 0; k < adj.count; k++) {
+            int n = adj.n[k];
+            if (this->At(n) == Opponent(c) && this->libsOf(n) == 0) {
+                lastCaptured = n;
+                captured += this->removeChain(this->chains[n].head);
+            }
+        }
+        this->captureBy[c] += captured;
+        int head = this->chains[i].head;
+        if (this->chains[head].libs == 0) {
+            // Suicide, only reachable with unchecked moves.
+            this->captureBy[Opponent(c)] += this->removeChain(head);
+        }
+        if (captured == 1 && this->chains[head].stones == 1 && this->chains[head].libs == 1) {
+            this->setKo(lastCaptured);
+        } else {
+            this->setKo(noPoint);
+        }
+        if (c == Colour::BLACK) {
+            this->bContinuePass = 0;
+        } else {
+            this->wContinuePass = 0;
+        }
+        this->SetPlayer(Opponent(c));
+        if (this->superko != Superko::NONE) {
+            this->RecordHistory();
+        }
+        return captured;
+    }
+
+    // Apply plays a trusted move like playMove, or passes if i is noPoint, as
+    // one step that Undo() can take back.
+    void Apply(int i, Colour c) {
+        this->Mark();
+        if (i == noPoint) {
+            this->PassColour(c);
+        } else {
+            this->playMove(i, c);
+        }
+    }
+
+    // Mark starts a step of the undo log: every change made to the board from
+    // now until the next Mark() is taken back together by one Undo(). Once the
+    // log has grown to the depth of a line, marking and undoing allocate
+    // nothing, except for the hash history of boards with a superko rule.
+    void Mark() {
+        this->undoMarks.push_back(UndoMark{this->ko, this->player, this->step, this->bContinuePass,
+                                           this->wContinuePass, this->hash, this->captureBy, this->history,
+                                           static_cast<uint32_t>(this->stoneLog.size()),
+                                           static_cast<uint32_t>(this->chainLog.size())});
+    }
+
+    // Undo takes back the last step started by Mark(), and returns false if
+    // there is none.
+    bool Undo() {
+        if (this->undoMarks.empty()) {
+            return false;
+        }
+        UndoMark &m = this->undoMarks.back();
+        for (size_t k = this->chainLog.size(); k-- > m.chains;) {
+            this->chains.mut(this->chainLog[k].first) = this->chainLog[k].second;
+        }
+        this->chainLog.resize(m.chains);
+        for (size_t k = this->stoneLog.size(); k-- > m.stones;) {
+            auto [i, c] = this->stoneLog[k];
+            if (this->symmetry) {
+                this->symmetryUpdate(i, this->At(i), c);
+            }
+            this->black.Reset(i);
+            this->white.Reset(i);
+            if (c == Colour::BLACK) {
+                this->black.Set(i);
+            } else if (c == Colour::WHITE) {
+                this->white.Set(i);
+            }
+        }
+        this->stoneLog.resize(m.stones);
+        this->ko = m.ko;
+        this->player = m.player;
+        this->step = m.step;
+        this->bContinuePass = m.bContinuePass;
+        this->wContinuePass = m.wContinuePass;
+        this->hash = m.hash;
+        this->captureBy = m.captureBy;
+        this->history = std::move(m.history);
+        this->undoMarks.pop_back();
+        return true;
+    }
+
+    // UndoDepth returns the number of steps Undo() can take back.
+    size_t UndoDepth() const { return this->undoMarks.size(); }
+
+    // chainMut returns chain entry i for writing, logging its old value while
+    // there is an undo mark.
+    ChainLink &chainMut(int i) {
+        if (!this->undoMarks.empty()) {
+            this->chainLog.emplace_back(i, this->chains[i]);
+        }
+        return this->chains.mut(i);
+    }
+
+    // addStone places a setup stone (SGF AB / AW) without making captures.
+    void addStone(int i, Colour c) {
+        if (this->At(i) == c) {
+            return;
+        }
+        if (this->At(i) != Colour::EMPTY) {
+            this->removeStone(i);
+        }
+        this->placeStone(i, c);
+    }
+
+    // removeStone clears a single point (SGF AE). The rest of its chain may fall
+    // apart, so the affected stones are re-chained from scratch.
+    void removeStone(int i) {
+        Colour c = this->At(i);
+        if (c == Colour::EMPTY) {
+            return;
+        }
+        std::vector<int> rest;
+        int s = this->chains[i].next;
+        while (s != i) {
+            rest.push_back(s);
+            s = this->chains[s].next;
+        }
+        this->removeChain(this->chains[i].head);
+        for (int r: rest) {
+            this->placeStone(r, c);
+        }
+    }
+
+    // placeStone puts a stone on an empty point and updates chains and
+    // liberties: the point is taken from each neighbouring chain, and friendly
+    // chains are merged into one.
+    void placeStone(int i, Colour c) {
+        this->set(i, c);
+        const Adjacent &adj = (*this->nbr)[i];
+        ChainLink &link = this->chainMut(i);
+        link = ChainLink{uint16_t(i), uint16_t(i), 0, 1};
+        int seen[4];
+        int nseen = 0;
+        for (int k = 0; k < adj.count; k++) {
+            int n = adj.n[k];
+            if (this->At(n) == Colour::EMPTY) {
+                link.libs++;
+                continue;
+            }
+            int h = this->chains[n].head;
+            if (std::find(seen, seen + nseen, h) == seen + nseen) {
+                seen[nseen++] = h;
+                this->chainMut(h).libs--;
+            }
+        }
+        int head = i;
+        for (int k = 0; k < nseen; k++) {
+            if (this->At(seen[k]) == c) {
+                head = this->mergeChains(head, seen[k]);
+            }
+        }
+    }
+
+    // mergeChains joins two friendly chains given by their heads and returns
+    // the head of the result. The smaller chain is relabelled, and only its
+    // liberties that the larger chain lacks are added.
+    int mergeChains(int a, int b) {
+        if (this->chains[a].stones < this->chains[b].stones) {
+            std::swap(a, b);
+        }
+        Colour c = this->At(a);
+        int s = b;
+        do {
+            const Adjacent &adj = (*this->nbr)[s];
+            for (int k = 0; k < adj.count; k++) {
+                int n = adj.n[k];
+                if (this->At(n) != Colour::EMPTY) {
+                    continue;
+                }
+                const Adjacent &nadj = (*this->nbr)[n];
+                bool known = false;
+                for (int j = 0; j < nadj.count && !known; j++) {
+                    int m = nadj.n[j];
+                    known = this->At(m) == c && this->chains[m].head == a;
+                }
+                if (!known) {
+                    this->chainMut(a).libs++;
+                }
+            }
+            this->chainMut(s).head = a;
+            s = this->chains[s].next;
+        } while (s != b);
+        std::swap(this->chainMut(a).next, this->chainMut(b).next);
+        this->chainMut(a).stones += this->chains[b].stones;
+        return a;
+    }
+
+    // removeChain empties every stone of the chain with the given head, gives
+    // each freed point back as a liberty to the neighbouring chains, and returns
+    // the number of stones removed.
+    int removeChain(int head) {
+        int count = 0;
+        int s = head;
+        do {
+            this->set(s, Colour::EMPTY);
+            count++;
+            s = this->chains[s].next;
+        } while (s != head);
+        do {
+            const Adjacent &adj = (*this->nbr)[s];
+            int seen[4];
+            int nseen = 0;
+            for (int k = 0; k < adj.count; k++) {
+                int n = adj.n[k];
+                if (this->At(n) == Colour::EMPTY) {
+                    continue;
+                }
+                int h = this->chains[n].head;
+                if (std::find(seen, seen + nseen, h) == seen + nseen) {
+                    seen[nseen++] = h;
+                    this->chainMut(h).libs++;
+                }
+            }
+            s = this->chains[s].next;
+        } while (s != head);
+        return count;
+    }
 };
 
 #endif // CONSOLEGO_BOARD_H
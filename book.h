@@ -0,0 +1,284 @@
+#ifndef CONSOLEGO_BOOK_H
+#define CONSOLEGO_BOOK_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "io.h"
+
+// BookEdge is a move out of a book position, with the games that played it.
+// The move is a point index in the canonical orientation of the position, or
+// noPoint for a pass.
+struct BookEdge {
+    uint64_t child = 0;
+    int move = noPoint;
+    Colour colour = Colour::EMPTY;
+    uint32_t games = 0;
+    uint32_t blackWins = 0;
+    uint32_t whiteWins = 0;
+};
+
+// BookPosition is one position of an OpeningBook: the number of games that
+// reached it and the moves they went on with.
+struct BookPosition {
+    uint32_t games = 0;
+    std::vector<BookEdge> edges;
+};
+
+// BookMove is a book move from a particular board, with the point in that
+// board's orientation.
+struct BookMove {
+    int point = noPoint;
+    Colour colour = Colour::EMPTY;
+    uint32_t games = 0;
+    uint32_t blackWins = 0;
+    uint32_t whiteWins = 0;
+};
+
+// OpeningBook merges the openings of many games into a DAG of positions. A
+// position is keyed by its canonical stone hash and the player to move, so
+// games that reach it by different move orders, or in a rotated or mirrored
+// orientation, share it and its moves; ko and captures are not part of the
+// key. Positions are spread over sharded tables with a lock each, so games can
+// be added from many threads at once.
+class OpeningBook {
+public:
+    // The book holds games of one board size, to the given number of moves.
+    explicit OpeningBook(int size = 19, int depth = 40) : size(size), depth(depth) {
+        if (size < 1 || size > maxBoardSize) {
+            throw std::invalid_argument("OpeningBook: bad size " + std::to_string(size));
+        }
+    }
+
+    OpeningBook(const OpeningBook &) = delete;
+    OpeningBook &operator=(const OpeningBook &) = delete;
+
+    // PositionKey returns the book key of a board's position.
+    static uint64_t PositionKey(const Board &b) { return key(b.SymmetryHashes(), b.player); }
+
+    // Add merges the main line of the game containing node, up to the book's
+    // depth, and returns true. Games of another board size, or that start from
+    // setup stones such as handicap games, are skipped and return false. The
+    // merge stops early at setup stones or a node with two moves. Add may be
+    // called from several threads at once.
+    bool Add(Node &node) {
+        Node *root = node.GetRoot().get();
+        if (root->RootBoardSize() != this->size || hasSetup(root)) {
+            this->skipped++;
+            return false;
+        }
+        auto re = root->GetValueView(Key::RE);
+        bool blackWon = !re.empty() && (re[0] == 'B' || re[0] == 'b');
+        bool whiteWon = !re.empty() && (re[0] == 'W' || re[0] == 'w');
+
+        Board b(this->size);
+        b.TrackSymmetries();
+        root->updateBoard(b);
+        uint64_t parent = PositionKey(b);
+        this->reach(parent);
+        int moves = 0;
+        for (Node *n = root->firstChild(); n && moves < this->depth; n = n->firstChild()) {
+            bool black = n->key_index(Key::B) != -1;
+            bool white = n->key_index(Key::W) != -1;
+            if (hasSetup(n) || (black && white)) {
+                break;
+            }
+            if (!black && !white) {
+                continue;
+            }
+            Colour c = black ? Colour::BLACK : Colour::WHITE;
+            auto hashes = b.SymmetryHashes();
+            int move = canonicalMove(hashes, b.Index(n->GetValueView(black ? Key::B : Key::W)));
+            n->updateBoard(b);
+            uint64_t child = PositionKey(b);
+            {
+                Shard &shard = this->shardOf(parent);
+                std::lock_guard<std::mutex> lock(shard.mu);
+                auto &edges = shard.positions[parent].edges;
+                auto it = std::find_if(edges.begin(), edges.end(),
+                                       [&](const BookEdge &e) { return e.child == child && e.colour == c; });
+                if (it == edges.end()) {
+                    edges.push_back(BookEdge{child, move, c});
+                    it = edges.end() - 1;
+                }
+                it->games++;
+                it->blackWins += blackWon;
+                it->whiteWins += whiteWon;
+            }
+            this->reach(child);
+            parent = child;
+            moves++;
+        }
+        this->games++;
+        return true;
+    }
+
+    // AddFiles merges every game of the SGF files in paths, parsing and merging
+    // them in parallel. It returns each game that failed to parse, as its file
+    // and error.
+    std::vector<std::pair<std::string, std::string>> AddFiles(const std::vector<std::string> &paths,
+                                                             const BulkOptions &opts = {}) {
+        auto files = FindSGFFiles(paths);
+        auto errors = ParseBulk(files, opts, [this](size_t, size_t, std::shared_ptr<Node> root) {
+            this->Add(*root);
+        });
+        std::vector<std::pair<std::string, std::string>> ret;
+        for (size_t f = 0; f < files.size(); f++) {
+            for (auto &e: errors[f]) {
+                ret.emplace_back(files[f], e.Message());
+            }
+        }
+        return ret;
+    }
+
+    int Size() const { return this->size; }
+    int Depth() const { return this->depth; }
+
+    // Games returns the number of games merged, and Skipped the number left out.
+    size_t Games() const { return this->games; }
+    size_t Skipped() const { return this->skipped; }
+
+    // Positions returns the number of distinct positions in the book.
+    size_t Positions() const {
+        size_t n = 0;
+        for (auto &shard: this->shards) {
+            std::lock_guard<std::mutex> lock(shard.mu);
+            n += shard.positions.size();
+        }
+        return n;
+    }
+
+    // Find returns the book position of a board, or nullptr if no game reached
+    // it. The pointer stays valid, but must not be read while games are added.
+    const BookPosition *Find(const Board &b) const {
+        uint64_t k = PositionKey(b);
+        const Shard &shard = this->shardOf(k);
+        std::lock_guard<std::mutex> lock(shard.mu);
+        auto it = shard.positions.find(k);
+        return it == shard.positions.end() ? nullptr : &it->second;
+    }
+
+    // Moves returns the book moves from a board, most played first, with the
+    // points mapped to the board's orientation. On a board that is itself
+    // symmetric, one of the equivalent points is given for each move.
+    std::vector<BookMove> Moves(const Board &b) const {
+        auto hashes = b.SymmetryHashes();
+        int s = static_cast<int>(std::min_element(hashes.begin(), hashes.end()) - hashes.begin());
+        uint64_t k = key(hashes, b.player);
+        const SymmetryTable &t = Symmetries(this->size);
+        std::vector<BookMove> ret;
+        {
+            const Shard &shard = this->shardOf(k);
+            std::lock_guard<std::mutex> lock(shard.mu);
+            auto it = shard.positions.find(k);
+            if (it == shard.positions.end()) {
+                return ret;
+            }
+            for (auto &e: it->second.edges) {
+                ret.push_back(BookMove{t.Map(e.move, t.inverse[s]), e.colour, e.games, e.blackWins, e.whiteWins});
+            }
+        }
+        std::sort(ret.begin(), ret.end(), [](const BookMove &a, const BookMove &b) {
+            return a.games != b.games ? a.games > b.games : a.point < b.point;
+        });
+        return ret;
+    }
+
+    // Export writes the book out as an ordinary SGF tree in a new arena: from
+    // the empty board, every move played in at least minGames games, down to
+    // maxDepth moves, most played first. Each move's comment gives its games
+    // and wins. A position reached by several move orders is written out under
+    // each of them.
+    std::shared_ptr<Node> Export(int maxDepth, uint32_t minGames = 1) const {
+        auto root = NodeArena::Create()->NewRoot();
+        root->appendValue(Key::SZ, std::to_string(this->size));
+        Board b(this->size);
+        b.TrackSymmetries();
+        this->exportFrom(b, root, maxDepth, std::max<uint32_t>(minGames, 1));
+        return root;
+    }
+
+private:
+    static constexpr size_t shardCount = 64;
+
+    struct Shard {
+        mutable std::mutex mu;
+        std::unordered_map<uint64_t, BookPosition> positions;
+    };
+
+    static uint64_t key(const std::array<uint64_t, symmetries> &hashes, Colour toMove) {
+        uint64_t least = *std::min_element(hashes.begin(), hashes.end());
+        return toMove == Colour::WHITE ? least ^ Zobrist().whiteToMove : least;
+    }
+
+    static bool hasSetup(Node *n) {
+        return n->key_index(Key::AB) != -1 || n->key_index(Key::AW) != -1 || n->key_index(Key::AE) != -1;
+    }
+
+    // canonicalMove maps a move into the canonical orientation of the position
+    // before it. When several symmetries give that orientation, the position is
+    // symmetric and so are the move's images; the smallest is taken, so that
+    // equivalent moves share an edge.
+    int canonicalMove(const std::array<uint64_t, symmetries> &hashes, int move) const {
+        if (move == noPoint) {
+            return noPoint;
+        }
+        const SymmetryTable &t = Symmetries(this->size);
+        uint64_t least = *std::min_element(hashes.begin(), hashes.end());
+        int best = INT_MAX;
+        for (int s = 0; s < symmetries; s++) {
+            if (hashes[s] == least) {
+                best = std::min(best, t.Map(move, s));
+            }
+        }
+        return best;
+    }
+
+    // Shards are picked by the low bits of the key; the high bits of a
+    // canonical hash, being a minimum, are skewed towards zero.
+    Shard &shardOf(uint64_t k) { return this->shards[k % shardCount]; }
+    const Shard &shardOf(uint64_t k) const { return this->shards[k % shardCount]; }
+
+    void reach(uint64_t k) {
+        Shard &shard = this->shardOf(k);
+        std::lock_guard<std::mutex> lock(shard.mu);
+        shard.positions[k].games++;
+    }
+
+    void exportFrom(Board &b, const std::shared_ptr<Node> &parent, int depth, uint32_t minGames) const {
+        if (depth <= 0) {
+            return;
+        }
+        for (auto &m: this->Moves(b)) {
+            if (m.games < minGames) {
+                break;
+            }
+            auto child = Node::NewNode(parent);
+            child->appendValue(m.colour == Colour::BLACK ? Key::B : Key::W,
+                               m.point == noPoint ? std::string() : b.PointName(m.point));
+            child->appendValue(Key::C, "games " + std::to_string(m.games) + ", black wins " +
+                                               std::to_string(m.blackWins) + ", white wins " +
+                                               std::to_string(m.whiteWins));
+            b.Apply(m.point, m.colour);
+            this->exportFrom(b, child, depth - 1, minGames);
+            b.Undo();
+        }
+    }
+
+    int size;
+    int depth;
+    std::array<Shard, shardCount> shards;
+    std::atomic<size_t> games{0};
+    std::atomic<size_t> skipped{0};
+};
+
+#endif // CONSOLEGO_BOOK_H
@@ -0,0 +1,429 @@
+#ifndef CONSOLEGO_CONCURRENT_H
+#define CONSOLEGO_CONCURRENT_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "node.h"
+
+// EpochDomain defers freeing memory that lock-free readers may still be
+// reading (epoch-based reclamation). A reader pins the current epoch while it
+// holds pointers into the shared data; a writer retires what it unlinks with
+// the epoch at that time, and it is freed once every pinned reader has pinned
+// a later one. A reader that reads for a long time repins between reads, or
+// nothing retired after its pin is ever freed. Readers never wait. Retiring
+// and reclaiming is for one thread at a time.
+class EpochDomain {
+public:
+    static constexpr int maxReaders = 64;
+
+    EpochDomain() = default;
+    EpochDomain(const EpochDomain &) = delete;
+    EpochDomain &operator=(const EpochDomain &) = delete;
+
+    ~EpochDomain() {
+        for (auto &r: this->retired) {
+            r.free(r.p);
+        }
+    }
+
+    // Pin claims a reader slot, pins the current epoch in it, and returns the
+    // slot. It throws if maxReaders readers are pinned already.
+    int Pin() {
+        for (int i = 0; i < maxReaders; i++) {
+            auto &slot = this->slots[i];
+            bool expected = false;
+            if (slot.used.load(std::memory_order_relaxed) || !slot.used.compare_exchange_strong(expected, true)) {
+                continue;
+            }
+            this->Repin(i);
+            return i;
+        }
+        throw std::runtime_error("EpochDomain: too many readers");
+    }
+
+    // Repin moves a pinned reader on to the current epoch, which is a point
+    // where it holds nothing it read before.
+    void Repin(int i) {
+        // A reader is pinned once it has seen its epoch still current after
+        // publishing it, so a writer that missed the pin has not yet advanced
+        // past it.
+        auto &slot = this->slots[i];
+        uint64_t e = this->global.load();
+        for (;;) {
+            slot.epoch.store(e);
+            uint64_t now = this->global.load();
+            if (now == e) {
+                return;
+            }
+            e = now;
+        }
+    }
+
+    void Unpin(int i) {
+        this->slots[i].epoch.store(0);
+        this->slots[i].used.store(false);
+    }
+
+    // Retire hands over an object that readers can no longer reach, to be
+    // deleted once the readers that might have reached it are gone.
+    template <typename T>
+    void Retire(const T *p) {
+        if (p) {
+            this->retired.push_back(
+                    {const_cast<T *>(p), this->global.load(), [](void *q) { delete static_cast<T *>(q); }});
+        }
+    }
+
+    // Reclaim starts a new epoch and frees every retired object that no pinned
+    // reader can still see. Objects are retired in epoch order, so those are
+    // at the front.
+    void Reclaim() {
+        this->global.fetch_add(1);
+        uint64_t oldest = UINT64_MAX;
+        for (auto &slot: this->slots) {
+            uint64_t e = slot.epoch.load();
+            if (e != 0) {
+                oldest = std::min(oldest, e);
+            }
+        }
+        while (!this->retired.empty() && this->retired.front().epoch < oldest) {
+            this->retired.front().free(this->retired.front().p);
+            this->retired.pop_front();
+        }
+    }
+
+    // Pending returns the number of retired objects not yet freed.
+    size_t Pending() const { return this->retired.size(); }
+
+private:
+    struct alignas(64) readerSlot {
+        std::atomic<bool> used{false};
+        // epoch is the pinned epoch, or 0 for none.
+        std::atomic<uint64_t> epoch{0};
+    };
+
+    struct retiredObject {
+        void *p;
+        uint64_t epoch;
+        void (*free)(void *);
+    };
+
+    std::atomic<uint64_t> global{1};
+    std::array<readerSlot, maxReaders> slots;
+    std::deque<retiredObject> retired;
+};
+
+struct sharedSlot;
+
+// sharedState is one published version of a node: its properties and its
+// children. It is never changed once published.
+struct sharedState {
+    SmallVector<Property, 2> props;
+    std::vector<const sharedSlot *> children;
+};
+
+// sharedSlot is the reader-side identity of a node. Its state is replaced
+// whenever the node changes.
+struct sharedSlot {
+    std::atomic<const sharedState *> state{nullptr};
+    const sharedSlot *parent = nullptr;
+    uint32_t depth = 0;
+};
+
+// SharedNode is a reader's view of one node of a SharedTree: the node as it
+// was when the view was taken, which later writes do not change. It stays
+// valid while the SharedTree::Reader it came from is alive.
+class SharedNode {
+public:
+    SharedNode() = default;
+
+    explicit operator bool() const { return this->slot != nullptr; }
+
+    // Same returns true if both views are of the same node, of any version.
+    bool Same(const SharedNode &other) const { return this->slot == other.slot; }
+
+    // Refresh returns a view of the latest version of the node.
+    SharedNode Refresh() const { return SharedNode(this->slot); }
+
+    uint32_t Depth() const { return this->slot->depth; }
+
+    // Parent returns the node's parent, or an empty view for the root.
+    SharedNode Parent() const { return SharedNode(this->slot->parent); }
+
+    size_t ChildCount() const { return this->state->children.size(); }
+
+    SharedNode Child(size_t i) const { return SharedNode(this->state->children.at(i)); }
+
+    // GetValueView returns the first value of a key, or "" if it has none.
+    std::string_view GetValueView(PropKey key) const {
+        for (auto &prop: this->state->props) {
+            if (prop.key == key) {
+                return prop.values[0].view();
+            }
+        }
+        return std::string_view();
+    }
+
+    std::vector<std::string> AllValues(PropKey key) const {
+        std::vector<std::string> ret;
+        for (auto &prop: this->state->props) {
+            if (prop.key == key) {
+                for (auto &val: prop.values) {
+                    ret.push_back(val.str());
+                }
+            }
+        }
+        return ret;
+    }
+
+    std::vector<std::string> AllKeys() const {
+        std::vector<std::string> ret;
+        for (auto &prop: this->state->props) {
+            ret.push_back(KeyName(prop.key));
+        }
+        return ret;
+    }
+
+    // GetBoard replays the line from the root to the node, as currently
+    // published, onto a new board.
+    std::shared_ptr<Board> GetBoard() const {
+        std::vector<const sharedState *> line;
+        for (const sharedSlot *s = this->slot; s; s = s->parent) {
+            line.push_back(s == this->slot ? this->state : s->state.load(std::memory_order_acquire));
+        }
+        std::reverse(line.begin(), line.end());
+        int size = 19;
+        for (auto &prop: line[0]->props) {
+            if (prop.key == Key::SZ) {
+                try {
+                    size = std::stoi(prop.values[0].str());
+                } catch (...) {
+                }
+            }
+        }
+        auto board = std::make_shared<Board>(size);
+        for (auto state: line) {
+            Node::applyProperties(state->props, *board);
+        }
+        return board;
+    }
+
+private:
+    friend class SharedTree;
+
+    explicit SharedNode(const sharedSlot *s) :
+        slot(s), state(s ? s->state.load(std::memory_order_acquire) : nullptr) {}
+
+    const sharedSlot *slot = nullptr;
+    const sharedState *state = nullptr;
+};
+
+// SharedTree lets any number of reader threads walk a game tree while writers
+// change it, without readers ever blocking or seeing a half-made change.
+//
+// Writers change the Node tree through the SharedTree, one at a time under a
+// lock, and each change publishes a new immutable version of the properties
+// and children of the nodes it touched with a single atomic store (read-copy-
+// update). Readers never look at the Node tree itself, whose children vectors,
+// properties and board caches are changed in place, but at the published
+// versions, through a Reader that pins an epoch so the versions it can see
+// outlive it.
+class SharedTree {
+public:
+    // Reader pins the tree's published versions until it is destroyed or
+    // repinned. A Reader belongs to one thread; a thread may hold several.
+    class Reader {
+    public:
+        explicit Reader(const SharedTree &tree) : tree(tree), slot(tree.epochs.Pin()) {}
+
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+
+        ~Reader() { this->tree.epochs.Unpin(this->slot); }
+
+        SharedNode Root() const { return SharedNode(this->tree.rootSlot); }
+
+        // Repin lets the versions read so far be freed, and moves on to the
+        // latest ones. Views taken before must not be used after it. A reader
+        // that runs for a long time should repin between reads.
+        void Repin() { this->tree.epochs.Repin(this->slot); }
+
+    private:
+        const SharedTree &tree;
+        int slot;
+    };
+
+    // SharedTree publishes the whole tree containing node. From then on the
+    // tree must only be changed through the SharedTree. It must outlive its
+    // Readers.
+    explicit SharedTree(std::shared_ptr<Node> node) : root(node->GetRoot()) {
+        std::lock_guard<std::mutex> lock(this->mu);
+        this->republish();
+        this->rootSlot = this->slots.at(this->root.get()).slot.get();
+    }
+
+    SharedTree(const SharedTree &) = delete;
+    SharedTree &operator=(const SharedTree &) = delete;
+
+    ~SharedTree() {
+        for (auto &s: this->slots) {
+            delete s.second.slot->state.load();
+        }
+    }
+
+    // Root returns the writers' handle to the root. Writers may read the Node
+    // tree between their own changes, as long as no other writer runs.
+    std::shared_ptr<Node> Root() const { return this->root; }
+
+    void AddValue(Node &node, PropKey key, std::string_view val) {
+        std::lock_guard<std::mutex> lock(this->mu);
+        node.AddValue(key, val);
+        this->publish(this->slotOf(node), node);
+        this->epochs.Reclaim();
+    }
+
+    void SetValue(Node &node, PropKey key, std::string_view val) {
+        std::lock_guard<std::mutex> lock(this->mu);
+        node.SetValue(key, val);
+        this->publish(this->slotOf(node), node);
+        this->epochs.Reclaim();
+    }
+
+    void DeleteKey(Node &node, PropKey key) {
+        std::lock_guard<std::mutex> lock(this->mu);
+        node.DeleteKey(key);
+        this->publish(this->slotOf(node), node);
+        this->epochs.Reclaim();
+    }
+
+    // PlayColour is Node::PlayColour: it returns the child with the move, made
+    // and published if it is new.
+    std::shared_ptr<Node> PlayColour(Node &node, const std::string &move, Colour colour, bool checkLegal) {
+        std::lock_guard<std::mutex> lock(this->mu);
+        sharedSlot *parent = this->slotOf(node);
+        auto child = node.PlayColour(move, colour, checkLegal);
+        this->adopt(parent, node, *child);
+        this->epochs.Reclaim();
+        return child;
+    }
+
+    // NewNode is Node::NewNode: it makes and publishes a new last child.
+    std::shared_ptr<Node> NewNode(Node &parent) {
+        std::lock_guard<std::mutex> lock(this->mu);
+        sharedSlot *slot = this->slotOf(parent);
+        auto child = Node::NewNode(parent.self());
+        this->adopt(slot, parent, *child);
+        this->epochs.Reclaim();
+        return child;
+    }
+
+    // Write runs f(root) for changes the methods above do not cover, such as
+    // deleting or moving nodes, and then publishes the whole tree again.
+    template <typename F>
+    void Write(F f) {
+        std::lock_guard<std::mutex> lock(this->mu);
+        f(*this->root);
+        this->republish();
+    }
+
+    // Pending returns the number of old versions waiting for readers to move on.
+    size_t Pending() const {
+        std::lock_guard<std::mutex> lock(this->mu);
+        return this->epochs.Pending();
+    }
+
+private:
+    sharedSlot *slotOf(Node &node) {
+        auto it = this->slots.find(&node);
+        if (it == this->slots.end()) {
+            throw std::invalid_argument("SharedTree: node is not in the tree");
+        }
+        return it->second.slot.get();
+    }
+
+    // publish replaces the published version of a node, whose children must
+    // all have slots, and retires the old one.
+    void publish(sharedSlot *slot, Node &node) {
+        auto state = new sharedState{node.props, {}};
+        state->children.reserve(node.childCount());
+        node.eachChild([&](Node *child) { state->children.push_back(this->slots.at(child).slot.get()); });
+        this->epochs.Retire(slot->state.exchange(state, std::memory_order_acq_rel));
+    }
+
+    // adopt publishes a child that may be new, then its parent.
+    void adopt(sharedSlot *parentSlot, Node &parent, Node &child) {
+        auto &entry = this->slots[&child];
+        if (entry.slot) {
+            return;
+        }
+        entry.node = child.self();
+        entry.slot = std::make_unique<sharedSlot>();
+        entry.slot->parent = parentSlot;
+        entry.slot->depth = parentSlot->depth + 1;
+        this->publish(entry.slot.get(), child);
+        this->publish(parentSlot, parent);
+    }
+
+    // republish publishes every node again, children before their parents,
+    // and retires the slots of nodes that have left the tree. A node keeps
+    // its slot if it is still under the same parent. Nodes made since the
+    // last publish cannot be taken for old ones, because the slots held the
+    // old ones alive and so their addresses could not be reused.
+    void republish() {
+        std::unordered_map<Node *, slotEntry> old;
+        old.swap(this->slots);
+        std::vector<sharedSlot *> line{nullptr};
+        this->root->Walk(
+                [&](Node *node) {
+                    auto it = old.find(node);
+                    slotEntry entry;
+                    if (it != old.end() && it->second.slot->parent == line.back()) {
+                        entry = std::move(it->second);
+                        old.erase(it);
+                    } else {
+                        entry.node = node->self();
+                        entry.slot = std::make_unique<sharedSlot>();
+                        entry.slot->parent = line.back();
+                        entry.slot->depth = line.back() ? line.back()->depth + 1 : 0;
+                    }
+                    line.push_back(entry.slot.get());
+                    this->slots[node] = std::move(entry);
+                },
+                [&](Node *node) {
+                    line.pop_back();
+                    this->publish(this->slots[node].slot.get(), *node);
+                });
+        for (auto &s: old) {
+            this->epochs.Retire(s.second.slot->state.load());
+            this->epochs.Retire(s.second.slot.release());
+        }
+        this->epochs.Reclaim();
+    }
+
+    // slotEntry is the slot of a node, with a handle that keeps the node alive
+    // while it has the slot.
+    struct slotEntry {
+        std::shared_ptr<Node> node;
+        std::unique_ptr<sharedSlot> slot;
+    };
+
+    mutable std::mutex mu;
+    std::shared_ptr<Node> root;
+    // slots maps every node of the tree to its slot; only writers use it.
+    std::unordered_map<Node *, slotEntry> slots;
+    const sharedSlot *rootSlot = nullptr;
+    mutable EpochDomain epochs;
+};
+
+#endif // CONSOLEGO_CONCURRENT_H
@@ -0,0 +1,107 @@
+#ifndef CONSOLEGO_CURSOR_H
+#define CONSOLEGO_CURSOR_H
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "board.h"
+#include "node.h"
+
+// Cursor is a place in a game tree together with one mutable board holding the
+// position after it. Moving down applies a node to the board as one undo step
+// and moving up undoes it, so stepping through a game, or between variations,
+// copies no boards and leaves the tree's board cache alone. Once the cursor
+// has been as deep as a line, moving along it allocates nothing.
+//
+// The nodes between the root and the cursor must not change while the cursor
+// is on them.
+class Cursor {
+public:
+    // Cursor starts at the root of the tree containing node and moves to node.
+    explicit Cursor(const std::shared_ptr<Node> &node) :
+        root(node->GetRoot()), node(this->root.get()), board(this->root->RootBoardSize()) {
+        this->board.km = this->root->RootKomi();
+        this->board.superko = this->root->boardCache()->superko;
+        if (this->board.superko != Superko::NONE) {
+            this->board.RecordHistory();
+        }
+        this->root->updateBoard(this->board);
+        this->Jump(*node);
+    }
+
+    Cursor(const Cursor &) = delete;
+    Cursor &operator=(const Cursor &) = delete;
+
+    // Current returns the node the cursor is on.
+    Node *Current() const { return this->node; }
+
+    // GetBoard returns the position after the current node. It changes as the
+    // cursor moves; Copy() it to keep it.
+    const Board &GetBoard() const { return this->board; }
+
+    // Next moves to the child'th child of the current node. It returns false,
+    // and does not move, if there is no such child.
+    bool Next(size_t child = 0) {
+        Node *found = nullptr;
+        size_t k = 0;
+        this->node->eachChild([&](Node *c) {
+            if (k++ == child) {
+                found = c;
+            }
+        });
+        if (!found) {
+            return false;
+        }
+        this->enter(found);
+        return true;
+    }
+
+    // Prev moves to the parent of the current node. It returns false at the
+    // root.
+    bool Prev() {
+        Node *parent = this->node->parentNode();
+        if (!parent) {
+            return false;
+        }
+        this->board.Undo();
+        this->node = parent;
+        return true;
+    }
+
+    // Jump moves to another node of the same tree: it undoes the current line
+    // up to the common ancestor of the two nodes and replays the target's line
+    // down from there.
+    void Jump(Node &target) {
+        Node *common = this->node->commonAncestor(&target);
+        if (!common) {
+            throw std::invalid_argument("Cursor::Jump(): node is in another tree");
+        }
+        while (this->node != common) {
+            this->Prev();
+        }
+        this->path.clear();
+        for (Node *n = &target; n != common; n = n->parentNode()) {
+            this->path.push_back(n);
+        }
+        for (auto it = this->path.rbegin(); it != this->path.rend(); ++it) {
+            this->enter(*it);
+        }
+    }
+
+private:
+    std::shared_ptr<Node> root;
+    Node *node;
+    Board board;
+    std::vector<Node *> path;
+
+    // enter applies child, a child of the current node, and moves to it.
+    void enter(Node *child) {
+        this->board.Mark();
+        this->board.step++;
+        child->updateBoard(this->board);
+        this->node = child;
+    }
+};
+
+#endif // CONSOLEGO_CURSOR_H
@@ -0,0 +1,333 @@
+#ifndef CONSOLEGO_DEDUP_H
+#define CONSOLEGO_DEDUP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "io.h"
+
+// GameSignature identifies a game for deduplication: its Dyer signature and the
+// Zobrist hash of the stones at the end of its main line, both taken in the
+// canonical orientation of that final position, so a game recorded rotated or
+// mirrored has the same signature.
+struct GameSignature {
+    std::string dyer;
+    uint64_t position = 0;
+};
+
+// SignGame computes the signature of the tree containing root. The main line is
+// replayed on a single scratch board, without touching the tree's board cache.
+// A final position that is itself symmetric has several canonical symmetries;
+// the smallest Dyer signature among them is used.
+inline GameSignature SignGame(Node &root) {
+    GameSignature sig;
+    Node *node = root.GetRoot().get();
+    Board board(node->RootBoardSize());
+    for (; node; node = node->firstChild()) {
+        node->updateBoard(board);
+    }
+    auto hashes = board.SymmetryHashes();
+    sig.position = *std::min_element(hashes.begin(), hashes.end());
+    for (int s = 0; s < symmetries; s++) {
+        if (hashes[s] == sig.position) {
+            auto dyer = root.Dyer(s);
+            if (sig.dyer.empty() || dyer < sig.dyer) {
+                sig.dyer = std::move(dyer);
+            }
+        }
+    }
+    return sig;
+}
+
+// DedupHash folds a Dyer signature into 64 bits (FNV-1a).
+inline uint64_t DedupHash(std::string_view s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c: s) {
+        h = (h ^ c) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// DedupRecord is one game in a DedupIndex.
+struct DedupRecord {
+    uint64_t dyer;
+    uint64_t position;
+    uint32_t file;
+    uint32_t game;
+
+    bool SameGame(const DedupRecord &o) const { return this->dyer == o.dyer && this->position == o.position; }
+
+    bool operator<(const DedupRecord &o) const {
+        if (this->dyer != o.dyer) {
+            return this->dyer < o.dyer;
+        }
+        if (this->position != o.position) {
+            return this->position < o.position;
+        }
+        if (this->file != o.file) {
+            return this->file < o.file;
+        }
+        return this->game < o.game;
+    }
+};
+
+// DedupFile is a file known to a DedupIndex. The size and modification time
+// tell whether it has changed since it was hashed.
+struct DedupFile {
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+// DedupUpdate reports what DedupIndex::Update did.
+struct DedupUpdate {
+    size_t filesHashed = 0;
+    size_t filesDropped = 0;
+    size_t gamesAdded = 0;
+    std::vector<std::pair<std::string, std::string>> errors;
+};
+
+// DedupIndex maps game signatures to the games that have them. Records are kept
+// sorted by signature, so duplicates are adjacent and a lookup is a binary
+// search; on disk the index is the file table followed by the packed records.
+class DedupIndex {
+public:
+    // Load reads an index saved by Save, or returns an empty index if the file
+    // does not exist.
+    static DedupIndex Load(const std::string &path) {
+        DedupIndex idx;
+        std::error_code ec;
+        if (!std::filesystem::exists(path, ec)) {
+            return idx;
+        }
+        MappedFile file(path);
+        auto in = file.View();
+        size_t pos = 0;
+        auto read = [&](void *dst, size_t n) {
+            if (pos + n > in.size()) {
+                throw std::runtime_error("DedupIndex: truncated index " + path);
+            }
+            std::memcpy(dst, in.data() + pos, n);
+            pos += n;
+        };
+        char magic[8];
+        read(magic, sizeof(magic));
+        // Indexes from before signatures were canonical are rebuilt from scratch.
+        if (std::memcmp(magic, oldMagic, sizeof(magic)) == 0) {
+            return idx;
+        }
+        if (std::memcmp(magic, fileMagic, sizeof(magic)) != 0) {
+            throw std::runtime_error("DedupIndex: not an index file " + path);
+        }
+        uint64_t nfiles, nrecords;
+        read(&nfiles, sizeof(nfiles));
+        read(&nrecords, sizeof(nrecords));
+        idx.files.resize(nfiles);
+        for (auto &f: idx.files) {
+            uint32_t len;
+            read(&f.size, sizeof(f.size));
+            read(&f.mtime, sizeof(f.mtime));
+            read(&len, sizeof(len));
+            f.path.resize(len);
+            read(f.path.data(), len);
+        }
+        if (nrecords > (in.size() - pos) / sizeof(DedupRecord)) {
+            throw std::runtime_error("DedupIndex: truncated index " + path);
+        }
+        idx.records.resize(nrecords);
+        read(idx.records.data(), nrecords * sizeof(DedupRecord));
+        for (auto &r: idx.records) {
+            if (r.file >= nfiles) {
+                throw std::runtime_error("DedupIndex: corrupt index " + path);
+            }
+        }
+        return idx;
+    }
+
+    // Save writes the index to a temporary file and renames it over path, so an
+    // interrupted run leaves the previous index intact. The index is in host
+    // byte order.
+    void Save(const std::string &path) const {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                throw std::runtime_error("DedupIndex: cannot write " + tmp);
+            }
+            auto write = [&out](const void *p, size_t n) { out.write(static_cast<const char *>(p), n); };
+            uint64_t nfiles = this->files.size();
+            uint64_t nrecords = this->records.size();
+            write(fileMagic, 8);
+            write(&nfiles, sizeof(nfiles));
+            write(&nrecords, sizeof(nrecords));
+            for (auto &f: this->files) {
+                auto len = static_cast<uint32_t>(f.path.size());
+                write(&f.size, sizeof(f.size));
+                write(&f.mtime, sizeof(f.mtime));
+                write(&len, sizeof(len));
+                write(f.path.data(), len);
+            }
+            write(this->records.data(), this->records.size() * sizeof(DedupRecord));
+            if (!out.flush()) {
+                throw std::runtime_error("DedupIndex: cannot write " + tmp);
+            }
+        }
+        std::filesystem::rename(tmp, path);
+    }
+
+    // Update hashes the SGF files in paths (directories are searched with
+    // FindSGFFiles) that are new to the index or have changed since they were
+    // hashed, in parallel. Files that are already indexed and unchanged are not
+    // read at all, and files that no longer exist are dropped with their games.
+    // A file that cannot be read keeps the size and time it was last hashed
+    // with, so it is tried again on the next run.
+    DedupUpdate Update(const std::vector<std::string> &paths, const BulkOptions &opts = {}) {
+        DedupUpdate ret;
+        ret.filesDropped = this->dropMissing();
+
+        std::unordered_map<std::string, uint32_t> known;
+        for (uint32_t i = 0; i < this->files.size(); i++) {
+            known.emplace(this->files[i].path, i);
+        }
+
+        std::vector<std::string> todo;
+        std::vector<uint32_t> ids;
+        std::vector<DedupFile> before;
+        std::vector<bool> stale(this->files.size(), false);
+        for (auto &p: FindSGFFiles(paths)) {
+            DedupFile f{p, 0, 0};
+            std::error_code ec;
+            f.size = std::filesystem::file_size(p, ec);
+            f.mtime = std::filesystem::last_write_time(p, ec).time_since_epoch().count();
+            auto it = known.find(p);
+            if (it != known.end()) {
+                auto &old = this->files[it->second];
+                if (old.size == f.size && old.mtime == f.mtime) {
+                    continue;
+                }
+                before.push_back(old);
+                old = f;
+                stale[it->second] = true;
+                ids.push_back(it->second);
+            } else {
+                auto id = static_cast<uint32_t>(this->files.size());
+                known.emplace(p, id);
+                before.push_back(DedupFile{p, 0, 0});
+                this->files.push_back(f);
+                stale.push_back(false);
+                ids.push_back(id);
+            }
+            todo.push_back(p);
+        }
+
+        ret.filesHashed = todo.size();
+        if (todo.empty()) {
+            return ret;
+        }
+        this->records.erase(std::remove_if(this->records.begin(), this->records.end(),
+                                           [&stale](const DedupRecord &r) { return stale[r.file]; }),
+                            this->records.end());
+
+        std::vector<DedupRecord> added;
+        std::mutex mu;
+        auto errors = ParseBulk(todo, opts, [&](size_t f, size_t g, std::shared_ptr<Node> root) {
+            auto sig = SignGame(*root);
+            DedupRecord r{DedupHash(sig.dyer), sig.position, ids[f], static_cast<uint32_t>(g)};
+            std::lock_guard<std::mutex> lock(mu);
+            added.push_back(r);
+        });
+        for (size_t f = 0; f < todo.size(); f++) {
+            for (auto &e: errors[f]) {
+                ret.errors.emplace_back(todo[f], e.Message());
+                if (e.game == noGame) {
+                    this->files[ids[f]] = before[f];
+                }
+            }
+        }
+        ret.gamesAdded = added.size();
+
+        std::sort(added.begin(), added.end());
+        size_t mid = this->records.size();
+        this->records.insert(this->records.end(), added.begin(), added.end());
+        std::inplace_merge(this->records.begin(), this->records.begin() + mid, this->records.end());
+        return ret;
+    }
+
+    // Lookup returns the games with a signature.
+    std::vector<DedupRecord> Lookup(const GameSignature &sig) const {
+        DedupRecord lo{DedupHash(sig.dyer), sig.position, 0, 0};
+        DedupRecord hi{lo.dyer, lo.position, UINT32_MAX, UINT32_MAX};
+        return std::vector<DedupRecord>(std::lower_bound(this->records.begin(), this->records.end(), lo),
+                                        std::upper_bound(this->records.begin(), this->records.end(), hi));
+    }
+
+    // Clusters returns every group of two or more games with the same
+    // signature, each in file and game order.
+    std::vector<std::vector<DedupRecord>> Clusters() const {
+        std::vector<std::vector<DedupRecord>> ret;
+        for (size_t i = 0; i < this->records.size();) {
+            size_t j = i + 1;
+            while (j < this->records.size() && this->records[j].SameGame(this->records[i])) {
+                j++;
+            }
+            if (j - i > 1) {
+                ret.emplace_back(this->records.begin() + i, this->records.begin() + j);
+            }
+            i = j;
+        }
+        return ret;
+    }
+
+    const std::vector<DedupFile> &Files() const { return this->files; }
+
+    const std::vector<DedupRecord> &Records() const { return this->records; }
+
+private:
+    // dropMissing removes the files that no longer exist, and their records,
+    // and renumbers the rest. Renumbering keeps the order of files, so the
+    // records stay sorted. It returns the number of files removed.
+    size_t dropMissing() {
+        std::vector<uint32_t> renumber(this->files.size());
+        size_t kept = 0;
+        for (size_t i = 0; i < this->files.size(); i++) {
+            std::error_code ec;
+            if (!std::filesystem::exists(this->files[i].path, ec)) {
+                renumber[i] = UINT32_MAX;
+                continue;
+            }
+            renumber[i] = static_cast<uint32_t>(kept);
+            if (kept != i) {
+                this->files[kept] = std::move(this->files[i]);
+            }
+            kept++;
+        }
+        size_t dropped = this->files.size() - kept;
+        if (dropped == 0) {
+            return 0;
+        }
+        this->files.resize(kept);
+        auto gone = [&renumber](const DedupRecord &r) { return renumber[r.file] == UINT32_MAX; };
+        this->records.erase(std::remove_if(this->records.begin(), this->records.end(), gone), this->records.end());
+        for (auto &r: this->records) {
+            r.file = renumber[r.file];
+        }
+        return dropped;
+    }
+
+    static constexpr char fileMagic[9] = "GODEDUP2";
+    static constexpr char oldMagic[9] = "GODEDUP1";
+
+    std::vector<DedupFile> files;
+    std::vector<DedupRecord> records;
+};
+
+#endif // CONSOLEGO_DEDUP_H
@@ -0,0 +1,228 @@
+#ifndef CONSOLEGO_ESTIMATE_H
+#define CONSOLEGO_ESTIMATE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "board.h"
+#include "pool.h"
+#include "zobrist.h"
+
+// EstimateOptions bounds the work done by Estimate. It stops at whichever
+// comes first, the playout budget or the deadline.
+struct EstimateOptions {
+    int playouts = 1000;
+    // deadline is measured from the call; zero means no deadline.
+    std::chrono::microseconds deadline{0};
+    // threads is the number of worker threads; 0 uses every hardware thread.
+    unsigned threads = 0;
+    // seed makes the result reproducible: playout n always uses the same random
+    // sequence, whichever thread runs it.
+    uint64_t seed = 1;
+    // Points whose ownership is within controversy of zero are counted as
+    // controversial.
+    float controversy = 0.5f;
+};
+
+// playoutRng is a xorshift64* generator, seeded per playout.
+struct playoutRng {
+    uint64_t state;
+
+    explicit playoutRng(uint64_t seed) {
+        uint64_t s = seed;
+        this->state = ZobristTable::splitmix64(s) | 1;
+    }
+
+    uint32_t Below(uint32_t n) {
+        this->state ^= this->state >> 12;
+        this->state ^= this->state << 25;
+        this->state ^= this->state >> 27;
+        uint64_t r = this->state * 0x2545f4914f6cdd1dULL;
+        return static_cast<uint32_t>(((r >> 32) * n) >> 32);
+    }
+};
+
+// isOwnEye returns true if every neighbour of the empty point i is a stone of
+// colour c. Random playouts never fill such points, so they end.
+inline bool isOwnEye(const Board &b, int i, Colour c) {
+    const Adjacent &adj = (*b.nbr)[i];
+    for (int k = 0; k < adj.count; k++) {
+        if (b.At(adj.n[k]) != c) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// playout plays random legal moves on b, never filling a player's own eyes,
+// until both players pass, then adds each point's final owner to counts:
+// +1 for black, -1 for white. An empty point belongs to a colour if all its
+// neighbours are that colour.
+inline void playout(Board &b, playoutRng &rng, int32_t *counts) {
+    int points = b.size * b.size;
+    std::vector<int> empties;
+    empties.reserve(points);
+    for (int i = 0; i < points; i++) {
+        if (b.At(i) == Colour::EMPTY) {
+            empties.push_back(i);
+        }
+    }
+    Colour c = b.player;
+    int passes = 0;
+    for (int moves = 0; passes < 2 && moves < 3 * points; moves++) {
+        // Try candidates in random order; ones that fail are swapped to the end
+        // so they are not tried again this move.
+        int n = static_cast<int>(empties.size());
+        int played = noPoint;
+        while (n > 0) {
+            int k = static_cast<int>(rng.Below(n));
+            int i = empties[k];
+            if (!isOwnEye(b, i, c) && b.legal(i, c)) {
+                played = k;
+                break;
+            }
+            std::swap(empties[k], empties[--n]);
+        }
+        if (played == noPoint) {
+            b.PassColour(c);
+            passes++;
+        } else {
+            int i = empties[played];
+            empties[played] = empties.back();
+            empties.pop_back();
+            // Opponent chains in atari are captured by the move; their stones
+            // become empty points again.
+            const Adjacent &adj = (*b.nbr)[i];
+            int heads[4];
+            int nheads = 0;
+            for (int k = 0; k < adj.count; k++) {
+                int n = adj.n[k];
+                if (b.At(n) != Opponent(c) || b.libsOf(n) != 1) {
+                    continue;
+                }
+                int head = b.chains[n].head;
+                if (std::find(heads, heads + nheads, head) != heads + nheads) {
+                    continue;
+                }
+                heads[nheads++] = head;
+                int s = head;
+                do {
+                    empties.push_back(s);
+                    s = b.chains[s].next;
+                } while (s != head);
+            }
+            b.playMove(i, c);
+            passes = 0;
+        }
+        c = Opponent(c);
+    }
+    for (int i = 0; i < points; i++) {
+        Colour owner = b.At(i);
+        if (owner == Colour::EMPTY) {
+            const Adjacent &adj = (*b.nbr)[i];
+            owner = adj.count ? b.At(adj.n[0]) : Colour::EMPTY;
+            for (int k = 1; k < adj.count; k++) {
+                if (b.At(adj.n[k]) != owner) {
+                    owner = Colour::EMPTY;
+                }
+            }
+        }
+        counts[i] += owner == Colour::BLACK ? 1 : owner == Colour::WHITE ? -1 : 0;
+    }
+}
+
+// playoutBoard returns a scratch copy of b to run playouts on, without the
+// superko history and symmetry hashes that playouts have no use for.
+inline std::shared_ptr<Board> playoutBoard(Board &b) {
+    auto ret = b.Copy();
+    ret->superko = Superko::NONE;
+    ret->history = nullptr;
+    ret->symmetry = nullptr;
+    return ret;
+}
+
+// scratchPlayout runs a playout on a board from playoutBoard as one undo step,
+// and takes it back, so the board is ready for the next playout.
+inline void scratchPlayout(Board &b, playoutRng &rng, int32_t *counts) {
+    b.Mark();
+    playout(b, rng, counts);
+    b.Undo();
+}
+
+// Estimate runs random playouts from the position on several threads and
+// writes the result into the board: ownership[i] is the mean final owner of
+// point i, from -1 (always white) to 1 (always black); bScore and wScore count
+// the points whose ownership favours each side, with komi added to white; and
+// controversyCount is the number of points whose ownership is within
+// opts.controversy of zero.
+// Every thread plays on its own copy of the board, made once and reset after
+// each playout, and keeps its own counts, which are added into shared atomic
+// counters when it finishes. Returns the number of playouts run.
+inline int Estimate(Board &b, const EstimateOptions &opts = {}) {
+    auto start = std::chrono::steady_clock::now();
+    int points = b.size * b.size;
+    std::vector<std::atomic<int32_t>> totals(points);
+    std::atomic<int> next{0};
+    std::atomic<int> done{0};
+
+    auto expired = [&] {
+        return opts.deadline.count() > 0 && std::chrono::steady_clock::now() - start >= opts.deadline;
+    };
+
+    auto work = [&] {
+        std::vector<int32_t> counts(points, 0);
+        auto scratch = playoutBoard(b);
+        int mine = 0;
+        for (;;) {
+            int n = next.fetch_add(1, std::memory_order_relaxed);
+            if (n >= opts.playouts || expired()) {
+                break;
+            }
+            playoutRng rng(opts.seed * 0x9e3779b97f4a7c15ULL + static_cast<uint64_t>(n));
+            scratchPlayout(*scratch, rng, counts.data());
+            mine++;
+        }
+        for (int i = 0; i < points; i++) {
+            if (counts[i] != 0) {
+                totals[i].fetch_add(counts[i], std::memory_order_relaxed);
+            }
+        }
+        done.fetch_add(mine, std::memory_order_relaxed);
+    };
+
+    {
+        ThreadPool pool(opts.threads);
+        for (unsigned t = 0; t < pool.Size(); t++) {
+            pool.Submit(work);
+        }
+        pool.Wait();
+    }
+
+    int playouts = done.load();
+    b.bScore = 0.0f;
+    b.wScore = b.km;
+    b.controversyCount = 0;
+    b.ownership.assign(points, 0.0f);
+    if (playouts == 0) {
+        return 0;
+    }
+    for (int i = 0; i < points; i++) {
+        float own = static_cast<float>(totals[i].load()) / static_cast<float>(playouts);
+        b.ownership[i] = own;
+        if (own > 0) {
+            b.bScore++;
+        } else if (own < 0) {
+            b.wScore++;
+        }
+        if (own > -opts.controversy && own < opts.controversy) {
+            b.controversyCount++;
+        }
+    }
+    return playouts;
+}
+
+#endif // CONSOLEGO_ESTIMATE_H
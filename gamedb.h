@@ -0,0 +1,518 @@
+#ifndef CONSOLEGO_GAMEDB_H
+#define CONSOLEGO_GAMEDB_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "binary.h"
+#include "io.h"
+#include "node.h"
+
+// gameDBKeys are the root properties a game database keeps as string columns.
+constexpr PropKey gameDBKeys[] = {Key::PB, Key::PW, Key::BR, Key::WR, Key::DT, Key::RE, shortKey("EV")};
+constexpr int gameDBKeyCount = sizeof(gameDBKeys) / sizeof(gameDBKeys[0]);
+
+// gameDBColumn returns the index of a key in gameDBKeys.
+inline int gameDBColumn(PropKey key) {
+    for (int k = 0; k < gameDBKeyCount; k++) {
+        if (gameDBKeys[k] == key) {
+            return k;
+        }
+    }
+    throw std::invalid_argument("GameDB: no column for " + KeyName(key));
+}
+
+// A game database file is a header followed by sections, each starting on an
+// 8-byte boundary, in host byte order. Strings are stored once, sorted, and
+// string columns hold their indexes; the other columns are values decoded
+// from the root properties. Each game's moves are its whole tree in the binary
+// game format.
+enum gameDBSection : int {
+    dbStringOffsets, // uint64_t[strings + 1], into dbStringBytes
+    dbStringBytes,
+    dbSize,          // uint8_t[games], SZ, 19 if absent
+    dbKomi,          // float[games], KM, NaN if absent
+    dbDate,          // uint32_t[games], the first date of DT as yyyymmdd, 0 if absent
+    dbWinner,        // int8_t[games], the Colour that won by RE, EMPTY if none
+    dbSource,        // uint32_t[games], string index of the file the game came from
+    dbSourceGame,    // uint32_t[games], index of the game in that file
+    dbMoveOffsets,   // uint64_t[games + 1], into dbMoves
+    dbMoves,
+    dbKeyColumns,    // uint32_t[games] for each of gameDBKeys
+    dbSections = dbKeyColumns + gameDBKeyCount,
+};
+
+struct gameDBHeader {
+    char magic[8];
+    uint64_t games;
+    uint64_t strings;
+    uint64_t offset[dbSections];
+    uint64_t length[dbSections];
+};
+
+constexpr char gameDBMagic[8] = {'G', 'O', 'G', 'A', 'M', 'E', 'D', '1'};
+
+// parseGameDate returns the first date of a DT value as yyyymmdd, with 0 for
+// a missing month or day, or 0 if it does not start with a year.
+inline uint32_t parseGameDate(std::string_view dt) {
+    uint32_t parts[3] = {0, 0, 0};
+    size_t pos = 0;
+    for (int p = 0; p < 3; p++) {
+        size_t digits = p == 0 ? 4 : 2;
+        if (p > 0 && (pos >= dt.size() || dt[pos] != '-')) {
+            break;
+        }
+        size_t start = p == 0 ? pos : pos + 1;
+        if (start + digits > dt.size()) {
+            break;
+        }
+        uint32_t v = 0;
+        for (size_t i = start; i < start + digits; i++) {
+            if (dt[i] < '0' || dt[i] > '9') {
+                return p == 0 ? 0 : parts[0] * 10000 + parts[1] * 100;
+            }
+            v = v * 10 + static_cast<uint32_t>(dt[i] - '0');
+        }
+        parts[p] = v;
+        pos = start + digits;
+    }
+    return parts[0] * 10000 + parts[1] * 100 + parts[2];
+}
+
+// GameQuery selects games of a GameDB by their root properties. Empty and
+// unset fields match every game.
+struct GameQuery {
+    // player must be PB or PW.
+    std::string player;
+    // equals holds root properties, from gameDBKeys, that must have exactly
+    // the given value.
+    std::vector<std::pair<PropKey, std::string>> equals;
+    int size = 0;
+    std::optional<float> minKomi;
+    std::optional<float> maxKomi;
+    // fromDate and toDate bound the date as yyyymmdd; games without a date
+    // never match a bound.
+    uint32_t fromDate = 0;
+    uint32_t toDate = 0;
+    Colour winner = Colour::EMPTY;
+};
+
+// GameDBWriter collects games and saves them as a game database file.
+class GameDBWriter {
+public:
+    GameDBWriter() {
+        this->intern("");
+        this->moveOffsets.push_back(0);
+    }
+
+    size_t Size() const { return this->sizes.size(); }
+
+    // Add adds the tree containing node, recording where it came from.
+    void Add(const Node &node, std::string_view source = {}, uint32_t game = 0) {
+        this->append(encode(node), source, game);
+    }
+
+    // AddFiles adds every game of the SGF files in paths, in file and game
+    // order, parsing them in parallel. It returns each game that failed to
+    // parse, as its file and error.
+    std::vector<std::pair<std::string, std::string>> AddFiles(const std::vector<std::string> &paths,
+                                                             const BulkOptions &opts = {}) {
+        auto files = FindSGFFiles(paths);
+        std::vector<std::pair<std::pair<size_t, size_t>, row>> rows;
+        std::mutex mu;
+        auto errors = ParseBulk(files, opts, [&](size_t f, size_t g, std::shared_ptr<Node> root) {
+            auto r = encode(*root);
+            std::lock_guard<std::mutex> lock(mu);
+            rows.emplace_back(std::make_pair(f, g), std::move(r));
+        });
+        std::sort(rows.begin(), rows.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        for (auto &r: rows) {
+            this->append(r.second, files[r.first.first], static_cast<uint32_t>(r.first.second));
+        }
+        std::vector<std::pair<std::string, std::string>> ret;
+        for (size_t f = 0; f < files.size(); f++) {
+            for (auto &e: errors[f]) {
+                ret.emplace_back(files[f], e.Message());
+            }
+        }
+        return ret;
+    }
+
+    // Save writes the database to a temporary file and renames it over path.
+    void Save(const std::string &path) const {
+        // Sort the strings, and renumber the string columns to match.
+        std::vector<uint32_t> order(this->strings.size());
+        for (uint32_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(),
+                  [this](uint32_t a, uint32_t b) { return this->strings[a] < this->strings[b]; });
+        std::vector<uint32_t> renumber(order.size());
+        std::vector<uint64_t> stringOffsets{0};
+        std::string stringBytes;
+        for (uint32_t i = 0; i < order.size(); i++) {
+            renumber[order[i]] = i;
+            stringBytes += this->strings[order[i]];
+            stringOffsets.push_back(stringBytes.size());
+        }
+        auto renumbered = [&renumber](const std::vector<uint32_t> &ids) {
+            std::vector<uint32_t> ret(ids.size());
+            for (size_t i = 0; i < ids.size(); i++) {
+                ret[i] = renumber[ids[i]];
+            }
+            return ret;
+        };
+
+        gameDBHeader header{};
+        std::memcpy(header.magic, gameDBMagic, sizeof(header.magic));
+        header.games = this->Size();
+        header.strings = this->strings.size();
+        std::vector<std::string> sections(dbSections);
+        auto put = [&sections](int s, const void *p, size_t n) {
+            sections[s].assign(static_cast<const char *>(p), n);
+        };
+        auto putVector = [&put](int s, const auto &v) { put(s, v.data(), v.size() * sizeof(v[0])); };
+        putVector(dbStringOffsets, stringOffsets);
+        sections[dbStringBytes] = stringBytes;
+        putVector(dbSize, this->sizes);
+        putVector(dbKomi, this->komis);
+        putVector(dbDate, this->dates);
+        putVector(dbWinner, this->winners);
+        putVector(dbSource, renumbered(this->sources));
+        putVector(dbSourceGame, this->sourceGames);
+        putVector(dbMoveOffsets, this->moveOffsets);
+        sections[dbMoves] = this->moves;
+        for (int k = 0; k < gameDBKeyCount; k++) {
+            putVector(dbKeyColumns + k, renumbered(this->keyColumns[k]));
+        }
+        uint64_t offset = sizeof(gameDBHeader);
+        for (int s = 0; s < dbSections; s++) {
+            offset = (offset + 7) & ~uint64_t(7);
+            header.offset[s] = offset;
+            header.length[s] = sections[s].size();
+            offset += sections[s].size();
+        }
+
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                throw std::runtime_error("GameDBWriter: cannot write " + tmp);
+            }
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            uint64_t at = sizeof(header);
+            for (int s = 0; s < dbSections; s++) {
+                static const char zeros[8] = {};
+                out.write(zeros, static_cast<std::streamsize>(header.offset[s] - at));
+                out.write(sections[s].data(), static_cast<std::streamsize>(sections[s].size()));
+                at = header.offset[s] + sections[s].size();
+            }
+            if (!out.flush()) {
+                throw std::runtime_error("GameDBWriter: cannot write " + tmp);
+            }
+        }
+        std::filesystem::rename(tmp, path);
+    }
+
+private:
+    // row is one game, decoded and encoded without touching the writer, so
+    // rows can be made in parallel.
+    struct row {
+        std::string values[gameDBKeyCount];
+        uint8_t size = 19;
+        float komi = std::numeric_limits<float>::quiet_NaN();
+        std::string moves;
+    };
+
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<std::string> strings;
+    std::vector<uint8_t> sizes;
+    std::vector<float> komis;
+    std::vector<uint32_t> dates;
+    std::vector<int8_t> winners;
+    std::vector<uint32_t> sources;
+    std::vector<uint32_t> sourceGames;
+    std::vector<uint64_t> moveOffsets;
+    std::string moves;
+    std::vector<uint32_t> keyColumns[gameDBKeyCount];
+
+    static row encode(const Node &node) {
+        const Node *root = &node;
+        while (Node *p = root->parentNode()) {
+            root = p;
+        }
+        row r;
+        for (int k = 0; k < gameDBKeyCount; k++) {
+            r.values[k] = std::string(root->GetValueView(gameDBKeys[k]));
+        }
+        auto sz = root->GetValueView(Key::SZ);
+        if (!sz.empty()) {
+            int size = std::atoi(std::string(sz).c_str());
+            r.size = static_cast<uint8_t>(size > 0 && size <= maxBoardSize ? size : 0);
+        }
+        auto km = std::string(root->GetValueView(Key::KM));
+        char *end = nullptr;
+        float komi = std::strtof(km.c_str(), &end);
+        if (!km.empty() && end != km.c_str()) {
+            r.komi = komi;
+        }
+        BinaryWriter().Write(r.moves, *root);
+        return r;
+    }
+
+    uint32_t intern(const std::string &s) {
+        auto [it, added] = this->ids.emplace(s, static_cast<uint32_t>(this->strings.size()));
+        if (added) {
+            this->strings.push_back(s);
+        }
+        return it->second;
+    }
+
+    void append(const row &r, std::string_view source, uint32_t game) {
+        for (int k = 0; k < gameDBKeyCount; k++) {
+            this->keyColumns[k].push_back(this->intern(r.values[k]));
+        }
+        this->sizes.push_back(r.size);
+        this->komis.push_back(r.komi);
+        this->dates.push_back(parseGameDate(r.values[gameDBColumn(Key::DT)]));
+        auto &re = r.values[gameDBColumn(Key::RE)];
+        Colour winner = Colour::EMPTY;
+        if (!re.empty() && (re[0] == 'B' || re[0] == 'b')) {
+            winner = Colour::BLACK;
+        } else if (!re.empty() && (re[0] == 'W' || re[0] == 'w')) {
+            winner = Colour::WHITE;
+        }
+        this->winners.push_back(static_cast<int8_t>(winner));
+        this->sources.push_back(this->intern(std::string(source)));
+        this->sourceGames.push_back(game);
+        this->moves += r.moves;
+        this->moveOffsets.push_back(this->moves.size());
+    }
+};
+
+// GameDB is a game database file mapped into memory. Opening it reads only
+// the header; the columns are used where they lie in the mapping, and a query
+// is a pass over each column it tests, with a loop simple enough for the
+// compiler to vectorize. Games are decoded only when asked for.
+class GameDB {
+public:
+    explicit GameDB(const std::string &path) : file(std::make_unique<MappedFile>(path)) {
+        auto in = this->file->View();
+        if (in.size() < sizeof(gameDBHeader)) {
+            throw std::runtime_error("GameDB: not a game database " + path);
+        }
+        std::memcpy(&this->header, in.data(), sizeof(gameDBHeader));
+        if (std::memcmp(this->header.magic, gameDBMagic, sizeof(gameDBMagic)) != 0) {
+            throw std::runtime_error("GameDB: not a game database " + path);
+        }
+        uint64_t n = this->header.games;
+        uint64_t expect[dbSections] = {};
+        expect[dbStringOffsets] = (this->header.strings + 1) * sizeof(uint64_t);
+        expect[dbSize] = n;
+        expect[dbKomi] = n * sizeof(float);
+        expect[dbDate] = n * sizeof(uint32_t);
+        expect[dbWinner] = n;
+        expect[dbSource] = n * sizeof(uint32_t);
+        expect[dbSourceGame] = n * sizeof(uint32_t);
+        expect[dbMoveOffsets] = (n + 1) * sizeof(uint64_t);
+        for (int k = 0; k < gameDBKeyCount; k++) {
+            expect[dbKeyColumns + k] = n * sizeof(uint32_t);
+        }
+        for (int s = 0; s < dbSections; s++) {
+            uint64_t off = this->header.offset[s];
+            uint64_t len = this->header.length[s];
+            bool sized = s == dbStringBytes || s == dbMoves || len == expect[s];
+            if (!sized || off % 8 != 0 || off > in.size() || len > in.size() - off || n > UINT32_MAX) {
+                throw std::runtime_error("GameDB: corrupt game database " + path);
+            }
+        }
+        this->stringOffsets = this->column<uint64_t>(dbStringOffsets);
+        this->stringBytes = in.substr(this->header.offset[dbStringBytes], this->header.length[dbStringBytes]);
+        this->sizes = this->column<uint8_t>(dbSize);
+        this->komis = this->column<float>(dbKomi);
+        this->dates = this->column<uint32_t>(dbDate);
+        this->winners = this->column<int8_t>(dbWinner);
+        this->sources = this->column<uint32_t>(dbSource);
+        this->sourceGames = this->column<uint32_t>(dbSourceGame);
+        this->moveOffsets = this->column<uint64_t>(dbMoveOffsets);
+        this->moves = in.substr(this->header.offset[dbMoves], this->header.length[dbMoves]);
+        for (int k = 0; k < gameDBKeyCount; k++) {
+            this->keyColumns[k] = this->column<uint32_t>(dbKeyColumns + k);
+        }
+    }
+
+    GameDB(const GameDB &) = delete;
+    GameDB &operator=(const GameDB &) = delete;
+
+    size_t Size() const { return this->header.games; }
+
+    // Value returns a root property of a game, one of gameDBKeys, or "" if the
+    // game does not have it.
+    std::string_view Value(size_t game, PropKey key) const {
+        return this->str(this->keyColumns[gameDBColumn(key)][this->check(game)]);
+    }
+
+    // BoardSize returns the SZ of a game, 19 if it has none, or 0 if it is not
+    // a supported size.
+    int BoardSize(size_t game) const { return this->sizes[this->check(game)]; }
+
+    // Komi returns the KM of a game, or NaN if it has none.
+    float Komi(size_t game) const { return this->komis[this->check(game)]; }
+
+    // Date returns the first date of the DT of a game as yyyymmdd, or 0.
+    uint32_t Date(size_t game) const { return this->dates[this->check(game)]; }
+
+    // Winner returns the colour that won a game by its RE, or EMPTY.
+    Colour Winner(size_t game) const { return static_cast<Colour>(this->winners[this->check(game)]); }
+
+    // Source returns the file a game was added from, and its index in the file.
+    std::pair<std::string_view, uint32_t> Source(size_t game) const {
+        return {this->str(this->sources[this->check(game)]), this->sourceGames[game]};
+    }
+
+    // Game decodes the whole tree of a game.
+    std::shared_ptr<Node> Game(size_t game, std::shared_ptr<NodeArena> arena = nullptr) const {
+        uint64_t from = this->moveOffsets[this->check(game)];
+        uint64_t to = this->moveOffsets[game + 1];
+        if (from > to || to > this->moves.size()) {
+            throw std::runtime_error("GameDB: corrupt game " + std::to_string(game));
+        }
+        auto root = BinaryParser(this->moves.substr(from, to - from), std::move(arena), false).Next();
+        if (!root) {
+            throw std::runtime_error("GameDB: corrupt game " + std::to_string(game));
+        }
+        return root;
+    }
+
+    // Find returns the indexes of the games that match a query, in order.
+    std::vector<uint32_t> Find(const GameQuery &q) const {
+        size_t n = this->Size();
+        std::vector<uint8_t> mask(n, 1);
+        if (!q.player.empty()) {
+            auto id = this->lookup(q.player);
+            if (!id) {
+                return {};
+            }
+            const uint32_t *pb = this->keyColumns[gameDBColumn(Key::PB)];
+            const uint32_t *pw = this->keyColumns[gameDBColumn(Key::PW)];
+            for (size_t i = 0; i < n; i++) {
+                mask[i] &= static_cast<uint8_t>((pb[i] == *id) | (pw[i] == *id));
+            }
+        }
+        for (auto &[key, value]: q.equals) {
+            auto id = this->lookup(value);
+            if (!id) {
+                return {};
+            }
+            scan(mask, this->keyColumns[gameDBColumn(key)], [v = *id](uint32_t x) { return x == v; });
+        }
+        if (q.size) {
+            scan(mask, this->sizes, [v = q.size](uint8_t x) { return x == v; });
+        }
+        if (q.minKomi) {
+            scan(mask, this->komis, [v = *q.minKomi](float x) { return x >= v; });
+        }
+        if (q.maxKomi) {
+            scan(mask, this->komis, [v = *q.maxKomi](float x) { return x <= v; });
+        }
+        if (q.fromDate) {
+            scan(mask, this->dates, [v = q.fromDate](uint32_t x) { return x >= v; });
+        }
+        if (q.toDate) {
+            scan(mask, this->dates, [v = q.toDate](uint32_t x) { return (x <= v) & (x != 0); });
+        }
+        if (q.winner != Colour::EMPTY) {
+            scan(mask, this->winners, [v = static_cast<int8_t>(q.winner)](int8_t x) { return x == v; });
+        }
+        std::vector<uint32_t> ret;
+        for (size_t i = 0; i < n; i++) {
+            if (mask[i]) {
+                ret.push_back(static_cast<uint32_t>(i));
+            }
+        }
+        return ret;
+    }
+
+private:
+    std::unique_ptr<MappedFile> file;
+    gameDBHeader header{};
+    const uint64_t *stringOffsets = nullptr;
+    std::string_view stringBytes;
+    const uint8_t *sizes = nullptr;
+    const float *komis = nullptr;
+    const uint32_t *dates = nullptr;
+    const int8_t *winners = nullptr;
+    const uint32_t *sources = nullptr;
+    const uint32_t *sourceGames = nullptr;
+    const uint64_t *moveOffsets = nullptr;
+    std::string_view moves;
+    const uint32_t *keyColumns[gameDBKeyCount] = {};
+
+    template <typename T>
+    const T *column(int s) const {
+        return reinterpret_cast<const T *>(this->file->View().data() + this->header.offset[s]);
+    }
+
+    // scan clears the mask of the games whose value in col fails keep.
+    template <typename T, typename F>
+    void scan(std::vector<uint8_t> &mask, const T *col, F keep) const {
+        uint8_t *m = mask.data();
+        for (size_t i = 0, n = mask.size(); i < n; i++) {
+            m[i] &= static_cast<uint8_t>(keep(col[i]));
+        }
+    }
+
+    size_t check(size_t game) const {
+        if (game >= this->Size()) {
+            throw std::out_of_range("GameDB: no game " + std::to_string(game));
+        }
+        return game;
+    }
+
+    std::string_view str(uint32_t id) const {
+        if (id >= this->header.strings) {
+            throw std::runtime_error("GameDB: corrupt string index");
+        }
+        uint64_t from = this->stringOffsets[id];
+        uint64_t to = this->stringOffsets[id + 1];
+        if (from > to || to > this->stringBytes.size()) {
+            throw std::runtime_error("GameDB: corrupt string table");
+        }
+        return this->stringBytes.substr(from, to - from);
+    }
+
+    // lookup binary searches the sorted strings for s.
+    std::optional<uint32_t> lookup(std::string_view s) const {
+        uint64_t lo = 0;
+        uint64_t hi = this->header.strings;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if (this->str(static_cast<uint32_t>(mid)) < s) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo < this->header.strings && this->str(static_cast<uint32_t>(lo)) == s) {
+            return static_cast<uint32_t>(lo);
+        }
+        return std::nullopt;
+    }
+};
+
+#endif // CONSOLEGO_GAMEDB_H
@@ -0,0 +1,508 @@
+#ifndef CONSOLEGO_GTP_H
+#define CONSOLEGO_GTP_H
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "board.h"
+#include "estimate.h"
+#include "io.h"
+#include "node.h"
+#include "score.h"
+
+// gtpColumns are the GTP column letters, which skip I. GTP boards are at most
+// 25x25.
+constexpr char gtpColumns[] = "ABCDEFGHJKLMNOPQRSTUVWXYZ";
+constexpr int gtpMaxSize = 25;
+
+// GTPVertex converts a point index to a GTP vertex, e.g. "D4", or "pass" for
+// noPoint.
+inline std::string GTPVertex(int i, int size) {
+    if (i == noPoint) {
+        return "pass";
+    }
+    return gtpColumns[i % size] + std::to_string(size - i / size);
+}
+
+// ParseGTPVertex converts a GTP vertex to a point index, or noPoint for
+// "pass". It throws std::invalid_argument if the vertex is not on the board.
+inline int ParseGTPVertex(std::string_view v, int size) {
+    std::string s(v);
+    for (auto &c: s) {
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+    if (s == "PASS") {
+        return noPoint;
+    }
+    const char *col = s.empty() ? nullptr : std::strchr(gtpColumns, s[0]);
+    if (!col || s.size() < 2 || s.size() > 3 || s.find_first_not_of("0123456789", 1) != std::string::npos) {
+        throw std::invalid_argument("invalid vertex");
+    }
+    int x = static_cast<int>(col - gtpColumns);
+    int row = std::stoi(s.substr(1));
+    if (x >= size || row < 1 || row > size) {
+        throw std::invalid_argument("invalid vertex");
+    }
+    return PointIndex(x, size - row, size);
+}
+
+// gtpInt parses a GTP integer argument, and gtpFloat a float. Both throw
+// std::invalid_argument("syntax error") if the whole argument is not a number.
+inline int gtpInt(const std::string &arg) {
+    char *end = nullptr;
+    errno = 0;
+    long v = std::strtol(arg.c_str(), &end, 10);
+    if (arg.empty() || *end != '\0' || errno == ERANGE || v < INT_MIN || v > INT_MAX) {
+        throw std::invalid_argument("syntax error");
+    }
+    return static_cast<int>(v);
+}
+
+inline float gtpFloat(const std::string &arg) {
+    char *end = nullptr;
+    errno = 0;
+    float v = std::strtof(arg.c_str(), &end);
+    if (arg.empty() || *end != '\0' || errno == ERANGE || !std::isfinite(v)) {
+        throw std::invalid_argument("syntax error");
+    }
+    return v;
+}
+
+// gtpLines is the queue from the thread reading commands to the engine. It is
+// shared with the reader, which may outlive the engine if it is still blocked
+// on input after quit.
+struct gtpLines {
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<std::string> lines;
+    bool closed = false;
+};
+
+// GTPEngine speaks the Go Text Protocol (version 2) for one game. The game is
+// kept as a Node tree for loadsgf and as one Board that every move is applied
+// to as an undo step, so play, genmove and undo touch only the points they
+// change and never rebuild the position.
+//
+// Between commands Run() ponders: it runs random playouts of the current
+// position, one at a time, so a command waits for at most one playout. The
+// ownership they gather is what final_score and final_status_list use to
+// decide which stones are dead; if there are not enough playouts yet, the
+// command runs the rest itself.
+class GTPEngine {
+public:
+    // scorePlayouts is the number of playouts final_score needs.
+    static constexpr int scorePlayouts = 256;
+    // ponderPlayouts is the number of playouts after which pondering stops.
+    static constexpr int ponderPlayouts = 4096;
+
+    explicit GTPEngine(int size = 19, float komi = 7.5f, uint64_t seed = 1) : rng(seed), seed(seed) {
+        this->reset(size, komi);
+    }
+
+    GTPEngine(const GTPEngine &) = delete;
+    GTPEngine &operator=(const GTPEngine &) = delete;
+
+    const Board &GetBoard() const { return *this->board; }
+
+    // Current returns the node of the last move.
+    Node *Current() const { return this->node; }
+
+    // Quit returns true once the quit command has run.
+    bool Quit() const { return this->quit; }
+
+    // Execute runs one command line and returns the whole response, ending
+    // with the blank line, or "" for a line with no command.
+    std::string Execute(std::string_view line) {
+        std::string clean;
+        for (char c: line.substr(0, line.find('#'))) {
+            if (c == '\t') {
+                clean += ' ';
+            } else if (static_cast<unsigned char>(c) >= 32 && c != 127) {
+                clean += c;
+            }
+        }
+        std::vector<std::string> args;
+        size_t pos = 0;
+        while ((pos = clean.find_first_not_of(' ', pos)) != std::string::npos) {
+            size_t end = clean.find(' ', pos);
+            args.push_back(clean.substr(pos, end - pos));
+            pos = end;
+        }
+        if (args.empty()) {
+            return "";
+        }
+        std::string id;
+        if (std::isdigit(static_cast<unsigned char>(args[0][0]))) {
+            id = args[0];
+            args.erase(args.begin());
+        }
+        if (args.empty()) {
+            return "?" + id + " missing command\n\n";
+        }
+        std::string name = args[0];
+        args.erase(args.begin());
+        for (auto &c: commands()) {
+            if (name == c.name) {
+                try {
+                    std::string out = (this->*c.run)(args);
+                    return "=" + id + (out.empty() ? "" : " " + out) + "\n\n";
+                } catch (const std::exception &e) {
+                    return "?" + id + " " + e.what() + "\n\n";
+                }
+            }
+        }
+        return "?" + id + " unknown command\n\n";
+    }
+
+    // Run reads commands from in on a separate thread, answers them on out,
+    // and ponders while no command is waiting. It returns after quit or at
+    // the end of input. After quit the reader may still be blocked on in, so
+    // in must outlive the process, as std::cin does, unless it has ended.
+    int Run(std::istream &in, std::ostream &out) {
+        auto queue = std::make_shared<gtpLines>();
+        std::thread reader([queue, &in] {
+            std::string line;
+            while (std::getline(in, line)) {
+                std::lock_guard<std::mutex> lock(queue->mu);
+                queue->lines.push_back(std::move(line));
+                queue->cv.notify_one();
+            }
+            std::lock_guard<std::mutex> lock(queue->mu);
+            queue->closed = true;
+            queue->cv.notify_one();
+        });
+        bool closed = false;
+        while (!this->quit) {
+            std::string line;
+            bool have = false;
+            {
+                std::unique_lock<std::mutex> lock(queue->mu);
+                if (queue->lines.empty() && !queue->closed && this->analysed >= ponderPlayouts) {
+                    queue->cv.wait_for(lock, std::chrono::milliseconds(100));
+                }
+                if (!queue->lines.empty()) {
+                    line = std::move(queue->lines.front());
+                    queue->lines.pop_front();
+                    have = true;
+                }
+                closed = queue->closed;
+            }
+            if (have) {
+                out << this->Execute(line) << std::flush;
+            } else if (closed) {
+                break;
+            } else if (this->analysed < ponderPlayouts) {
+                this->Ponder(1);
+            }
+        }
+        if (closed) {
+            reader.join();
+        } else {
+            reader.detach();
+        }
+        return 0;
+    }
+
+    // Ponder runs n more playouts of the current position, and returns the
+    // number run for it so far.
+    int Ponder(int n) {
+        if (this->analysedHash != this->board->hash || this->counts.empty()) {
+            this->counts.assign(this->board->size * this->board->size, 0);
+            this->analysed = 0;
+            this->analysedHash = this->board->hash;
+            this->scratch = playoutBoard(*this->board);
+        }
+        for (int k = 0; k < n; k++) {
+            playoutRng r(this->seed * 0x9e3779b97f4a7c15ULL + static_cast<uint64_t>(this->analysed));
+            scratchPlayout(*this->scratch, r, this->counts.data());
+            this->analysed++;
+        }
+        return this->analysed;
+    }
+
+private:
+    using handler = std::string (GTPEngine::*)(const std::vector<std::string> &);
+
+    struct command {
+        const char *name;
+        handler run;
+    };
+
+    std::shared_ptr<Node> root;
+    Node *node = nullptr;
+    std::unique_ptr<Board> board;
+    playoutRng rng;
+    uint64_t seed;
+    bool quit = false;
+
+    // Ownership counts of the pondered position, as Estimate keeps them, and
+    // the copy of it that the playouts run on.
+    std::vector<int32_t> counts;
+    std::shared_ptr<Board> scratch;
+    int analysed = 0;
+    uint64_t analysedHash = 0;
+
+    static const std::vector<command> &commands() {
+        static const std::vector<command> table = {
+                {"protocol_version", &GTPEngine::protocolVersion},
+                {"name", &GTPEngine::name},
+                {"version", &GTPEngine::version},
+                {"known_command", &GTPEngine::knownCommand},
+                {"list_commands", &GTPEngine::listCommands},
+                {"quit", &GTPEngine::quitCommand},
+                {"boardsize", &GTPEngine::boardsize},
+                {"clear_board", &GTPEngine::clearBoard},
+                {"komi", &GTPEngine::komi},
+                {"play", &GTPEngine::play},
+                {"genmove", &GTPEngine::genmove},
+                {"undo", &GTPEngine::undo},
+                {"loadsgf", &GTPEngine::loadsgf},
+                {"final_score", &GTPEngine::finalScore},
+                {"final_status_list", &GTPEngine::finalStatusList},
+                {"showboard", &GTPEngine::showboard},
+        };
+        return table;
+    }
+
+    // reset starts a new game tree with an empty board.
+    void reset(int size, float komi) {
+        this->root = Node::NewNode(nullptr);
+        this->root->SetValue(Key::SZ, std::to_string(size));
+        this->root->SetValue(Key::KM, formatKomi(komi));
+        this->node = this->root.get();
+        this->board = std::make_unique<Board>(size);
+        this->board->km = komi;
+        this->counts.clear();
+    }
+
+    static std::string formatKomi(float komi) {
+        std::ostringstream ss;
+        ss << komi;
+        return ss.str();
+    }
+
+    static Colour parseColour(const std::vector<std::string> &args) {
+        if (args.empty()) {
+            throw std::invalid_argument("missing color");
+        }
+        std::string c = args[0];
+        for (auto &ch: c) {
+            ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+        }
+        if (c == "b" || c == "black") {
+            return Colour::BLACK;
+        }
+        if (c == "w" || c == "white") {
+            return Colour::WHITE;
+        }
+        throw std::invalid_argument("invalid color");
+    }
+
+    // apply plays a move, already known to be legal, on the board and in the
+    // tree.
+    void apply(int i, Colour c) {
+        this->board->Apply(i, c);
+        this->board->step++;
+        auto child = i == noPoint ? this->node->PassColour(c)
+                                  : this->node->PlayColour(this->board->PointName(i), c, false);
+        this->node = child.get();
+    }
+
+    // deadStones returns the stones that the pondered ownership gives to the
+    // other side, pondering first if there are too few playouts.
+    Bitboard deadStones() {
+        this->Ponder(0);
+        if (this->analysed < scorePlayouts) {
+            this->Ponder(scorePlayouts - this->analysed);
+        }
+        Bitboard dead;
+        for (int i = 0; i < static_cast<int>(this->counts.size()); i++) {
+            Colour c = this->board->At(i);
+            if ((c == Colour::BLACK && this->counts[i] < 0) || (c == Colour::WHITE && this->counts[i] > 0)) {
+                dead.Set(i);
+            }
+        }
+        return dead;
+    }
+
+    std::string protocolVersion(const std::vector<std::string> &) { return "2"; }
+
+    std::string name(const std::vector<std::string> &) { return "consoleGo"; }
+
+    std::string version(const std::vector<std::string> &) { return "1.0.0"; }
+
+    std::string knownCommand(const std::vector<std::string> &args) {
+        for (auto &c: commands()) {
+            if (!args.empty() && args[0] == c.name) {
+                return "true";
+            }
+        }
+        return "false";
+    }
+
+    std::string listCommands(const std::vector<std::string> &) {
+        std::string ret;
+        for (auto &c: commands()) {
+            ret += (ret.empty() ? "" : "\n") + std::string(c.name);
+        }
+        return ret;
+    }
+
+    std::string quitCommand(const std::vector<std::string> &) {
+        this->quit = true;
+        return "";
+    }
+
+    std::string boardsize(const std::vector<std::string> &args) {
+        if (args.empty()) {
+            throw std::invalid_argument("syntax error");
+        }
+        int size = gtpInt(args[0]);
+        if (size < 2 || size > gtpMaxSize) {
+            throw std::invalid_argument("unacceptable size");
+        }
+        this->reset(size, this->board->km);
+        return "";
+    }
+
+    std::string clearBoard(const std::vector<std::string> &) {
+        this->reset(this->board->size, this->board->km);
+        return "";
+    }
+
+    std::string komi(const std::vector<std::string> &args) {
+        if (args.empty()) {
+            throw std::invalid_argument("syntax error");
+        }
+        float km = gtpFloat(args[0]);
+        this->board->km = km;
+        this->root->SetValue(Key::KM, formatKomi(km));
+        return "";
+    }
+
+    std::string play(const std::vector<std::string> &args) {
+        Colour c = parseColour(args);
+        if (args.size() < 2) {
+            throw std::invalid_argument("missing vertex");
+        }
+        int i = ParseGTPVertex(args[1], this->board->size);
+        if (i != noPoint && !this->board->legal(i, c)) {
+            throw std::invalid_argument("illegal move");
+        }
+        this->apply(i, c);
+        return "";
+    }
+
+    // genmove plays a random legal move that does not fill one of the
+    // player's own eyes, the same policy as the playouts, or passes.
+    std::string genmove(const std::vector<std::string> &args) {
+        Colour c = parseColour(args);
+        int points = this->board->size * this->board->size;
+        int start = static_cast<int>(this->rng.Below(points));
+        int move = noPoint;
+        for (int k = 0; k < points && move == noPoint; k++) {
+            int i = (start + k) % points;
+            if (this->board->At(i) == Colour::EMPTY && !isOwnEye(*this->board, i, c) && this->board->legal(i, c)) {
+                move = i;
+            }
+        }
+        this->apply(move, c);
+        return GTPVertex(move, this->board->size);
+    }
+
+    std::string undo(const std::vector<std::string> &) {
+        if (!this->board->Undo()) {
+            throw std::invalid_argument("cannot undo");
+        }
+        this->node = this->node->parentNode();
+        return "";
+    }
+
+    // loadsgf replays the main line of an SGF file up to, but not including,
+    // the given move number, or to the end. Moves after that are added to the
+    // loaded tree.
+    std::string loadsgf(const std::vector<std::string> &args) {
+        if (args.empty()) {
+            throw std::invalid_argument("missing filename");
+        }
+        int stop = args.size() > 1 ? gtpInt(args[1]) : 0;
+        std::shared_ptr<Node> loaded;
+        try {
+            loaded = Load(args[0]);
+        } catch (const std::exception &) {
+            throw std::invalid_argument("cannot load file");
+        }
+        int size = loaded->RootBoardSize();
+        if (size < 2 || size > gtpMaxSize) {
+            throw std::invalid_argument("unacceptable size");
+        }
+        this->root = loaded;
+        this->node = loaded.get();
+        this->board = std::make_unique<Board>(size);
+        this->board->km = loaded->RootKomi();
+        this->counts.clear();
+        loaded->updateBoard(*this->board);
+        int moves = 0;
+        for (Node *next = loaded->firstChild(); next; next = next->firstChild()) {
+            bool isMove = next->ValueCount(Key::B) > 0 || next->ValueCount(Key::W) > 0;
+            if (isMove && stop > 0 && ++moves >= stop) {
+                break;
+            }
+            this->board->Mark();
+            this->board->step++;
+            next->updateBoard(*this->board);
+            this->node = next;
+        }
+        return "";
+    }
+
+    std::string finalScore(const std::vector<std::string> &) {
+        auto copy = this->board->Copy();
+        return ScoreBoard(*copy, ScoringRule::AREA, this->deadStones()).Result();
+    }
+
+    std::string finalStatusList(const std::vector<std::string> &args) {
+        if (args.empty()) {
+            throw std::invalid_argument("missing status");
+        }
+        if (args[0] != "dead" && args[0] != "alive" && args[0] != "seki") {
+            throw std::invalid_argument("invalid status");
+        }
+        if (args[0] == "seki") {
+            return "";
+        }
+        Bitboard dead = this->deadStones();
+        std::string ret;
+        for (int i = 0; i < this->board->size * this->board->size; i++) {
+            if (this->board->At(i) != Colour::EMPTY && dead.Test(i) == (args[0] == "dead")) {
+                ret += (ret.empty() ? "" : " ") + GTPVertex(i, this->board->size);
+            }
+        }
+        return ret;
+    }
+
+    std::string showboard(const std::vector<std::string> &) {
+        std::string s = this->board->String();
+        s.pop_back();
+        return "\n" + s;
+    }
+};
+
+#endif // CONSOLEGO_GTP_H
@@ -5,4 +5,538 @@
 #ifndef CONSOLEGO_IO_H
 #define CONSOLEGO_IO_H
 
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cerrno>
+#include <fstream>
+#include <ostream>
+
+#ifdef _WIN32
+#include <sstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "node.h"
+#include "pool.h"
+
+// MappedFile maps a whole file read-only into memory for the lifetime of the
+// object. Where mmap is unavailable the file is read into a buffer instead.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path) {
+#ifdef _WIN32
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("MappedFile(): cannot open " + path);
+        }
+        std::ostringstream ss;
+        ss << in.rdbuf();
+        buffer = ss.str();
+        data = buffer.data();
+        length = buffer.size();
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("MappedFile(): cannot open " + path);
+        }
+        struct stat st {};
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("MappedFile(): cannot stat " + path);
+        }
+        length = static_cast<size_t>(st.st_size);
+        if (length > 0) {
+            void *p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("MappedFile(): cannot map " + path);
+            }
+            ::madvise(p, length, MADV_SEQUENTIAL);
+            data = static_cast<const char *>(p);
+        }
+        ::close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (length > 0) {
+            ::munmap(const_cast<char *>(data), length);
+        }
+#endif
+    }
+
+    std::string_view View() const { return std::string_view(data, length); }
+
+private:
+    const char *data = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    std::string buffer;
+#endif
+};
+
+// SGFParser builds Node trees from SGF text in a single pass. Values are
+// tokenized as string_views into the input; only values containing escapes
+// are copied, into a reused scratch buffer. Variations are tracked
+// with an explicit stack, so nesting depth is not limited by the call stack.
+// If an arena is given, the trees are built in it.
+class SGFParser {
+public:
+    explicit SGFParser(std::string_view sgf, std::shared_ptr<NodeArena> arena = nullptr) :
+        in(sgf), arena(std::move(arena)) {}
+
+    // Next parses the next game tree of the collection, or returns nullptr when
+    // no more game trees remain. Anything between game trees is skipped.
+    std::shared_ptr<Node> Next() {
+        pos = std::min(in.find('(', pos), in.size());
+        if (pos >= in.size()) {
+            return nullptr;
+        }
+
+        std::shared_ptr<Node> root;
+        std::shared_ptr<Node> node;
+        std::vector<std::shared_ptr<Node>> stack;
+        bool inKey = false;
+        key.clear();
+
+        for (; pos < in.size(); pos++) {
+            char c = in[pos];
+            if (c >= 'A' && c <= 'Z') {
+                if (!inKey) {
+                    key.clear();
+                    inKey = true;
+                }
+                key.push_back(c);
+                continue;
+            }
+            if (c >= 'a' && c <= 'z') {
+                // FF[3] long identifiers such as AddBlack: only capitals count.
+                continue;
+            }
+            inKey = false;
+            switch (c) {
+                case '(':
+                    if (!stack.empty() && !node) {
+                        throw error("empty game tree");
+                    }
+                    stack.push_back(node);
+                    break;
+                case ')':
+                    if (stack.empty() || !node) {
+                        throw error("unbalanced ')'");
+                    }
+                    node = stack.back();
+                    stack.pop_back();
+                    if (stack.empty()) {
+                        pos++;
+                        checkRoot(*root);
+                        return root;
+                    }
+                    break;
+                case ';':
+                    if (stack.empty()) {
+                        throw error("node outside game tree");
+                    }
+                    if (!node) {
+                        if (root) {
+                            throw error("second root in game tree");
+                        }
+                        root = this->arena ? this->arena->NewRoot() : Node::NewNode(nullptr);
+                        node = root;
+                    } else {
+                        node = Node::NewNode(node);
+                    }
+                    key.clear();
+                    break;
+                case '[':
+                    if (!node || key.empty()) {
+                        throw error("value without node or key");
+                    }
+                    node->appendValue(InternKey(key), readValue());
+                    break;
+                default:
+                    if (!isSpace(c)) {
+                        throw error(std::string("unexpected character '") + c + "'");
+                    }
+            }
+        }
+        throw error("unexpected end of input");
+    }
+
+private:
+    std::string_view in;
+    std::shared_ptr<NodeArena> arena;
+    size_t pos = 0;
+    std::string key;
+    std::string scratch;
+
+    static bool isSpace(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\v'; }
+
+    // readValue consumes a [value] starting at the '[' and leaves pos on the
+    // closing ']'. A backslash escapes the next character.
+    std::string_view readValue() {
+        size_t start = ++pos;
+        size_t close = in.find(']', start);
+        if (close == std::string_view::npos) {
+            throw error("unterminated value");
+        }
+        auto raw = in.substr(start, close - start);
+        if (raw.find('\\') == std::string_view::npos) {
+            pos = close;
+            return raw;
+        }
+        scratch.clear();
+        for (pos = start; pos < in.size(); pos++) {
+            char c = in[pos];
+            if (c == ']') {
+                return scratch;
+            }
+            if (c == '\\') {
+                if (++pos >= in.size()) {
+                    break;
+                }
+                c = in[pos];
+            }
+            scratch.push_back(c);
+        }
+        throw error("unterminated value");
+    }
+
+    static void checkRoot(Node &root) {
+        auto sz = root.GetValue("SZ");
+        if (sz.empty()) {
+            return;
+        }
+        int size = 0;
+        try {
+            size = std::stoi(sz);
+        } catch (...) {
+            throw std::runtime_error("SGF: bad SZ value " + sz);
+        }
+        if (size < 1 || size > maxBoardSize) {
+            throw std::runtime_error("SGF: board size not supported: " + sz);
+        }
+    }
+
+    std::runtime_error error(const std::string &what) const {
+        return std::runtime_error("SGF: " + what + " at offset " + std::to_string(pos));
+    }
+};
+
+// LoadSGFCollection parses every game tree in an SGF string.
+inline std::vector<std::shared_ptr<Node>> LoadSGFCollection(std::string_view sgf,
+                                                            std::shared_ptr<NodeArena> arena = nullptr) {
+    std::vector<std::shared_ptr<Node>> ret;
+    SGFParser parser(sgf, std::move(arena));
+    while (auto root = parser.Next()) {
+        ret.push_back(root);
+    }
+    if (ret.empty()) {
+        throw std::runtime_error("SGF: no game tree found");
+    }
+    return ret;
+}
+
+// LoadSGF parses an SGF string and returns the root of its first game tree.
+inline std::shared_ptr<Node> LoadSGF(std::string_view sgf, std::shared_ptr<NodeArena> arena = nullptr) {
+    auto root = SGFParser(sgf, std::move(arena)).Next();
+    if (!root) {
+        throw std::runtime_error("SGF: no game tree found");
+    }
+    return root;
+}
+
+// LoadCollection memory-maps an SGF file and parses every game tree in it.
+inline std::vector<std::shared_ptr<Node>> LoadCollection(const std::string &path,
+                                                         std::shared_ptr<NodeArena> arena = nullptr) {
+    MappedFile file(path);
+    return LoadSGFCollection(file.View(), std::move(arena));
+}
+
+// Load memory-maps an SGF file and returns the root of its first game tree.
+inline std::shared_ptr<Node> Load(const std::string &path, std::shared_ptr<NodeArena> arena = nullptr) {
+    MappedFile file(path);
+    return LoadSGF(file.View(), std::move(arena));
+}
+
+// SplitSGFCollection returns the text of each top-level game tree of an SGF
+// collection, without parsing the nodes. Brackets inside property values are
+// skipped, so comments may contain parentheses. An unbalanced last game tree
+// runs to the end of the input and is left for the parser to reject.
+inline std::vector<std::string_view> SplitSGFCollection(std::string_view sgf) {
+    std::vector<std::string_view> ret;
+    size_t start = 0;
+    int depth = 0;
+    for (size_t i = 0; i < sgf.size(); i++) {
+        switch (sgf[i]) {
+            case '[':
+                for (i++; i < sgf.size() && sgf[i] != ']'; i++) {
+                    if (sgf[i] == '\\') {
+                        i++;
+                    }
+                }
+                break;
+            case '(':
+                if (depth++ == 0) {
+                    start = i;
+                }
+                break;
+            case ')':
+                if (depth > 0 && --depth == 0) {
+                    ret.push_back(sgf.substr(start, i + 1 - start));
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    if (depth > 0) {
+        ret.push_back(sgf.substr(start));
+    }
+    return ret;
+}
+
+// noGame is the game index of a BulkError that belongs to the whole file.
+constexpr size_t noGame = SIZE_MAX;
+
+// BulkError is one failure of a bulk load: a game of a file that did not parse,
+// with its 0-based index into the file, or, with game set to noGame, a file
+// that could not be read at all.
+struct BulkError {
+    size_t game = noGame;
+    std::string what;
+
+    // Message returns the error prefixed with its 1-based game number.
+    std::string Message() const {
+        return this->game == noGame ? this->what : "game " + std::to_string(this->game + 1) + ": " + this->what;
+    }
+};
+
+// BulkResult holds the game trees loaded from one file. Games that fail to
+// parse are left out and their failures are kept in errors, in game order.
+struct BulkResult {
+    std::string path;
+    std::vector<std::shared_ptr<Node>> games;
+    std::vector<BulkError> errors;
+};
+
+// BulkOptions controls ParseBulk and LoadBulk.
+struct BulkOptions {
+    // threads is the number of worker threads; 0 uses every hardware thread.
+    unsigned threads = 0;
+    // gamesPerTask is how many games of a collection one task parses.
+    size_t gamesPerTask = 64;
+    // useArena builds each game in its own NodeArena.
+    bool useArena = true;
+};
+
+// FindSGFFiles expands directories in paths to the .sgf files below them,
+// sorted by path. Other paths are kept as given.
+inline std::vector<std::string> FindSGFFiles(const std::vector<std::string> &paths) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> ret;
+    for (auto &p: paths) {
+        std::error_code ec;
+        if (!fs::is_directory(p, ec)) {
+            ret.push_back(p);
+            continue;
+        }
+        std::vector<std::string> found;
+        for (auto it = fs::recursive_directory_iterator(p, ec); !ec && it != fs::recursive_directory_iterator();
+             it.increment(ec)) {
+            auto ext = it->path().extension().string();
+            std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+            if (ext == ".sgf" && it->is_regular_file(ec)) {
+                found.push_back(it->path().string());
+            }
+        }
+        std::sort(found.begin(), found.end());
+        ret.insert(ret.end(), found.begin(), found.end());
+    }
+    return ret;
+}
+
+// ParseBulk parses every game of every file in paths concurrently and calls
+// visit(file, game, root) for each game that parses, with the indexes into paths
+// and into the file. visit runs on the worker threads, so it must be safe to
+// call concurrently; an exception it throws is reported as an error of the
+// game. Each file is mapped by one task, which splits a collection into game
+// trees and shards them across the pool, so one large collection is spread
+// over all the workers. The errors of each file, in game order, are returned
+// in the order of paths; errors never abort the batch.
+template <typename F>
+std::vector<std::vector<BulkError>> ParseBulk(const std::vector<std::string> &paths, const BulkOptions &opts,
+                                              F visit) {
+    struct FileState {
+        std::unique_ptr<MappedFile> file;
+        std::vector<std::string_view> trees;
+        std::vector<std::string> errors;
+        std::vector<char> failed;
+    };
+
+    std::vector<std::vector<BulkError>> errors(paths.size());
+    std::vector<FileState> states(paths.size());
+    size_t perTask = std::max<size_t>(1, opts.gamesPerTask);
+
+    auto parseRange = [&](size_t f, size_t from, size_t to) {
+        auto &st = states[f];
+        for (size_t g = from; g < to; g++) {
+            try {
+                visit(f, g, LoadSGF(st.trees[g], opts.useArena ? NodeArena::Create() : nullptr));
+            } catch (const std::exception &e) {
+                st.errors[g] = e.what();
+                st.failed[g] = 1;
+            }
+        }
+    };
+
+    {
+        ThreadPool pool(opts.threads);
+        for (size_t f = 0; f < paths.size(); f++) {
+            pool.Submit([&, f] {
+                auto &st = states[f];
+                try {
+                    st.file = std::make_unique<MappedFile>(paths[f]);
+                } catch (const std::exception &e) {
+                    errors[f].push_back(BulkError{noGame, e.what()});
+                    return;
+                }
+                st.trees = SplitSGFCollection(st.file->View());
+                if (st.trees.empty()) {
+                    errors[f].push_back(BulkError{noGame, "SGF: no game tree found"});
+                    return;
+                }
+                st.errors.resize(st.trees.size());
+                st.failed.resize(st.trees.size());
+                for (size_t from = perTask; from < st.trees.size(); from += perTask) {
+                    size_t to = std::min(from + perTask, st.trees.size());
+                    pool.Submit([&parseRange, f, from, to] { parseRange(f, from, to); });
+                }
+                parseRange(f, 0, std::min(perTask, st.trees.size()));
+            });
+        }
+        pool.Wait();
+    }
+
+    for (size_t f = 0; f < paths.size(); f++) {
+        auto &st = states[f];
+        for (size_t g = 0; g < st.failed.size(); g++) {
+            if (st.failed[g]) {
+                errors[f].push_back(BulkError{g, std::move(st.errors[g])});
+            }
+        }
+    }
+    return errors;
+}
+
+// LoadBulk loads every game of every file in paths concurrently with
+// ParseBulk. Results are in the order of paths, and games in file order,
+// however the work was scheduled.
+inline std::vector<BulkResult> LoadBulk(const std::vector<std::string> &paths, const BulkOptions &opts = {}) {
+    std::vector<BulkResult> results(paths.size());
+    std::vector<std::vector<std::pair<size_t, std::shared_ptr<Node>>>> found(paths.size());
+    std::mutex mu;
+    auto errors = ParseBulk(paths, opts, [&](size_t f, size_t g, std::shared_ptr<Node> root) {
+        std::lock_guard<std::mutex> lock(mu);
+        found[f].emplace_back(g, std::move(root));
+    });
+    for (size_t f = 0; f < paths.size(); f++) {
+        std::sort(found[f].begin(), found[f].end(),
+                  [](const auto &a, const auto &b) { return a.first < b.first; });
+        results[f].path = paths[f];
+        results[f].errors = std::move(errors[f]);
+        for (auto &game: found[f]) {
+            results[f].games.push_back(std::move(game.second));
+        }
+    }
+    return results;
+}
+
+// sgfFlushBytes is how much SGF text the writers buffer before passing it on.
+constexpr size_t sgfFlushBytes = 64 * 1024;
+
+// WriteSGFCollection writes the whole trees of the given nodes to a stream, one
+// per line.
+inline void WriteSGFCollection(std::ostream &os, const std::vector<std::shared_ptr<Node>> &nodes) {
+    std::string buf;
+    buf.reserve(2 * sgfFlushBytes);
+    auto flush = [&os](std::string &b) {
+        os.write(b.data(), static_cast<std::streamsize>(b.size()));
+        b.clear();
+    };
+    bool any = false;
+    for (auto &node: nodes) {
+        if (!node) {
+            continue;
+        }
+        if (any) {
+            buf += '\n';
+        }
+        node->GetRoot()->writeTreeTo(buf, flush, sgfFlushBytes);
+        any = true;
+    }
+    if (!any) {
+        buf += "()";
+    }
+    flush(buf);
+    if (!os) {
+        throw std::runtime_error("WriteSGF(): write failed");
+    }
+}
+
+// WriteSGF writes the whole tree containing node to a stream.
+inline void WriteSGF(std::ostream &os, const std::shared_ptr<Node> &node) { WriteSGFCollection(os, {node}); }
+
+#ifndef _WIN32
+// WriteSGF writes the whole tree containing node to a file descriptor.
+inline void WriteSGF(int fd, const std::shared_ptr<Node> &node) {
+    auto flush = [fd](std::string &b) {
+        size_t done = 0;
+        while (done < b.size()) {
+            ssize_t n = ::write(fd, b.data() + done, b.size() - done);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("WriteSGF(): write failed");
+            }
+            done += static_cast<size_t>(n);
+        }
+        b.clear();
+    };
+    std::string buf;
+    buf.reserve(2 * sgfFlushBytes);
+    node->GetRoot()->writeTreeTo(buf, flush, sgfFlushBytes);
+}
+#endif
+
+// SaveCollectionFile saves the whole trees of the given nodes to a file.
+inline void SaveCollectionFile(const std::string &path, const std::vector<std::shared_ptr<Node>> &nodes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("SaveCollectionFile(): cannot open " + path);
+    }
+    WriteSGFCollection(out, nodes);
+}
+
+// SaveFile saves the whole tree containing node to a file.
+inline void SaveFile(const std::string &path, const std::shared_ptr<Node> &node) { SaveCollectionFile(path, {node}); }
+
 #endif // CONSOLEGO_IO_H
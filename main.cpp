@@ -1,3 +1,390 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
 
-int main() {
+#include "book.h"
+#include "dedup.h"
+#include "gamedb.h"
+#include "gtp.h"
+#include "io.h"
+#include "score.h"
+
+static int usage() {
+    std::cerr << "usage: consoleGo load [-j threads] [--heap] path...\n"
+                 "       consoleGo dedup [-j threads] index path...\n"
+                 "       consoleGo score [-j threads] [--territory] [--json] path...\n"
+                 "       consoleGo db [-j threads] database path...\n"
+                 "       consoleGo find [--player name] [--size n] [--komi min:max] [--dates from:to] [--winner b|w]\n"
+                 "                      database\n"
+                 "       consoleGo book [-j threads] [--size n] [--depth n] [--min games] out.sgf path...\n"
+                 "       consoleGo gtp\n"
+                 "  load   parse SGF files and directories of them, one line per file\n"
+                 "  dedup  add new or changed files to a dedup index and print duplicate clusters\n"
+                 "  score  score the end of every game, by area unless --territory, as CSV or JSON\n"
+                 "  db     build a game database of every game in the SGF files\n"
+                 "  find   print the games of a game database that match, one line per game\n"
+                 "  book   merge the openings of the games into an opening book, written as SGF\n"
+                 "  gtp    play games over the Go Text Protocol on standard input and output\n";
+    return 2;
+}
+
+// parseInt parses a whole argument as an integer from lo to hi into v, and
+// returns false, leaving v alone, if it is anything else.
+static bool parseInt(const std::string &arg, long lo, long hi, long &v) {
+    char *end = nullptr;
+    errno = 0;
+    long n = std::strtol(arg.c_str(), &end, 10);
+    if (arg.empty() || *end != '\0' || errno == ERANGE || n < lo || n > hi) {
+        return false;
+    }
+    v = n;
+    return true;
+}
+
+// parseFloat is parseInt for a finite float.
+static bool parseFloat(const std::string &arg, float &v) {
+    char *end = nullptr;
+    errno = 0;
+    float f = std::strtof(arg.c_str(), &end);
+    if (arg.empty() || *end != '\0' || errno == ERANGE || !std::isfinite(f)) {
+        return false;
+    }
+    v = f;
+    return true;
+}
+
+// parseThreads parses the argument of -j into opts.
+static bool parseThreads(const std::string &arg, BulkOptions &opts) {
+    long n;
+    if (!parseInt(arg, 0, INT_MAX, n)) {
+        return false;
+    }
+    opts.threads = static_cast<unsigned>(n);
+    return true;
+}
+
+// loadMain parses every SGF file named on the command line, or found below a
+// named directory, and prints the number of games and the errors of each file.
+static int loadMain(int argc, char **argv) {
+    BulkOptions opts;
+    std::vector<std::string> paths;
+    for (int i = 0; i < argc; i++) {
+        if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            if (!parseThreads(argv[++i], opts)) {
+                return usage();
+            }
+        } else if (std::strcmp(argv[i], "--heap") == 0) {
+            opts.useArena = false;
+        } else {
+            paths.emplace_back(argv[i]);
+        }
+    }
+    if (paths.empty()) {
+        return usage();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto results = LoadBulk(FindSGFFiles(paths), opts);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    size_t games = 0;
+    size_t failed = 0;
+    for (auto &r: results) {
+        games += r.games.size();
+        std::cout << r.path << '\t' << r.games.size();
+        if (!r.errors.empty()) {
+            failed++;
+        }
+        for (auto &e: r.errors) {
+            std::cout << '\t' << e.Message();
+        }
+        std::cout << '\n';
+    }
+    std::cerr << results.size() << " files, " << games << " games, " << failed << " with errors in "
+              << elapsed.count() << "s\n";
+    return failed ? 1 : 0;
+}
+
+// dedupMain brings a dedup index up to date with the named files and
+// directories, saves it, and prints each cluster of duplicate games as one
+// line of tab-separated path#game entries.
+static int dedupMain(int argc, char **argv) {
+    BulkOptions opts;
+    std::vector<std::string> args;
+    for (int i = 0; i < argc; i++) {
+        if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            if (!parseThreads(argv[++i], opts)) {
+                return usage();
+            }
+        } else {
+            args.emplace_back(argv[i]);
+        }
+    }
+    if (args.size() < 2) {
+        return usage();
+    }
+    std::string indexPath = args[0];
+    args.erase(args.begin());
+
+    auto index = DedupIndex::Load(indexPath);
+    auto update = index.Update(args, opts);
+    index.Save(indexPath);
+    for (auto &e: update.errors) {
+        std::cerr << e.first << '\t' << e.second << '\n';
+    }
+
+    auto clusters = index.Clusters();
+    for (auto &cluster: clusters) {
+        for (size_t i = 0; i < cluster.size(); i++) {
+            std::cout << (i ? "\t" : "") << index.Files()[cluster[i].file].path << '#' << cluster[i].game + 1;
+        }
+        std::cout << '\n';
+    }
+    std::cerr << update.filesHashed << " files hashed, " << update.filesDropped << " dropped, " << update.gamesAdded
+              << " games added, "
+              << index.Records().size() << " games indexed, " << clusters.size() << " duplicate clusters\n";
+    return update.errors.empty() ? 0 : 1;
+}
+
+// scoreMain scores every game in the named files and directories and writes
+// one row per game to standard output.
+static int scoreMain(int argc, char **argv) {
+    BulkOptions opts;
+    ScoringRule rule = ScoringRule::AREA;
+    bool json = false;
+    std::vector<std::string> paths;
+    for (int i = 0; i < argc; i++) {
+        if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            if (!parseThreads(argv[++i], opts)) {
+                return usage();
+            }
+        } else if (std::strcmp(argv[i], "--territory") == 0) {
+            rule = ScoringRule::TERRITORY;
+        } else if (std::strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else {
+            paths.emplace_back(argv[i]);
+        }
+    }
+    if (paths.empty()) {
+        return usage();
+    }
+
+    auto rows = ScoreBulk(FindSGFFiles(paths), rule, opts);
+    if (json) {
+        WriteScoresJSON(std::cout, rows);
+    } else {
+        WriteScoresCSV(std::cout, rows);
+    }
+    bool failed = std::any_of(rows.begin(), rows.end(), [](const ScoreRow &r) { return !r.error.empty(); });
+    return failed ? 1 : 0;
+}
+
+// dbMain builds a game database of every game in the named files and
+// directories.
+static int dbMain(int argc, char **argv) {
+    BulkOptions opts;
+    std::vector<std::string> args;
+    for (int i = 0; i < argc; i++) {
+        if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            if (!parseThreads(argv[++i], opts)) {
+                return usage();
+            }
+        } else {
+            args.emplace_back(argv[i]);
+        }
+    }
+    if (args.size() < 2) {
+        return usage();
+    }
+    std::string dbPath = args[0];
+    args.erase(args.begin());
+
+    GameDBWriter writer;
+    auto errors = writer.AddFiles(args, opts);
+    writer.Save(dbPath);
+    for (auto &e: errors) {
+        std::cerr << e.first << '\t' << e.second << '\n';
+    }
+    std::cerr << writer.Size() << " games written to " << dbPath << '\n';
+    return errors.empty() ? 0 : 1;
+}
+
+// bookMain merges the openings of every game in the named files and
+// directories and saves the moves played often enough as an SGF tree.
+static int bookMain(int argc, char **argv) {
+    BulkOptions opts;
+    int size = 19;
+    int depth = 40;
+    uint32_t minGames = 1;
+    std::vector<std::string> args;
+    for (int i = 0; i < argc; i++) {
+        bool hasArg = i + 1 < argc;
+        long n = 0;
+        if (std::strcmp(argv[i], "-j") == 0 && hasArg) {
+            if (!parseThreads(argv[++i], opts)) {
+                return usage();
+            }
+        } else if (std::strcmp(argv[i], "--size") == 0 && hasArg) {
+            if (!parseInt(argv[++i], 1, maxBoardSize, n)) {
+                return usage();
+            }
+            size = static_cast<int>(n);
+        } else if (std::strcmp(argv[i], "--depth") == 0 && hasArg) {
+            if (!parseInt(argv[++i], 0, INT_MAX, n)) {
+                return usage();
+            }
+            depth = static_cast<int>(n);
+        } else if (std::strcmp(argv[i], "--min") == 0 && hasArg) {
+            if (!parseInt(argv[++i], 0, UINT32_MAX, n)) {
+                return usage();
+            }
+            minGames = static_cast<uint32_t>(n);
+        } else {
+            args.emplace_back(argv[i]);
+        }
+    }
+    if (args.size() < 2) {
+        return usage();
+    }
+    std::string outPath = args[0];
+    args.erase(args.begin());
+
+    OpeningBook book(size, depth);
+    auto errors = book.AddFiles(args, opts);
+    SaveFile(outPath, book.Export(depth, minGames));
+    for (auto &e: errors) {
+        std::cerr << e.first << '\t' << e.second << '\n';
+    }
+    std::cerr << book.Games() << " games merged, " << book.Skipped() << " skipped, " << book.Positions()
+              << " positions, written to " << outPath << '\n';
+    return errors.empty() ? 0 : 1;
+}
+
+// findMain prints the games of a game database that match the query given
+// by the flags, as tab-separated index, source, PB, PW, DT and RE.
+static int findMain(int argc, char **argv) {
+    GameQuery q;
+    std::string dbPath;
+    for (int i = 0; i < argc; i++) {
+        bool hasArg = i + 1 < argc;
+        if (std::strcmp(argv[i], "--player") == 0 && hasArg) {
+            q.player = argv[++i];
+        } else if (std::strcmp(argv[i], "--size") == 0 && hasArg) {
+            long n;
+            if (!parseInt(argv[++i], 1, maxBoardSize, n)) {
+                return usage();
+            }
+            q.size = static_cast<int>(n);
+        } else if (std::strcmp(argv[i], "--komi") == 0 && hasArg) {
+            // Either bound may be left out, but not both.
+            std::string range = argv[++i];
+            auto colon = range.find(':');
+            std::string from = range.substr(0, colon);
+            std::string to = colon == std::string::npos ? std::string() : range.substr(colon + 1);
+            float km;
+            if (from.empty() && to.empty()) {
+                return usage();
+            }
+            if (!from.empty()) {
+                if (!parseFloat(from, km)) {
+                    return usage();
+                }
+                q.minKomi = km;
+            }
+            if (!to.empty()) {
+                if (!parseFloat(to, km)) {
+                    return usage();
+                }
+                q.maxKomi = km;
+            }
+        } else if (std::strcmp(argv[i], "--dates") == 0 && hasArg) {
+            std::string range = argv[++i];
+            auto colon = range.find(':');
+            std::string from = range.substr(0, colon);
+            std::string to = colon == std::string::npos ? std::string() : range.substr(colon + 1);
+            q.fromDate = parseGameDate(from);
+            q.toDate = parseGameDate(to);
+            if ((!from.empty() && !q.fromDate) || (!to.empty() && !q.toDate)) {
+                return usage();
+            }
+            // A year or month runs to its end.
+            if (q.toDate) {
+                q.toDate += q.toDate % 10000 == 0 ? 1231 : q.toDate % 100 == 0 ? 31 : 0;
+            }
+        } else if (std::strcmp(argv[i], "--winner") == 0 && hasArg) {
+            std::string w = argv[++i];
+            std::transform(w.begin(), w.end(), w.begin(), [](unsigned char c) { return std::tolower(c); });
+            if (w == "b" || w == "black") {
+                q.winner = Colour::BLACK;
+            } else if (w == "w" || w == "white") {
+                q.winner = Colour::WHITE;
+            } else {
+                return usage();
+            }
+        } else if (dbPath.empty()) {
+            dbPath = argv[i];
+        } else {
+            return usage();
+        }
+    }
+    if (dbPath.empty()) {
+        return usage();
+    }
+
+    GameDB db(dbPath);
+    for (uint32_t g: db.Find(q)) {
+        auto [source, game] = db.Source(g);
+        std::cout << g << '\t' << source << '#' << game + 1;
+        for (PropKey key: {Key::PB, Key::PW, Key::DT, Key::RE}) {
+            std::cout << '\t' << db.Value(g, key);
+        }
+        std::cout << '\n';
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        return usage();
+    }
+    std::string mode = argv[1];
+    // Errors such as unreadable files or a bad index end the run with a
+    // one-line message rather than an abort.
+    try {
+        if (mode == "load") {
+            return loadMain(argc - 2, argv + 2);
+        }
+        if (mode == "dedup") {
+            return dedupMain(argc - 2, argv + 2);
+        }
+        if (mode == "score") {
+            return scoreMain(argc - 2, argv + 2);
+        }
+        if (mode == "db") {
+            return dbMain(argc - 2, argv + 2);
+        }
+        if (mode == "find") {
+            return findMain(argc - 2, argv + 2);
+        }
+        if (mode == "book") {
+            return bookMain(argc - 2, argv + 2);
+        }
+        if (mode == "gtp") {
+            return GTPEngine().Run(std::cin, std::cout);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+    return usage();
 }
@@ -3,69 +3,454 @@
 
 
 #include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <list>
 #include <map>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 #include "board.h"
 #include "colour.h"
+#include "props.h"
 #include "utils.h"
 
-const std::vector<std::string> mutors = {"B", "W", "AB", "AW", "AE", "PL", "SZ"};
+struct Node;
+
+// BoardCache bounds the memory spent on cached boards in one tree. Boards are
+// always kept at checkpoint nodes (every checkpointInterval moves from the
+// root); any other board built by GetBoard() goes into an LRU that is trimmed
+// to byteBudget. A missing board is rebuilt by replaying from the nearest
+// ancestor that still has one.
+struct BoardCache {
+    int checkpointInterval = 16;
+    size_t byteBudget = size_t(64) << 20;
+    Superko superko = Superko::NONE;
+
+    size_t bytes = 0;
+    std::list<Node *> lru; // most recently used first
+};
+
+// noNode is the arena index used for "no node".
+constexpr uint32_t noNode = UINT32_MAX;
+
+// Visit tells Node::Walk how to go on after calling a visitor on a node.
+enum class Visit {
+    // CONTINUE visits the node's children.
+    CONTINUE,
+    // SKIP leaves out the node's children.
+    SKIP,
+    // STOP ends the walk at once.
+    STOP,
+};
+
+// WalkFrame is a node together with a cursor over its children: an index into
+// children for heap nodes, the next child's id for arena nodes.
+struct WalkFrame {
+    Node *node;
+    uint32_t next;
+};
+
+class SubtreeRange;
+class MainLineRange;
+class AncestorRange;
+
+// NodeArena stores the nodes of arena-backed trees contiguously, in fixed-size
+// blocks, and links them with 32-bit indices instead of shared_ptr/weak_ptr.
+// Handles to arena nodes are aliasing shared_ptrs that share the arena's
+// reference count, so walking the tree costs no refcount traffic, and every
+// node is freed at once when the last handle goes away.
+//
+// Arena nodes keep working with the whole Node API, except that
+// shared_from_this() is not available on them, and they can only be moved
+// within their own arena.
+class NodeArena : public std::enable_shared_from_this<NodeArena> {
+public:
+    static std::shared_ptr<NodeArena> Create() { return std::shared_ptr<NodeArena>(new NodeArena()); }
+
+    NodeArena(const NodeArena &) = delete;
+    NodeArena &operator=(const NodeArena &) = delete;
+    ~NodeArena();
+
+    // NewRoot creates a parentless node in the arena.
+    std::shared_ptr<Node> NewRoot();
+
+    Node *At(uint32_t i) const;
+
+    std::shared_ptr<Node> Handle(Node *node) { return std::shared_ptr<Node>(shared_from_this(), node); }
+
+    // Size returns the number of nodes ever allocated in the arena.
+    uint32_t Size() const { return count; }
+
+    Node *allocate();
+
+private:
+    static constexpr uint32_t blockBits = 10;
+    static constexpr uint32_t blockNodes = 1u << blockBits;
+
+    std::vector<std::unique_ptr<unsigned char[]>> blocks;
+    uint32_t count = 0;
+
+    NodeArena() = default;
+};
 
 
 struct Node : public std::enable_shared_from_this<Node> {
-    // e.g. ["B" "dd"] ["TR", "dd", "fj", "np"]
-    std::vector<std::vector<std::string>> props;
+    // e.g. {B: ["dd"]} {TR: ["dd", "fj", "np"]}. Keys are interned, and the
+    // first couple of properties and their short values are stored inline.
+    SmallVector<Property, 2> props;
 
     std::vector<std::shared_ptr<Node>> children;
 
     std::weak_ptr<Node> parent;
 
+    // board caches the position after this node; see GetBoard().
     std::shared_ptr<Board> board;
 
+    std::shared_ptr<BoardCache> cache;
+    std::list<Node *>::iterator lruPos;
+    bool inLru = false;
+
+    // Topology of arena nodes; heap nodes use children and parent instead.
+    NodeArena *arena = nullptr;
+    uint32_t id = noNode;
+    uint32_t parentId = noNode;
+    uint32_t firstChildId = noNode;
+    uint32_t nextSiblingId = noNode;
+
+    // depth is the number of steps up to the root. jump is an ancestor picked so
+    // that any ancestor is reached from the node by O(log n) jumps and parent
+    // steps (Myers' skew-binary jump pointers, binary lifting with one pointer
+    // per node); a root jumps to itself. Both are kept up to date whenever a
+    // node is attached, moved or orphaned.
+    uint32_t depth = 0;
+    Node *jump = this;
+
     Node() = default;
 
     Node(const Node &) = delete;
 
     Node &operator=(const Node &) = delete;
 
-    ~Node() = default;
+    // The destructor releases a heap subtree iteratively: children nobody else
+    // holds are emptied before they are destroyed, so a long line does not
+    // recurse once per node. Subtrees that are held elsewhere survive as roots
+    // of their own trees, which costs a walk of each of them to renumber its
+    // depths.
+    ~Node() {
+        this->dropBoard();
+        if (this->children.empty()) {
+            return;
+        }
+        std::vector<std::shared_ptr<Node>> pending = std::move(this->children);
+        while (!pending.empty()) {
+            auto node = std::move(pending.back());
+            pending.pop_back();
+            if (node.use_count() == 1) {
+                std::move(node->children.begin(), node->children.end(), std::back_inserter(pending));
+                node->children.clear();
+            } else {
+                node->updateDepthRecursive();
+            }
+        }
+    }
 
-    Node(std::shared_ptr<Node> parent) {
-        this->parent = parent;
-        parent->children.push_back(std::shared_ptr<Node>(this));
+    // NewNode creates a node and, if parent is not null, attaches it as the
+    // parent's last child.
+    // Children of an arena node are allocated in the same arena.
+    static std::shared_ptr<Node> NewNode(std::shared_ptr<Node> parent) {
+        if (parent && parent->arena) {
+            Node *node = parent->arena->allocate();
+            node->cache = parent->cache;
+            parent->linkChild(node, false);
+            node->placeUnder(parent.get());
+            return parent->arena->Handle(node);
+        }
+        auto node = std::make_shared<Node>();
+        if (parent) {
+            node->parent = parent;
+            node->cache = parent->cache;
+            parent->children.push_back(node);
+            node->placeUnder(parent.get());
+        }
+        return node;
     }
     std::shared_ptr<Node> Copy() {
         auto ret = std::make_shared<Node>();
         ret->props = this->props;
-        ret->children = this->children;
-        ret->parent = this->parent;
-        ret->board = this->board;
+        ret->children = this->Children();
+        ret->parent = this->Parent();
+        ret->placeUnder(this->parentNode());
         return ret;
     };
+
+    // self returns an owning handle to this node, for heap and arena nodes
+    // alike.
+    std::shared_ptr<Node> self() { return this->arena ? this->arena->Handle(this) : shared_from_this(); }
+
+    Node *parentNode() const {
+        if (this->arena) {
+            return this->parentId == noNode ? nullptr : this->arena->At(this->parentId);
+        }
+        return this->parent.lock().get();
+    }
+
+    // eachChild calls f(Node *) for every child, in order.
+    template <typename F>
+    void eachChild(F f) const {
+        if (this->arena) {
+            for (uint32_t i = this->firstChildId; i != noNode;) {
+                Node *child = this->arena->At(i);
+                i = child->nextSiblingId;
+                f(child);
+            }
+            return;
+        }
+        for (auto &child: this->children) {
+            f(child.get());
+        }
+    }
+
+    size_t childCount() const {
+        if (!this->arena) {
+            return this->children.size();
+        }
+        size_t n = 0;
+        this->eachChild([&n](Node *) { n++; });
+        return n;
+    }
+
+    Node *firstChild() const {
+        if (this->arena) {
+            return this->firstChildId == noNode ? nullptr : this->arena->At(this->firstChildId);
+        }
+        return this->children.empty() ? nullptr : this->children[0].get();
+    }
+
+    Node *lastChild() const {
+        Node *last = nullptr;
+        if (!this->arena) {
+            return this->children.empty() ? nullptr : this->children.back().get();
+        }
+        this->eachChild([&last](Node *child) { last = child; });
+        return last;
+    }
+
+    // hasNextSibling returns true if this node, a child of parent, is not the
+    // parent's last child.
+    bool hasNextSibling(const Node *parent) const {
+        return this->arena ? this->nextSiblingId != noNode : parent->children.back().get() != this;
+    }
+
+    // frameOf returns a WalkFrame positioned on the first child of node.
+    static WalkFrame frameOf(Node *node) { return {node, node->arena ? node->firstChildId : 0}; }
+
+    // nextChild returns the next child of a frame's node and advances the
+    // frame, or returns nullptr after the last child.
+    static Node *nextChild(WalkFrame &f) {
+        if (f.node->arena) {
+            if (f.next == noNode) {
+                return nullptr;
+            }
+            Node *child = f.node->arena->At(f.next);
+            f.next = child->nextSiblingId;
+            return child;
+        }
+        return f.next < f.node->children.size() ? f.node->children[f.next++].get() : nullptr;
+    }
+
+    // visitResult calls a visitor, which may return Visit, or nothing to mean
+    // Visit::CONTINUE.
+    template <typename F>
+    static Visit visitResult(F &f, Node *node) {
+        if constexpr (std::is_void_v<std::invoke_result_t<F &, Node *>>) {
+            f(node);
+            return Visit::CONTINUE;
+        } else {
+            return f(node);
+        }
+    }
+
+    // Walk visits this node's subtree depth first, calling pre(node) before a
+    // node's children and post(node) after them. Either may return a Visit:
+    // SKIP from pre leaves out the children (post is still called), STOP from
+    // either ends the walk. Walk returns false if it was stopped. It uses an
+    // explicit stack as deep as the tree, so it does not allocate per node and
+    // cannot overflow the call stack.
+    template <typename Pre, typename Post>
+    bool Walk(Pre pre, Post post) {
+        Visit v = visitResult(pre, this);
+        if (v == Visit::STOP) {
+            return false;
+        }
+        if (v == Visit::SKIP) {
+            return visitResult(post, this) != Visit::STOP;
+        }
+        std::vector<WalkFrame> stack{frameOf(this)};
+        while (!stack.empty()) {
+            Node *child = nextChild(stack.back());
+            if (!child) {
+                Node *done = stack.back().node;
+                stack.pop_back();
+                if (visitResult(post, done) == Visit::STOP) {
+                    return false;
+                }
+                continue;
+            }
+            v = visitResult(pre, child);
+            if (v == Visit::STOP) {
+                return false;
+            }
+            // Leaves need no frame of their own.
+            bool leaf = child->arena ? child->firstChildId == noNode : child->children.empty();
+            if (v == Visit::SKIP || leaf) {
+                if (visitResult(post, child) == Visit::STOP) {
+                    return false;
+                }
+                continue;
+            }
+            stack.push_back(frameOf(child));
+        }
+        return true;
+    }
+
+    // Walk visits this node's subtree in preorder; see Walk(pre, post).
+    template <typename Pre>
+    bool Walk(Pre pre) {
+        return this->Walk(pre, [](Node *) {});
+    }
+
+    // Subtree returns a range over this node's subtree in preorder, starting
+    // with this node.
+    SubtreeRange Subtree();
+
+    // MainLine returns a range from this node down the first children to the
+    // end of its line.
+    MainLineRange MainLine();
+
+    // Ancestors returns a range from this node's parent up to the root.
+    AncestorRange Ancestors();
+
+    // placeUnder sets depth and jump for a node whose parent is p, or for a root
+    // if p is null. p must already be placed. A node jumps as far as its
+    // parent's jump goes again when the parent's last two jumps are the same
+    // length, and to its parent otherwise.
+    void placeUnder(Node *p) {
+        if (!p) {
+            this->depth = 0;
+            this->jump = this;
+            return;
+        }
+        Node *j = p->jump;
+        this->depth = p->depth + 1;
+        this->jump = p->depth - j->depth == j->depth - j->jump->depth ? j->jump : p;
+    }
+
+    // updateDepthRecursive places every node of the subtree again, after the
+    // subtree was moved or its parent went away.
+    // The walk keeps the line of parents itself instead of looking each one up.
+    void updateDepthRecursive() {
+        std::vector<Node *> line{this->parentNode()};
+        this->Walk(
+                [&line](Node *node) {
+                    node->placeUnder(line.back());
+                    line.push_back(node);
+                },
+                [&line](Node *) { line.pop_back(); });
+    }
+
+    // ancestorAt returns this node's ancestor at depth d, or the node itself if
+    // d is its own depth. d must not be more than the node's depth.
+    Node *ancestorAt(uint32_t d) {
+        Node *node = this;
+        while (node->depth > d) {
+            node = node->jump->depth >= d ? node->jump : node->parentNode();
+        }
+        return node;
+    }
+
+    // commonAncestor returns the deepest node that is this node or one of its
+    // ancestors and also other or one of other's ancestors, or nullptr if the
+    // two are in different trees. Nodes at the same depth have jumps of the same
+    // length, so both sides jump together until their jumps meet.
+    Node *commonAncestor(Node *other) {
+        Node *a = this->ancestorAt(std::min(this->depth, other->depth));
+        Node *b = other->ancestorAt(a->depth);
+        while (a != b) {
+            if (a->depth == 0) {
+                return nullptr;
+            }
+            if (a->jump != b->jump) {
+                a = a->jump;
+                b = b->jump;
+            } else {
+                a = a->parentNode();
+                b = b->parentNode();
+            }
+        }
+        return a;
+    }
+
+    // linkChild attaches an arena node as the first or last child.
+    void linkChild(Node *child, bool first) {
+        child->parentId = this->id;
+        child->nextSiblingId = noNode;
+        if (first || this->firstChildId == noNode) {
+            child->nextSiblingId = this->firstChildId;
+            this->firstChildId = child->id;
+            return;
+        }
+        this->lastChild()->nextSiblingId = child->id;
+    }
+
+    // unlinkChild detaches an arena node from this node's children.
+    void unlinkChild(Node *child) {
+        if (this->firstChildId == child->id) {
+            this->firstChildId = child->nextSiblingId;
+        } else {
+            for (uint32_t i = this->firstChildId; i != noNode;) {
+                Node *c = this->arena->At(i);
+                if (c->nextSiblingId == child->id) {
+                    c->nextSiblingId = child->nextSiblingId;
+                    break;
+                }
+                i = c->nextSiblingId;
+            }
+        }
+        child->parentId = noNode;
+        child->nextSiblingId = noNode;
+    }
     // Write the node in SGF format to an io.Writer.
     // This method instantiates io.WriterTo for no particularly good reason.
     std::string WriteTo() {
-        std::string node = ";";
-        for (auto &prop: this->props) {
-            if (prop.empty())
-                continue;
-            node += prop[0];
-            for (size_t i = 1; i < prop.size(); i++) {
-                node += "[";
-                node += prop[i];
-                node += "]";
+        std::string node;
+        this->writeNodeTo(node);
+        return node;
+    }
+
+    // appendValue is AddValue for nodes under construction by the SGF loader,
+    // which cannot have a board yet, so the board cache is left alone.
+    void appendValue(PropKey key, std::string_view val) {
+        auto ki = this->key_index(key);
+        if (ki == -1) {
+            this->props.push_back(Property{key, {ShortString(val)}});
+            return;
+        }
+        for (auto &v: this->props[ki].values) {
+            if (v == val) {
+                return;
             }
         }
-        return node;
+        this->props[ki].values.emplace_back(val);
     }
 
-    int key_index(std::string key) {
+    int key_index(PropKey key) const {
         for (size_t i = 0; i < this->props.size(); i++) {
-            if (this->props[i][0] == key) {
+            if (this->props[i].key == key) {
                 return i;
             }
         }
@@ -75,63 +460,68 @@ struct Node : public std::enable_shared_from_this<Node> {
 
     // AddValue adds the specified string as a value for the given key. If the value
     // already exists for the key, nothing happens.
-    void AddValue(std::string key, std::string val) {
+    void AddValue(std::string key, std::string val) { this->AddValue(InternKey(key), val); }
+
+    void AddValue(PropKey key, std::string_view val) {
         this->mutorCheck(key);
-        auto ki = this->key_index(key);
-        if (ki == -1) {
-            this->props.push_back(std::vector<std::string>{key, val});
-            return;
-        };
-        for (size_t i = 1; i < this->props[ki].size(); i++) {
-            if (this->props[ki][i] == val) {
-                return;
-            }
-        }
-        this->props[ki].push_back(val);
+        this->appendValue(key, val);
     }
 
     // DeleteKey deletes the given key and all of its values.
-    void DeleteKey(std::string key) {
+    void DeleteKey(std::string key) { this->DeleteKey(InternKey(key)); }
+
+    void DeleteKey(PropKey key) {
         auto ki = this->key_index(key);
         if (ki == -1) {
             return;
         }
         this->mutorCheck(key);
-        this->props.erase(this->props.begin() + ki);
+        this->props.erase(ki);
     }
 
     // DeleteValue checks if the given key in this node has the given value, and
     // removes that value, if it does.
-    void DeleteValue(std::string key, std::string val) {
+    void DeleteValue(std::string key, std::string val) { this->DeleteValue(InternKey(key), val); }
+
+    void DeleteValue(PropKey key, std::string_view val) {
         auto ki = this->key_index(key);
         if (ki == -1) {
             return;
         }
         this->mutorCheck(key);
-        for (size_t i = 1; i < this->props[ki].size(); i++) {
-            if (this->props[ki][i] == val) {
-                this->props[ki].erase(this->props[ki].begin() + i);
-                return;
+        auto &values = this->props[ki].values;
+        for (size_t i = 0; i < values.size(); i++) {
+            if (values[i] == val) {
+                values.erase(i);
+                break;
             }
         }
-        if (this->props[ki].size() < 2) {
-            this->props.erase(this->props.begin() + ki);
+        if (values.empty()) {
+            this->props.erase(ki);
         }
     }
 
     // GetValue returns the first value for the given key, if present, in which case
     // ok will be true. Otherwise it returns "" and false.
-    std::string GetValue(std::string key) {
+    std::string GetValue(std::string key) { return std::string(this->GetValueView(InternKey(key))); }
+
+    std::string GetValue(PropKey key) { return std::string(this->GetValueView(key)); }
+
+    // GetValueView is GetValue without a copy. The view is valid until the key is
+    // next modified.
+    std::string_view GetValueView(PropKey key) const {
         auto ki = this->key_index(key);
         if (ki == -1) {
-            return "";
+            return std::string_view();
         }
-        return this->props[ki][1];
+        return this->props[ki].values[0].view();
     }
 
     // SetValue sets the specified string as the first and only value for the given
     // key.
-    void SetValue(std::string key, std::string val) {
+    void SetValue(std::string key, std::string val) { this->SetValue(InternKey(key), val); }
+
+    void SetValue(PropKey key, std::string_view val) {
         this->DeleteKey(key);
         this->AddValue(key, val);
     }
@@ -139,9 +529,10 @@ struct Node : public std::enable_shared_from_this<Node> {
     // SetValues sets the values of the key to the values provided. The original
     // slice remains safe to modify.
     void SetValues(std::string key, std::vector<std::string> values) {
-        this->DeleteKey(key);
+        auto k = InternKey(key);
+        this->DeleteKey(k);
         for (auto &val: values) {
-            this->AddValue(key, val);
+            this->AddValue(k, val);
         }
     }
 
@@ -149,34 +540,38 @@ struct Node : public std::enable_shared_from_this<Node> {
     int KeyCount() { return this->props.size(); }
 
     // ValueCount returns the number of values a key has.
-    int ValueCount(std::string key) {
+    int ValueCount(std::string key) { return this->ValueCount(InternKey(key)); }
+
+    int ValueCount(PropKey key) const {
         auto ki = this->key_index(key);
         if (ki == -1) {
             return 0;
         }
-        return this->props[ki].size() - 1;
+        return this->props[ki].values.size();
     }
 
     // AllKeys returns a new slice of strings, containing all the keys that the node
     // has.
     std::vector<std::string> AllKeys() {
         std::vector<std::string> ret;
-        for (auto &slice: this->props) {
-            ret.push_back(slice[0]);
+        for (auto &prop: this->props) {
+            ret.push_back(KeyName(prop.key));
         }
         return ret;
     }
 
     // AllValues returns a new slice of strings, containing all the values that a
     // given key has in this node.
-    std::vector<std::string> AllValues(std::string key) {
+    std::vector<std::string> AllValues(std::string key) { return this->AllValues(InternKey(key)); }
+
+    std::vector<std::string> AllValues(PropKey key) {
         auto ki = this->key_index(key);
         if (ki == -1) {
             return std::vector<std::string>();
         }
         std::vector<std::string> ret;
-        for (size_t i = 1; i < this->props[ki].size(); i++) {
-            ret.push_back(this->props[ki][i]);
+        for (auto &val: this->props[ki].values) {
+            ret.push_back(val.str());
         }
         return ret;
     }
@@ -188,16 +583,17 @@ struct Node : public std::enable_shared_from_this<Node> {
         if (lastChild == nullptr) {
             return std::make_tuple(0, 0, "", false);
         }
+        int size = this->RootBoardSize();
         auto lastMove = lastChild->AllValues("B");
         if (lastMove.size() == 1) {
-            auto [x, y, onboard] = ParsePoint(lastMove[0], this->board->size);
+            auto [x, y, onboard] = ParsePoint(lastMove[0], size);
             if (onboard) {
                 return std::make_tuple(x, y, "B", true);
             }
         }
         lastMove = lastChild->AllValues("W");
         if (lastMove.size() == 1) {
-            auto [x, y, onboard] = ParsePoint(lastMove[0], this->board->size);
+            auto [x, y, onboard] = ParsePoint(lastMove[0], size);
             if (onboard) {
                 return std::make_tuple(x, y, "W", true);
             }
@@ -207,29 +603,38 @@ struct Node : public std::enable_shared_from_this<Node> {
 
     // Parent returns the parent of a node. This will be nil if the node is the root
     // of the tree.
-    std::shared_ptr<Node> Parent() { return this->parent.lock(); }
+    std::shared_ptr<Node> Parent() {
+        if (this->arena) {
+            Node *p = this->parentNode();
+            return p ? this->arena->Handle(p) : nullptr;
+        }
+        return this->parent.lock();
+    }
 
     // Children returns a new slice of pointers to all the node's children.
-    std::vector<std::shared_ptr<Node>> Children() { return this->children; }
+    std::vector<std::shared_ptr<Node>> Children() {
+        if (!this->arena) {
+            return this->children;
+        }
+        std::vector<std::shared_ptr<Node>> ret;
+        this->eachChild([&](Node *child) { ret.push_back(this->arena->Handle(child)); });
+        return ret;
+    }
 
     // MainChild returns the first child a node has. If the node has zero children,
     // nil is returned.
     std::shared_ptr<Node> MainChild() {
-        if (this->children.size() == 0) {
-            return nullptr;
-        }
-        return this->children[0];
+        Node *child = this->firstChild();
+        return child ? child->self() : nullptr;
     }
 
     std::shared_ptr<Node> LastChild() {
-        if (this->children.size() == 0) {
-            return nullptr;
-        }
-        return this->children[this->children.size() - 1];
+        Node *child = this->lastChild();
+        return child ? child->self() : nullptr;
     }
 
     Colour LastColor() {
-        if (this->children.size() == 0) {
+        if (this->childCount() == 0) {
             auto props = this->AllKeys();
             if (props.size() >= 1) {
                 if (props[0] == "B") {
@@ -243,7 +648,11 @@ struct Node : public std::enable_shared_from_this<Node> {
                 return Colour::BLACK;
             }
         } else {
-            auto props = this->children[0]->LastChild()->AllKeys();
+            auto last = this->firstChild()->lastChild();
+            if (!last) {
+                return Colour::BLACK;
+            }
+            auto props = last->AllKeys();
             if (props.size() >= 1) {
                 if (props[0] == "B") {
                     return Colour::WHITE;
@@ -262,6 +671,10 @@ struct Node : public std::enable_shared_from_this<Node> {
     // parent's list of children, and added to the new parent's list. SetParent
     // panics if a cyclic tree is created.
     void SetParent(std::shared_ptr<Node> new_parent) {
+        if (this->arena || (new_parent && new_parent->arena)) {
+            this->setArenaParent(new_parent.get());
+            return;
+        }
         // Remove from old parent's children
         if (auto old_parent = parent.lock()) {
             old_parent->children.erase(
@@ -287,12 +700,46 @@ struct Node : public std::enable_shared_from_this<Node> {
             // Add to children
             new_parent->children.push_back(shared_from_this());
         }
+        this->updateDepthRecursive();
+        this->clearBoardCacheRecursive();
+        this->detachCacheRecursive();
+    }
+
+    // setArenaParent is SetParent for arena nodes, which may only move within
+    // their own arena.
+    void setArenaParent(Node *new_parent) {
+        if (new_parent && new_parent->arena != this->arena) {
+            throw std::runtime_error("SetParent(): nodes belong to different arenas");
+        }
+        for (Node *current = new_parent; current; current = current->parentNode()) {
+            if (current == this) {
+                throw std::runtime_error("Cycle detected in node hierarchy");
+            }
+        }
+        if (Node *old_parent = this->parentNode()) {
+            old_parent->unlinkChild(this);
+        }
+        if (new_parent) {
+            new_parent->linkChild(this, false);
+        }
+        this->updateDepthRecursive();
         this->clearBoardCacheRecursive();
+        this->detachCacheRecursive();
     }
 
     // DeleteChildren deletes all children of a node. This is useful for
-    // clearing the children of a node when it is no longer needed.
-    void DeleteChildren() { children.clear(); }
+    // clearing the children of a node when it is no longer needed. Arena
+    // children are detached, become roots, and are freed with the arena.
+    void DeleteChildren() {
+        if (this->arena) {
+            while (Node *child = this->firstChild()) {
+                this->unlinkChild(child);
+                child->updateDepthRecursive();
+            }
+            return;
+        }
+        children.clear();
+    }
     // ToString returns a string representation of the node for debugging
     std::string ToString() {
         if (!this) {
@@ -300,7 +747,7 @@ struct Node : public std::enable_shared_from_this<Node> {
         }
 
         std::string noun = "children";
-        if (children.size() == 1) {
+        if (this->childCount() == 1) {
             noun = "child";
         }
 
@@ -308,7 +755,7 @@ struct Node : public std::enable_shared_from_this<Node> {
         std::sort(keys.begin(), keys.end());
 
         std::ostringstream oss;
-        oss << "Node " << this << ": depth " << (int) this->GetLine().size() - 1 << ", " << children.size() << " "
+        oss << "Node " << this << ": depth " << this->depth << ", " << this->childCount() << " "
             << noun << ", subtree size " << this->SubtreeSize() << ", keys [";
         for (size_t i = 0; i < keys.size(); ++i) {
             oss << keys[i];
@@ -334,21 +781,25 @@ struct Node : public std::enable_shared_from_this<Node> {
         if (all_b.size() + all_w.size() > 0 && all_ab.size() + all_aw.size() + all_ae.size() > 0) {
             throw std::runtime_error("Mix of move and setup properties");
         }
-        auto parent = this->parent.lock().get();
+        auto parent = this->parentNode();
         if (parent) {
-            auto board = parent->board.get();
+            auto board = parent->GetBoard();
             if (all_b.size() > 0) {
                 auto mv = all_b[0];
-                if (!ValidPoint(mv, board->size)) {
-                    board->LegalColour(mv, Colour::BLACK);
+                if (ValidPoint(mv, board->size)) {
+                    if (!board->LegalColour(mv, Colour::BLACK)) {
+                        throw std::runtime_error("Illegal B move: " + mv);
+                    }
                 } else if (mv != "" && mv != "tt") {
                     throw std::runtime_error("Invalid B move point: " + mv);
                 }
             }
             if (all_w.size() > 0) {
                 auto mv = all_w[0];
-                if (!ValidPoint(mv, board->size)) {
-                    board->LegalColour(mv, Colour::WHITE);
+                if (ValidPoint(mv, board->size)) {
+                    if (!board->LegalColour(mv, Colour::WHITE)) {
+                        throw std::runtime_error("Illegal W move: " + mv);
+                    }
                 } else if (mv != "" && mv != "tt") {
                     throw std::runtime_error("Invalid W move point: " + mv);
                 }
@@ -365,31 +816,28 @@ struct Node : public std::enable_shared_from_this<Node> {
     // along with an error. Failure indicates the move was illegal.
     //
     // Note that passes cannot be played with Play.
-    std::shared_ptr<Node> Play(std::string move) { return this->PlayColour(move, this->board->player, true); }
+    std::shared_ptr<Node> Play(std::string move) { return this->PlayColour(move, this->GetBoard()->player, true); }
 
     // PlayColour is like Play, except the colour is specified rather than being
     // automatically determined.
     std::shared_ptr<Node> PlayColour(std::string move, Colour colour, bool checkLegal) {
         if (checkLegal) {
-            auto legal = this->board->LegalColour(move, colour);
+            auto legal = this->GetBoard()->LegalColour(move, colour);
             if (!legal) {
                 throw std::runtime_error("Illegal move: " + move);
             }
         }
-        auto key = "B";
-        if (colour == Colour::WHITE) {
-            key = "W";
-        }
-        auto child = this->children;
-        for (auto i = 0; i < child.size(); i++) {
-            if (child[i]->ValueCount(key) == 1) {
-                auto mv = child[i]->GetValue(key);
-                if (mv == move) {
-                    return child[i];
-                }
+        PropKey key = colour == Colour::WHITE ? Key::W : Key::B;
+        Node *found = nullptr;
+        this->eachChild([&](Node *child) {
+            if (!found && child->ValueCount(key) == 1 && child->GetValueView(key) == move) {
+                found = child;
             }
+        });
+        if (found) {
+            return found->self();
         }
-        auto newNode = std::make_shared<Node>(shared_from_this());
+        auto newNode = NewNode(this->self());
         newNode->SetValue(key, move);
         return newNode;
     }
@@ -397,7 +845,7 @@ struct Node : public std::enable_shared_from_this<Node> {
     // created, attached as a child, and returned. However, if the specified pass
     // already existed in a child, that child is returned instead and no new node is
     // created.
-    std::shared_ptr<Node> Pass() { return this->PassColour(this->board->player); }
+    std::shared_ptr<Node> Pass() { return this->PassColour(this->GetBoard()->player); }
 
     // PassColour is like Pass, except the colour is specified rather than being
     // automatically determined.
@@ -405,16 +853,18 @@ struct Node : public std::enable_shared_from_this<Node> {
         if (colour != Colour::WHITE && colour != Colour::BLACK) {
             throw std::runtime_error("Invalid colour: " + std::to_string(static_cast<int>(colour)));
         }
-        auto key = (colour == Colour::WHITE) ? "W" : "B";
-        for (const auto &child: this->children) {
-            if (child->ValueCount(key) == 1) {
-                auto mv = child->GetValue(key);
-                if (!ValidPoint(mv, this->board->size)) {
-                    return child;
-                }
+        PropKey key = colour == Colour::WHITE ? Key::W : Key::B;
+        int size = this->RootBoardSize();
+        Node *found = nullptr;
+        this->eachChild([&](Node *child) {
+            if (!found && child->ValueCount(key) == 1 && !ValidPoint(child->GetValueView(key), size)) {
+                found = child;
             }
+        });
+        if (found) {
+            return found->self();
         }
-        auto newNode = std::make_shared<Node>(shared_from_this());
+        auto newNode = NewNode(this->self());
         newNode->SetValue(key, "");
         return newNode;
     }
@@ -423,41 +873,94 @@ struct Node : public std::enable_shared_from_this<Node> {
 
     // GetRoot travels up the tree, examining each node's parent until it finds the
     // root node, which it returns.
-    std::shared_ptr<Node> GetRoot() {
-        auto root = shared_from_this();
-        while (root->parent.lock()) {
-            root = root->parent.lock();
-        }
-        return root;
-    }
+    std::shared_ptr<Node> GetRoot() { return this->ancestorAt(0)->self(); }
 
     // GetEnd travels down the tree from the node, until it reaches a node with zero
     // children. It returns that node. Note that, if GetEnd is called on a node that
     // is not on the main line, the result will not be on the main line either, but
     // will instead be the end of the current branch.
     std::shared_ptr<Node> GetEnd() {
-        auto node = shared_from_this();
-        while (!node->children.empty()) {
-            node = node->children.back();
+        Node *node = this;
+        while (Node *last = node->lastChild()) {
+            node = last;
         }
-        return node;
+        return node->self();
     }
 
     // GetLine returns the line representation of the node
     std::vector<std::shared_ptr<Node>> GetLine() const {
-        std::vector<std::shared_ptr<Node>> ret;
+        std::vector<std::shared_ptr<Node>> ret(this->depth + 1);
+        if (this->arena) {
+            Node *node = const_cast<Node *>(this);
+            for (size_t i = ret.size(); i-- > 0; node = node->parentNode()) {
+                ret[i] = this->arena->Handle(node);
+            }
+            return ret;
+        }
         auto node = std::const_pointer_cast<Node>(shared_from_this());
-        while (node) {
-            ret.push_back(node);
-            node = node->parent.lock();
+        for (size_t i = ret.size(); i-- > 0; node = node->parent.lock()) {
+            ret[i] = node;
         }
-        std::reverse(ret.begin(), ret.end());
         return ret;
     }
 
+    // Depth returns the number of nodes above this one; a root has depth 0.
+    uint32_t Depth() const { return this->depth; }
+
+    // Ancestor returns the node k levels above this one, or nullptr if k is
+    // more than Depth(). Ancestor(0) is the node itself. It takes O(log k)
+    // steps.
+    std::shared_ptr<Node> Ancestor(uint32_t k) {
+        return k > this->depth ? nullptr : this->ancestorAt(this->depth - k)->self();
+    }
+
+    // CommonAncestor returns the deepest node on both this node's line and
+    // other's line, or nullptr if they are in different trees. It takes
+    // O(log n) steps.
+    std::shared_ptr<Node> CommonAncestor(const std::shared_ptr<Node> &other) {
+        Node *common = other ? this->commonAncestor(other.get()) : nullptr;
+        return common ? common->self() : nullptr;
+    }
+
+    // ReplayFrom moves a board from one variation to another. b must hold the
+    // position after from, a node of the same tree, and be owned by the caller;
+    // ReplayFrom returns a board with the position after this node. Only the
+    // nodes below the common ancestor of from and this node are replayed: if
+    // from is an ancestor, b itself is moved down to this node, and otherwise
+    // play restarts from the deepest cached board on the way down from the
+    // common ancestor, or from the common ancestor's own board.
+    std::shared_ptr<Board> ReplayFrom(Node &from, std::shared_ptr<Board> b) {
+        Node *common = this->commonAncestor(&from);
+        if (!common) {
+            throw std::invalid_argument("ReplayFrom(): nodes are in different trees");
+        }
+        std::vector<Node *> path;
+        Node *node = this;
+        for (; node != common && !(node->board && common != &from); node = node->parentNode()) {
+            path.push_back(node);
+        }
+        if (node != &from) {
+            b = (node->board ? node->board : node->GetBoard())->Copy();
+        }
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            b->step++;
+            (*it)->updateBoard(*b);
+        }
+        return b;
+    }
+
     // MakeMainLine adjusts the tree structure so that the main line leads to this
     // node.
     void MakeMainLine() {
+        if (this->arena) {
+            for (Node *node = this, *up; (up = node->parentNode()); node = up) {
+                if (up->firstChildId != node->id) {
+                    up->unlinkChild(node);
+                    up->linkChild(node, true);
+                }
+            }
+            return;
+        }
         auto node = shared_from_this();
         while (auto parent = node->parent.lock()) {
             // Find node in parent's children
@@ -474,10 +977,8 @@ struct Node : public std::enable_shared_from_this<Node> {
 
     // SubtreeSize returns the number of nodes in the subtree rooted at this node
     int SubtreeSize() {
-        int size = 1; // Count this node
-        for (const auto &child: children) {
-            size += child->SubtreeSize();
-        }
+        int size = 0;
+        this->Walk([&size](Node *) { size++; });
         return size;
     }
 
@@ -488,11 +989,7 @@ struct Node : public std::enable_shared_from_this<Node> {
     // itself.
     std::vector<std::shared_ptr<Node>> SubtreeNodes() {
         std::vector<std::shared_ptr<Node>> nodes;
-        nodes.push_back(shared_from_this());
-        for (const auto &child: children) {
-            auto childNodes = child->SubtreeNodes();
-            nodes.insert(nodes.end(), childNodes.begin(), childNodes.end());
-        }
+        this->Walk([&nodes](Node *node) { nodes.push_back(node->self()); });
         return nodes;
     }
 
@@ -509,18 +1006,17 @@ struct Node : public std::enable_shared_from_this<Node> {
     // SubTreeKeyValueCount returns the number of keys and values in a node's
     // subtree, including itself.
     std::pair<int, int> SubTreeKeyValueCount() {
-        auto keyCount = this->KeyCount();
-        auto valueCount = 0;
-        for (auto &key: this->AllKeys()) {
-            valueCount += this->ValueCount(key);
-        }
-        for (auto &child: this->children) {
-            auto [childKeys, childValues] = child->SubTreeKeyValueCount();
-            keyCount += childKeys;
-            valueCount += childValues;
-        }
+        int keyCount = 0;
+        int valueCount = 0;
+        this->Walk([&](Node *node) {
+            keyCount += node->KeyCount();
+            for (auto &prop: node->props) {
+                valueCount += prop.values.size();
+            }
+        });
         return {keyCount, valueCount};
     }
+
     // TreeKeyValueCount returns the number of keys and values in the whole tree.
     std::pair<int, int> TreeKeyValueCount() {
         auto [keyCount, valueCount] = this->GetRoot()->SubTreeKeyValueCount();
@@ -531,7 +1027,7 @@ struct Node : public std::enable_shared_from_this<Node> {
     // which it returns as an integer. If no SZ property is present, it returns 19.
     int RootBoardSize() {
         auto root = this->GetRoot();
-        auto sz = root->GetValue("SZ");
+        auto sz = root->GetValue(Key::SZ);
         if (sz == "") {
             return 19;
         }
@@ -546,7 +1042,7 @@ struct Node : public std::enable_shared_from_this<Node> {
     // returns as a float64. If no KM property is present, it returns 0.
     float RootKomi() {
         auto root = this->GetRoot();
-        auto km = root->GetValue("KM");
+        auto km = root->GetValue(Key::KM);
         if (km == "") {
             return 0;
         }
@@ -556,34 +1052,90 @@ struct Node : public std::enable_shared_from_this<Node> {
             return 0;
         }
     }
-    // Dyer returns the Dyer Signature of the entire tree.
-    std::string Dyer() {
-        std::map<int, std::string> vals = {{20, "??"}, {40, "??"}, {60, "??"}, {31, "??"}, {51, "??"}, {71, "??"}};
-        auto moveCount = 0;
-        std::shared_ptr<Node> node = this->GetRoot();
-        auto size = this->RootBoardSize();
-        bool breaked = false;
-        std::vector<std::string> loopKeys = {"B", "W"};
-        while (breaked == false) {
-            for (auto &key: loopKeys) {
-                try {
-                    auto mv = node->GetValue(key);
-                    moveCount += 1;
-                    if (moveCount == 20 || moveCount == 40 || moveCount == 60 || moveCount == 31 || moveCount == 51 ||
-                        moveCount == 71) {
-                        if (ValidPoint(mv, size)) {
-                            vals[moveCount] = mv;
-                        }
-                    }
-                } catch (...) {
+    // Dyer returns the Dyer Signature of the entire tree: the board size and
+    // the points of moves 20, 40, 60, 31, 51 and 71 of the main line, with "??"
+    // for moves that are missing or passes. The points are mapped through the
+    // given symmetry, so Dyer(s) is the signature of the tree after
+    // Transform(s).
+    std::string Dyer(int symmetry = 0) {
+        static constexpr int marks[] = {20, 40, 60, 31, 51, 71};
+        std::string_view vals[72] = {};
+        int moveCount = 0;
+        Node *root = this->GetRoot().get();
+        auto size = root->RootBoardSize();
+        for (Node *node = root; node && moveCount <= 71; node = node->firstChild()) {
+            for (PropKey key: {Key::B, Key::W}) {
+                if (node->key_index(key) == -1) {
+                    continue;
+                }
+                if (++moveCount <= 71) {
+                    vals[moveCount] = node->GetValueView(key);
                 }
             }
-            node = node->MainChild();
-            if (node == nullptr || moveCount > 71) {
-                breaked = true;
+        }
+        std::string ret = std::to_string(size);
+        for (int m: marks) {
+            ret += ValidPoint(vals[m], size) ? TransformPoint(vals[m], size, symmetry) : std::string("??");
+        }
+        return ret;
+    }
+
+    // MainLineMoves returns the point index of every move of the main line from
+    // the root, with noPoint for passes.
+    std::vector<int> MainLineMoves() {
+        std::vector<int> ret;
+        Node *root = this->GetRoot().get();
+        int size = root->RootBoardSize();
+        for (Node *node = root; node; node = node->firstChild()) {
+            for (PropKey key: {Key::B, Key::W}) {
+                if (node->key_index(key) == -1) {
+                    continue;
+                }
+                auto [x, y, onboard] = ParsePoint(node->GetValueView(key), size);
+                ret.push_back(onboard ? PointIndex(x, y, size) : noPoint);
             }
         }
-        return std::to_string(size) + vals[20] + vals[40] + vals[60] + vals[31] + vals[51] + vals[71];
+        return ret;
+    }
+
+    // MainLineSymmetry returns the symmetry that puts the main line in its
+    // canonical form, as CanonicalLineSymmetry() does: games that open with the
+    // same moves up to symmetry have the same main line after Transform().
+    int MainLineSymmetry() { return CanonicalLineSymmetry(this->MainLineMoves(), this->RootBoardSize()); }
+
+    // Transform maps every point of the whole tree through a symmetry: moves,
+    // setup stones, territory and markup. Cached boards are dropped.
+    void Transform(int symmetry) {
+        if (symmetry < 0 || symmetry >= symmetries) {
+            throw std::invalid_argument("Transform(): bad symmetry " + std::to_string(symmetry));
+        }
+        Node *root = this->GetRoot().get();
+        int size = root->RootBoardSize();
+        static const PropKey points[] = {Key::B,         Key::W,         Key::AB,        Key::AW,
+                                         Key::AE,        Key::TB,        Key::TW,        shortKey("TR"),
+                                         shortKey("SQ"), shortKey("CR"), shortKey("MA"), shortKey("SL"),
+                                         shortKey("DD"), shortKey("VW")};
+        static const PropKey pairs[] = {shortKey("AR"), shortKey("LN")};
+        static const PropKey label = shortKey("LB");
+        auto in = [](const auto &keys, PropKey k) {
+            return std::find(std::begin(keys), std::end(keys), k) != std::end(keys);
+        };
+        root->Walk([&](Node *node) {
+            for (auto &prop: node->props) {
+                for (auto &val: prop.values) {
+                    auto v = val.view();
+                    if (in(points, prop.key)) {
+                        val = ShortString(TransformPointValue(v, size, symmetry));
+                    } else if (in(pairs, prop.key) && v.size() == 5 && v[2] == ':') {
+                        val = ShortString(TransformPoint(v.substr(0, 2), size, symmetry) + ":" +
+                                          TransformPoint(v.substr(3, 2), size, symmetry));
+                    } else if (prop.key == label && v.size() >= 3 && v[2] == ':') {
+                        val = ShortString(TransformPoint(v.substr(0, 2), size, symmetry) + std::string(v.substr(2)));
+                    }
+                }
+            }
+        });
+        root->clearBoardCacheRecursive();
     }
 
     // clear_board_cache_recursive() needs to be called whenever a node's board cache becomes invalid.
@@ -591,68 +1143,419 @@ struct Node : public std::enable_shared_from_this<Node> {
     //
     //		* Changing a board-altering property.
     //		* Changing the identity of its parent.
+    //
+    // Checkpointed boards can sit below nodes without one, so the whole subtree
+    // is always visited.
     void clearBoardCacheRecursive() {
-        if (this->board.get() == nullptr) {
-            return;
+        this->Walk([](Node *node) { node->dropBoard(); });
+    }
+
+    // detachCacheRecursive forgets the subtree's BoardCache, e.g. after it was
+    // moved to another tree; the right one is picked up again on demand.
+    void detachCacheRecursive() {
+        this->Walk([](Node *node) { node->cache = nullptr; });
+    }
+
+    void mutorCheck(PropKey key) {
+        if (isMutor(key)) {
+            this->clearBoardCacheRecursive();
+        }
+    }
+
+    // SetBoardCache configures board caching for the whole tree: boards are kept
+    // every checkpointInterval moves, plus recently used ones up to byteBudget
+    // bytes. superko sets the repetition rule of the tree's boards.
+    void SetBoardCache(int checkpointInterval, size_t byteBudget, Superko superko = Superko::NONE) {
+        if (checkpointInterval < 1) {
+            throw std::invalid_argument("SetBoardCache(): bad checkpoint interval");
+        }
+        auto root = this->GetRoot();
+        auto cache = root->boardCache();
+        cache->checkpointInterval = checkpointInterval;
+        cache->byteBudget = byteBudget;
+        cache->superko = superko;
+        root->clearBoardCacheRecursive();
+    }
+
+    // GetBoard returns the board position after this node. The board is shared
+    // with the cache and must not be modified; Copy() it first.
+    //
+    // If the board is not cached it is rebuilt by replaying the nodes between
+    // here and the nearest ancestor with a cached board. Boards met along the
+    // way are kept only at checkpoints, and the result goes into the tree's LRU.
+    std::shared_ptr<Board> GetBoard() {
+        auto cache = this->boardCache();
+        if (this->board) {
+            if (this->inLru) {
+                cache->lru.splice(cache->lru.begin(), cache->lru, this->lruPos);
+            }
+            return this->board;
+        }
+
+        std::vector<Node *> path;
+        Node *node = this;
+        while (node && !node->board) {
+            path.push_back(node);
+            node = node->parentNode();
+        }
+        std::shared_ptr<Board> work;
+        if (node) {
+            work = node->board->Copy();
+        } else {
+            Node *root = path.back();
+            path.pop_back();
+            work = std::make_shared<Board>(root->RootBoardSize());
+            work->km = root->RootKomi();
+            work->superko = cache->superko;
+            if (work->superko != Superko::NONE) {
+                work->RecordHistory();
+            }
+            root->updateBoard(*work);
+            root->board = (root == this) ? work : work->Copy();
+        }
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            work->step++;
+            (*it)->updateBoard(*work);
+            if (*it != this && work->step % cache->checkpointInterval == 0) {
+                (*it)->board = work->Copy();
+            }
+        }
+        if (!this->board) {
+            this->board = work;
+            if (work->step % cache->checkpointInterval != 0) {
+                this->lruPos = cache->lru.insert(cache->lru.begin(), this);
+                this->inLru = true;
+                cache->bytes += work->MemoryUsage();
+                this->trimCache(*cache);
+            }
+        }
+        return this->board;
+    }
+
+    std::shared_ptr<BoardCache> boardCache() {
+        if (!this->cache) {
+            Node *parent = this->parentNode();
+            this->cache = parent ? parent->boardCache() : std::make_shared<BoardCache>();
+        }
+        return this->cache;
+    }
+
+    // dropBoard releases the node's cached board, if any.
+    void dropBoard() {
+        if (this->inLru) {
+            this->cache->bytes -= this->board->MemoryUsage();
+            this->cache->lru.erase(this->lruPos);
+            this->inLru = false;
         }
         this->board = nullptr;
-        for (auto &child: this->children) {
-            child->clearBoardCacheRecursive();
+    }
+
+    static void trimCache(BoardCache &cache) {
+        while (cache.bytes > cache.byteBudget && cache.lru.size() > 1) {
+            cache.lru.back()->dropBoard();
         }
     }
 
-    void mutorCheck(std::string key) {
-        for (auto &s: mutors) {
-            if (s == key) {
-                this->clearBoardCacheRecursive();
-                break;
+    // updateBoard applies the node's board-altering properties to a board:
+    // setup stones, then the move, then the player to move.
+    void updateBoard(Board &b) { applyProperties(this->props, b); }
+
+    // applyProperties is updateBoard for a set of properties held elsewhere.
+    static void applyProperties(const SmallVector<Property, 2> &props, Board &b) {
+        for (auto &prop: props) {
+            Colour c;
+            if (prop.key == Key::AB) {
+                c = Colour::BLACK;
+            } else if (prop.key == Key::AW) {
+                c = Colour::WHITE;
+            } else if (prop.key == Key::AE) {
+                c = Colour::EMPTY;
+            } else {
+                continue;
+            }
+            for (auto &val: prop.values) {
+                ForEachPoint(val.view(), b.size, [&](int x, int y) {
+                    int p = PointIndex(x, y, b.size);
+                    if (c == Colour::EMPTY) {
+                        b.removeStone(p);
+                    } else {
+                        b.addStone(p, c);
+                    }
+                });
             }
+            b.ClearKo();
+        }
+        std::string_view pl;
+        for (auto &prop: props) {
+            if (prop.key == Key::PL) {
+                pl = prop.values[0].view();
+            }
+            if (prop.key != Key::B && prop.key != Key::W) {
+                continue;
+            }
+            Colour c = prop.key == Key::B ? Colour::BLACK : Colour::WHITE;
+            int p = b.Index(prop.values[0].view());
+            if (p == noPoint) {
+                b.PassColour(c);
+            } else {
+                b.removeStone(p);
+                b.playMove(p, c);
+            }
+        }
+        if (pl == "B" || pl == "b") {
+            b.SetPlayer(Colour::BLACK);
+        } else if (pl == "W" || pl == "w") {
+            b.SetPlayer(Colour::WHITE);
         }
     }
-    // TODO: complete this function
-    std::shared_ptr<Board> GetBoard() { return this->board; }
 
     // Save saves the entire game tree to the specified file. It does not need to be
     // called from the root node, but can be called from any node in an SGF tree -
     // the whole tree is always saved.
 
-    std::string Save() { return SaveCollection(std::vector<std::shared_ptr<Node>>{shared_from_this()}); }
+    std::string Save() { return SaveCollection(std::vector<std::shared_ptr<Node>>{this->self()}); }
 
+    // SaveCollection saves the trees of several nodes, one per line.
     std::string SaveCollection(std::vector<std::shared_ptr<Node>> nodes) {
         std::string sgf;
-        std::vector<std::shared_ptr<Node>> roots;
+        bool any = false;
         for (auto &node: nodes) {
-            if (node) {
-                roots.push_back(node);
+            if (!node) {
+                continue;
             }
+            if (any) {
+                sgf += "\n";
+            }
+            node->GetRoot()->writeTreeTo(sgf, [](std::string &) {});
+            any = true;
         }
-        if (roots.size() == 0) {
+        if (!any) {
             return "()";
         }
-        for (auto &root: roots) {
-            sgf = root->writeTree();
-        }
         return sgf;
     }
+
     std::string writeTree() {
-        std::string sgf = "(";
-        sgf += this->WriteTo();
-        if (children.size() == 0) {
-            // leaf node
-            sgf += ")";
-            return sgf;
-        } else if (children.size() == 1) {
-            // main line, no branch, 递归主干
-            sgf += children[0]->writeTree().substr(1, children[0]->writeTree().size() - 2); // 去掉子树的外层括号
-        } else {
-            // 分支，每个分支都递归包裹
-            for (auto &child: children) {
-                sgf += child->writeTree();
+        std::string sgf;
+        this->writeTreeTo(sgf, [](std::string &) {});
+        return sgf;
+    };
+
+    // writeNodeTo appends the node in SGF format to buf, escaping '\' and ']'
+    // in values.
+    void writeNodeTo(std::string &buf) const {
+        buf += ';';
+        for (auto &prop: this->props) {
+            AppendKeyName(buf, prop.key);
+            for (auto &val: prop.values) {
+                buf += '[';
+                auto v = val.view();
+                size_t from = 0;
+                for (size_t i = 0; i < v.size(); i++) {
+                    if (v[i] == '\\' || v[i] == ']') {
+                        buf.append(v.data() + from, i - from);
+                        buf += '\\';
+                        from = i;
+                    }
+                }
+                buf.append(v.data() + from, v.size() - from);
+                buf += ']';
             }
         }
-        sgf += ")";
-        return sgf;
+    }
+
+    // writeTreeTo appends the subtree rooted at this node to buf in SGF format.
+    // A main line is written as a plain sequence of nodes and every variation
+    // is wrapped in parentheses. The walk keeps its own stack, so it runs in
+    // linear time and a long main line cannot overflow the call stack.
+    // flush(buf) is called, and may empty buf, whenever buf grows past flushAt.
+    template <typename F>
+    void writeTreeTo(std::string &buf, F flush, size_t flushAt = SIZE_MAX) const {
+        // Each entry opens a variation, and the nullptr below it closes it.
+        std::vector<const Node *> stack{nullptr, this};
+        std::vector<const Node *> branch;
+        while (!stack.empty()) {
+            const Node *node = stack.back();
+            stack.pop_back();
+            if (!node) {
+                buf += ')';
+                continue;
+            }
+            buf += '(';
+            for (;;) {
+                node->writeNodeTo(buf);
+                if (buf.size() >= flushAt) {
+                    flush(buf);
+                }
+                const Node *first = node->firstChild();
+                if (!first) {
+                    break;
+                }
+                if (node->childCount() == 1) {
+                    node = first;
+                    continue;
+                }
+                branch.clear();
+                node->eachChild([&branch](Node *child) { branch.push_back(child); });
+                for (auto it = branch.rbegin(); it != branch.rend(); ++it) {
+                    stack.push_back(nullptr);
+                    stack.push_back(*it);
+                }
+                break;
+            }
+        }
+        flush(buf);
+    }
+};
+
+inline NodeArena::~NodeArena() {
+    for (uint32_t i = this->count; i-- > 0;) {
+        this->At(i)->~Node();
+    }
+}
+
+inline Node *NodeArena::At(uint32_t i) const {
+    return reinterpret_cast<Node *>(this->blocks[i >> blockBits].get()) + (i & (blockNodes - 1));
+}
+
+inline Node *NodeArena::allocate() {
+    if (this->count == noNode) {
+        throw std::length_error("NodeArena: too many nodes");
+    }
+    if ((this->count & (blockNodes - 1)) == 0) {
+        this->blocks.emplace_back(new unsigned char[blockNodes * sizeof(Node)]);
+    }
+    Node *node = new (this->At(this->count)) Node();
+    node->arena = this;
+    node->id = this->count++;
+    return node;
+}
+
+inline std::shared_ptr<Node> NodeArena::NewRoot() { return this->Handle(this->allocate()); }
+
+// SubtreeRange iterates over a subtree in preorder. Its iterator keeps a stack
+// of WalkFrames as deep as the tree, allocated once per iteration.
+class SubtreeRange {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Node *;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Node **;
+        using reference = Node *;
+
+        iterator() = default;
+        explicit iterator(Node *root) : cur(root) {}
+
+        Node *operator*() const { return this->cur; }
+
+        iterator &operator++() {
+            this->stack.push_back(Node::frameOf(this->cur));
+            while (!this->stack.empty()) {
+                if (Node *next = Node::nextChild(this->stack.back())) {
+                    this->cur = next;
+                    return *this;
+                }
+                this->stack.pop_back();
+            }
+            this->cur = nullptr;
+            return *this;
+        }
+
+        bool operator==(const iterator &o) const { return this->cur == o.cur; }
+        bool operator!=(const iterator &o) const { return this->cur != o.cur; }
+
+    private:
+        Node *cur = nullptr;
+        std::vector<WalkFrame> stack;
     };
+
+    explicit SubtreeRange(Node *root) : root(root) {}
+
+    iterator begin() const { return iterator(this->root); }
+    iterator end() const { return iterator(); }
+
+private:
+    Node *root;
 };
 
+// MainLineRange iterates from a node down the first children.
+class MainLineRange {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Node *;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Node **;
+        using reference = Node *;
+
+        explicit iterator(Node *node = nullptr) : cur(node) {}
+
+        Node *operator*() const { return this->cur; }
+
+        iterator &operator++() {
+            this->cur = this->cur->firstChild();
+            return *this;
+        }
+
+        bool operator==(const iterator &o) const { return this->cur == o.cur; }
+        bool operator!=(const iterator &o) const { return this->cur != o.cur; }
+
+    private:
+        Node *cur;
+    };
+
+    explicit MainLineRange(Node *start) : start(start) {}
+
+    iterator begin() const { return iterator(this->start); }
+    iterator end() const { return iterator(); }
+
+private:
+    Node *start;
+};
+
+// AncestorRange iterates from a node up the parents to the root.
+class AncestorRange {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Node *;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Node **;
+        using reference = Node *;
+
+        explicit iterator(Node *node = nullptr) : cur(node) {}
+
+        Node *operator*() const { return this->cur; }
+
+        iterator &operator++() {
+            this->cur = this->cur->parentNode();
+            return *this;
+        }
+
+        bool operator==(const iterator &o) const { return this->cur == o.cur; }
+        bool operator!=(const iterator &o) const { return this->cur != o.cur; }
+
+    private:
+        Node *cur;
+    };
+
+    explicit AncestorRange(Node *start) : start(start) {}
+
+    iterator begin() const { return iterator(this->start); }
+    iterator end() const { return iterator(); }
+
+private:
+    Node *start;
+};
+
+inline SubtreeRange Node::Subtree() { return SubtreeRange(this); }
+
+inline MainLineRange Node::MainLine() { return MainLineRange(this); }
+
+inline AncestorRange Node::Ancestors() { return AncestorRange(this->parentNode()); }
+
 #endif // CONSOLEGO_NODE_H
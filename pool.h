@@ -0,0 +1,170 @@
+#ifndef CONSOLEGO_POOL_H
+#define CONSOLEGO_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ThreadPool runs tasks on a fixed set of worker threads. Every worker owns a
+// deque: tasks submitted from a worker go to the back of its own deque and are
+// taken from the back (so nested work stays cache-warm), while idle workers
+// steal from the front of the others. Tasks submitted from outside the pool
+// are spread round-robin.
+class ThreadPool {
+public:
+    // threads == 0 uses one worker per hardware thread.
+    explicit ThreadPool(unsigned threads = 0) {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (unsigned i = 0; i < threads; i++) {
+            this->queues.push_back(std::make_unique<Queue>());
+        }
+        for (unsigned i = 0; i < threads; i++) {
+            this->workers.emplace_back([this, i] { this->run(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(this->mu);
+            this->stop = true;
+        }
+        this->wake.notify_all();
+        for (auto &t: this->workers) {
+            t.join();
+        }
+    }
+
+    unsigned Size() const { return static_cast<unsigned>(this->workers.size()); }
+
+    // Submit queues a task. It may be called from inside another task.
+    void Submit(std::function<void()> task) {
+        size_t q;
+        if (current() == this) {
+            q = workerIndex();
+        } else {
+            q = this->next.fetch_add(1, std::memory_order_relaxed) % this->queues.size();
+        }
+        this->pending.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(this->queues[q]->mu);
+            this->queues[q]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(this->mu);
+            this->queued++;
+        }
+        this->wake.notify_one();
+    }
+
+    // Wait blocks until every submitted task, including tasks they submitted,
+    // has finished. The first exception thrown by a task is rethrown here.
+    void Wait() {
+        std::unique_lock<std::mutex> lock(this->mu);
+        this->done.wait(lock, [this] { return this->pending.load() == 0; });
+        if (this->failure) {
+            auto e = this->failure;
+            this->failure = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mu;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> pending{0};
+
+    // mu guards queued, stop and failure.
+    std::mutex mu;
+    std::condition_variable wake;
+    std::condition_variable done;
+    size_t queued = 0;
+    bool stop = false;
+    std::exception_ptr failure;
+
+    static ThreadPool *&current() {
+        thread_local ThreadPool *pool = nullptr;
+        return pool;
+    }
+
+    static size_t &workerIndex() {
+        thread_local size_t index = 0;
+        return index;
+    }
+
+    // take pops a task from the worker's own deque, or steals one.
+    bool take(size_t self, std::function<void()> &task) {
+        {
+            auto &q = *this->queues[self];
+            std::lock_guard<std::mutex> lock(q.mu);
+            if (!q.tasks.empty()) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t k = 1; k < this->queues.size(); k++) {
+            auto &q = *this->queues[(self + k) % this->queues.size()];
+            std::lock_guard<std::mutex> lock(q.mu);
+            if (!q.tasks.empty()) {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t self) {
+        current() = this;
+        workerIndex() = self;
+        std::function<void()> task;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(this->mu);
+                this->wake.wait(lock, [this] { return this->queued > 0 || this->stop; });
+                if (this->queued == 0) {
+                    return;
+                }
+                this->queued--;
+            }
+            // A task is reserved for this worker, but another may have taken the
+            // one that was pushed; keep looking until one turns up.
+            while (!this->take(self, task)) {
+                std::this_thread::yield();
+            }
+            try {
+                task();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(this->mu);
+                if (!this->failure) {
+                    this->failure = std::current_exception();
+                }
+            }
+            task = nullptr;
+            if (this->pending.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(this->mu);
+                this->done.notify_all();
+            }
+        }
+    }
+};
+
+#endif // CONSOLEGO_POOL_H
@@ -0,0 +1,356 @@
+#ifndef CONSOLEGO_PROPS_H
+#define CONSOLEGO_PROPS_H
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+// SmallVector is a vector that keeps up to N elements inline and only moves to
+// the heap when it grows past that.
+template <typename T, size_t N>
+class SmallVector {
+public:
+    SmallVector() = default;
+
+    SmallVector(std::initializer_list<T> init) {
+        for (auto &v: init) {
+            this->push_back(v);
+        }
+    }
+
+    SmallVector(const SmallVector &other) {
+        this->reserve(other.size_);
+        for (auto &v: other) {
+            this->push_back(v);
+        }
+    }
+
+    SmallVector(SmallVector &&other) noexcept { this->steal(other); }
+
+    SmallVector &operator=(const SmallVector &other) {
+        if (this != &other) {
+            this->clear();
+            this->reserve(other.size_);
+            for (auto &v: other) {
+                this->push_back(v);
+            }
+        }
+        return *this;
+    }
+
+    SmallVector &operator=(SmallVector &&other) noexcept {
+        if (this != &other) {
+            this->release();
+            this->steal(other);
+        }
+        return *this;
+    }
+
+    ~SmallVector() { this->release(); }
+
+    T *begin() { return this->data_; }
+    T *end() { return this->data_ + this->size_; }
+    const T *begin() const { return this->data_; }
+    const T *end() const { return this->data_ + this->size_; }
+
+    size_t size() const { return this->size_; }
+    bool empty() const { return this->size_ == 0; }
+    T &operator[](size_t i) { return this->data_[i]; }
+    const T &operator[](size_t i) const { return this->data_[i]; }
+    T &back() { return this->data_[this->size_ - 1]; }
+
+    template <typename... Args>
+    T &emplace_back(Args &&...args) {
+        if (this->size_ == this->cap_) {
+            this->reserve(this->cap_ * 2);
+        }
+        T *slot = new (this->data_ + this->size_) T(std::forward<Args>(args)...);
+        this->size_++;
+        return *slot;
+    }
+
+    void push_back(const T &v) { this->emplace_back(v); }
+    void push_back(T &&v) { this->emplace_back(std::move(v)); }
+
+    // erase removes the element at index i, keeping the order of the rest.
+    void erase(size_t i) {
+        for (size_t j = i; j + 1 < this->size_; j++) {
+            this->data_[j] = std::move(this->data_[j + 1]);
+        }
+        this->data_[--this->size_].~T();
+    }
+
+    void clear() {
+        for (size_t i = 0; i < this->size_; i++) {
+            this->data_[i].~T();
+        }
+        this->size_ = 0;
+    }
+
+    void reserve(size_t n) {
+        if (n <= this->cap_) {
+            return;
+        }
+        T *fresh = static_cast<T *>(::operator new(n * sizeof(T)));
+        for (size_t i = 0; i < this->size_; i++) {
+            new (fresh + i) T(std::move(this->data_[i]));
+            this->data_[i].~T();
+        }
+        if (!this->isInline()) {
+            ::operator delete(this->data_);
+        }
+        this->data_ = fresh;
+        this->cap_ = static_cast<uint32_t>(n);
+    }
+
+private:
+    T *data_ = reinterpret_cast<T *>(inline_);
+    uint32_t size_ = 0;
+    uint32_t cap_ = N;
+    alignas(T) unsigned char inline_[N * sizeof(T)];
+
+    bool isInline() const { return this->data_ == reinterpret_cast<const T *>(this->inline_); }
+
+    void release() {
+        this->clear();
+        if (!this->isInline()) {
+            ::operator delete(this->data_);
+        }
+        this->data_ = reinterpret_cast<T *>(this->inline_);
+        this->cap_ = N;
+    }
+
+    void steal(SmallVector &other) {
+        if (other.isInline()) {
+            for (size_t i = 0; i < other.size_; i++) {
+                new (this->data_ + i) T(std::move(other.data_[i]));
+            }
+            this->size_ = other.size_;
+            other.clear();
+            return;
+        }
+        this->data_ = other.data_;
+        this->size_ = other.size_;
+        this->cap_ = other.cap_;
+        other.data_ = reinterpret_cast<T *>(other.inline_);
+        other.size_ = 0;
+        other.cap_ = N;
+    }
+};
+
+// ShortString is an immutable string that stores up to 22 characters inline,
+// which covers moves, point lists and most numeric values, and spills longer
+// text such as comments to the heap.
+class ShortString {
+public:
+    ShortString() { this->setInline("", 0); }
+
+    ShortString(std::string_view v) {
+        if (v.size() <= inlineCap) {
+            this->setInline(v.data(), v.size());
+        } else {
+            this->setHeap(v.data(), v.size());
+        }
+    }
+
+    ShortString(const std::string &v) : ShortString(std::string_view(v)) {}
+    ShortString(const char *v) : ShortString(std::string_view(v)) {}
+
+    ShortString(const ShortString &other) : ShortString(other.view()) {}
+
+    ShortString(ShortString &&other) noexcept {
+        std::memcpy(this->raw, other.raw, sizeof(this->raw));
+        other.setInline("", 0);
+    }
+
+    ShortString &operator=(const ShortString &other) {
+        if (this != &other) {
+            ShortString copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    ShortString &operator=(ShortString &&other) noexcept {
+        if (this != &other) {
+            this->free();
+            std::memcpy(this->raw, other.raw, sizeof(this->raw));
+            other.setInline("", 0);
+        }
+        return *this;
+    }
+
+    ~ShortString() { this->free(); }
+
+    std::string_view view() const {
+        if (this->isHeap()) {
+            return std::string_view(this->heap().ptr, this->heap().len);
+        }
+        return std::string_view(this->raw, static_cast<uint8_t>(this->raw[inlineCap + 1]));
+    }
+
+    std::string str() const { return std::string(this->view()); }
+    operator std::string() const { return this->str(); }
+    size_t size() const { return this->view().size(); }
+    bool empty() const { return this->size() == 0; }
+
+    bool operator==(std::string_view v) const { return this->view() == v; }
+    bool operator!=(std::string_view v) const { return this->view() != v; }
+    bool operator==(const ShortString &o) const { return this->view() == o.view(); }
+
+private:
+    static constexpr size_t inlineCap = 22;
+    static constexpr uint8_t heapTag = 0xFF;
+
+    struct Heap {
+        char *ptr;
+        size_t len;
+    };
+
+    // raw holds either inlineCap characters, a NUL and the length, or a Heap
+    // record with heapTag in the last byte.
+    alignas(Heap) char raw[inlineCap + 2];
+
+    bool isHeap() const { return static_cast<uint8_t>(this->raw[inlineCap + 1]) == heapTag; }
+    const Heap &heap() const { return *reinterpret_cast<const Heap *>(this->raw); }
+
+    void setInline(const char *p, size_t n) {
+        std::memcpy(this->raw, p, n);
+        this->raw[n] = '\0';
+        this->raw[inlineCap + 1] = static_cast<char>(n);
+    }
+
+    void setHeap(const char *p, size_t n) {
+        Heap h{new char[n], n};
+        std::memcpy(h.ptr, p, n);
+        std::memcpy(this->raw, &h, sizeof(h));
+        this->raw[inlineCap + 1] = static_cast<char>(heapTag);
+    }
+
+    void free() {
+        if (this->isHeap()) {
+            delete[] this->heap().ptr;
+            this->setInline("", 0);
+        }
+    }
+};
+
+inline bool operator==(std::string_view a, const ShortString &b) { return b == a; }
+inline bool operator!=(std::string_view a, const ShortString &b) { return b != a; }
+
+// PropKey is an interned SGF property identifier. Identifiers of one or two
+// capital letters, which is all of FF[4], encode directly into the id, so
+// interning them needs no table or lock; anything else is assigned an id from
+// a shared table on first use.
+enum class PropKey : uint16_t {
+    NONE = 0,
+};
+
+constexpr PropKey shortKey(const char *k) {
+    return static_cast<PropKey>((k[0] - 'A' + 1) * 27 + (k[1] ? k[1] - 'A' + 1 : 0));
+}
+
+constexpr uint16_t firstInternedKey = 27 * 27;
+
+// Key holds the ids of commonly used properties.
+namespace Key {
+    constexpr PropKey B = shortKey("B");
+    constexpr PropKey W = shortKey("W");
+    constexpr PropKey AB = shortKey("AB");
+    constexpr PropKey AW = shortKey("AW");
+    constexpr PropKey AE = shortKey("AE");
+    constexpr PropKey PL = shortKey("PL");
+    constexpr PropKey SZ = shortKey("SZ");
+    constexpr PropKey KM = shortKey("KM");
+    constexpr PropKey C = shortKey("C");
+    constexpr PropKey GM = shortKey("GM");
+    constexpr PropKey FF = shortKey("FF");
+    constexpr PropKey PB = shortKey("PB");
+    constexpr PropKey PW = shortKey("PW");
+    constexpr PropKey BR = shortKey("BR");
+    constexpr PropKey WR = shortKey("WR");
+    constexpr PropKey DT = shortKey("DT");
+    constexpr PropKey RE = shortKey("RE");
+    constexpr PropKey HA = shortKey("HA");
+    constexpr PropKey RU = shortKey("RU");
+    constexpr PropKey TB = shortKey("TB");
+    constexpr PropKey TW = shortKey("TW");
+} // namespace Key
+
+// isMutor returns true for the keys that change the board position.
+inline bool isMutor(PropKey k) {
+    return k == Key::B || k == Key::W || k == Key::AB || k == Key::AW || k == Key::AE || k == Key::PL ||
+           k == Key::SZ;
+}
+
+// KeyTable holds the identifiers that do not fit the short encoding.
+struct KeyTable {
+    std::mutex mu;
+    std::unordered_map<std::string, PropKey> ids;
+    std::deque<std::string> names;
+
+    static KeyTable &Get() {
+        static KeyTable table;
+        return table;
+    }
+};
+
+// InternKey returns the id of a property identifier.
+inline PropKey InternKey(std::string_view k) {
+    auto upper = [](char c) { return c >= 'A' && c <= 'Z'; };
+    if ((k.size() == 1 && upper(k[0])) || (k.size() == 2 && upper(k[0]) && upper(k[1]))) {
+        return static_cast<PropKey>((k[0] - 'A' + 1) * 27 + (k.size() == 2 ? k[1] - 'A' + 1 : 0));
+    }
+    auto &table = KeyTable::Get();
+    std::lock_guard<std::mutex> lock(table.mu);
+    auto it = table.ids.find(std::string(k));
+    if (it != table.ids.end()) {
+        return it->second;
+    }
+    if (table.names.size() >= size_t(UINT16_MAX) - firstInternedKey) {
+        throw std::length_error("InternKey(): too many distinct property identifiers");
+    }
+    auto id = static_cast<PropKey>(firstInternedKey + table.names.size());
+    table.names.emplace_back(k);
+    table.ids.emplace(std::string(k), id);
+    return id;
+}
+
+// AppendKeyName appends the identifier of a key to out.
+inline void AppendKeyName(std::string &out, PropKey k) {
+    auto v = static_cast<uint16_t>(k);
+    if (v < firstInternedKey) {
+        out.push_back(static_cast<char>('A' + v / 27 - 1));
+        if (v % 27) {
+            out.push_back(static_cast<char>('A' + v % 27 - 1));
+        }
+        return;
+    }
+    auto &table = KeyTable::Get();
+    std::lock_guard<std::mutex> lock(table.mu);
+    out += table.names.at(v - firstInternedKey);
+}
+
+// KeyName returns the identifier of a key.
+inline std::string KeyName(PropKey k) {
+    std::string ret;
+    AppendKeyName(ret, k);
+    return ret;
+}
+
+// Property is one key of a node and its values.
+struct Property {
+    PropKey key;
+    SmallVector<ShortString, 1> values;
+};
+
+#endif // CONSOLEGO_PROPS_H
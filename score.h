@@ -0,0 +1,274 @@
+#ifndef CONSOLEGO_SCORE_H
+#define CONSOLEGO_SCORE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "bitboard.h"
+#include "board.h"
+#include "io.h"
+#include "node.h"
+
+// ScoringRule selects how a finished game is counted.
+enum class ScoringRule {
+    // AREA counts stones plus surrounded points (Chinese rules).
+    AREA,
+    // TERRITORY counts surrounded points plus prisoners (Japanese rules).
+    TERRITORY,
+};
+
+// Score is the count of a finished position. white includes komi.
+struct Score {
+    float black = 0.0f;
+    float white = 0.0f;
+    int blackStones = 0;
+    int whiteStones = 0;
+    int blackTerritory = 0;
+    int whiteTerritory = 0;
+    int blackPrisoners = 0;
+    int whitePrisoners = 0;
+    int dame = 0;
+
+    // Result returns the outcome in SGF RE form, e.g. "B+3.5", or "0" for a
+    // draw.
+    std::string Result() const {
+        float margin = this->black - this->white;
+        if (margin == 0.0f) {
+            return "0";
+        }
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%c+%g", margin > 0 ? 'B' : 'W', margin > 0 ? margin : -margin);
+        return buf;
+    }
+};
+
+// ScoreBoard counts a finished position under a rule, removing the stones in
+// dead first, and writes the totals into bScore and wScore. The empty points
+// are split into regions with bitboard flood fills; a region belongs to a side
+// if it borders only that side's stones, and is dame otherwise. Under
+// territory rules, the captures recorded on the board and the dead stones are
+// prisoners.
+inline Score ScoreBoard(Board &b, ScoringRule rule, const Bitboard &dead = Bitboard()) {
+    const EdgeMasks &e = Edges(b.size);
+    int n = e.nwords;
+    Bitboard black, white, open;
+    Score s;
+    for (int w = 0; w < n; w++) {
+        black.words[w] = b.black.words[w] & ~dead.words[w];
+        white.words[w] = b.white.words[w] & ~dead.words[w];
+        open.words[w] = e.onBoard.words[w] & ~(black.words[w] | white.words[w]);
+        s.whitePrisoners += __builtin_popcountll(b.black.words[w] & dead.words[w]);
+        s.blackPrisoners += __builtin_popcountll(b.white.words[w] & dead.words[w]);
+    }
+    s.blackStones = black.Count(n);
+    s.whiteStones = white.Count(n);
+
+    Bitboard rest = open;
+    for (int w = 0; w < n; w++) {
+        while (rest.words[w]) {
+            Bitboard seed;
+            seed.words[w] = rest.words[w] & -rest.words[w];
+            Bitboard region = FloodFill(seed, open, e);
+            Bitboard border = Dilate(region, e);
+            bool touchesBlack = false, touchesWhite = false;
+            for (int k = 0; k < n; k++) {
+                touchesBlack |= (border.words[k] & black.words[k]) != 0;
+                touchesWhite |= (border.words[k] & white.words[k]) != 0;
+                rest.words[k] &= ~region.words[k];
+            }
+            int size = region.Count(n);
+            if (touchesBlack && !touchesWhite) {
+                s.blackTerritory += size;
+            } else if (touchesWhite && !touchesBlack) {
+                s.whiteTerritory += size;
+            } else {
+                s.dame += size;
+            }
+        }
+    }
+
+    if (rule == ScoringRule::AREA) {
+        s.black = static_cast<float>(s.blackStones + s.blackTerritory);
+        s.white = static_cast<float>(s.whiteStones + s.whiteTerritory) + b.km;
+    } else {
+        s.blackPrisoners += b.captureBy[Colour::BLACK];
+        s.whitePrisoners += b.captureBy[Colour::WHITE];
+        s.black = static_cast<float>(s.blackTerritory + s.blackPrisoners);
+        s.white = static_cast<float>(s.whiteTerritory + s.whitePrisoners) + b.km;
+    }
+    b.bScore = s.black;
+    b.wScore = s.white;
+    return s;
+}
+
+// ScoreGame scores the end of the main line of the tree containing node.
+// Dead stones are taken from the last node: white stones on TB points, black
+// stones on TW points and, if the node is only setup, the stones it removes
+// with AE.
+inline Score ScoreGame(Node &node, ScoringRule rule) {
+    Node *root = node.GetRoot().get();
+    Board board(root->RootBoardSize());
+    board.km = root->RootKomi();
+    Node *last = root;
+    while (Node *next = last->firstChild()) {
+        last->updateBoard(board);
+        last = next;
+    }
+    Bitboard dead;
+    bool setupOnly = last != root && last->ValueCount(Key::B) == 0 && last->ValueCount(Key::W) == 0 &&
+                     last->ValueCount(Key::AB) == 0 && last->ValueCount(Key::AW) == 0;
+    if (setupOnly) {
+        for (auto &v: last->AllValues(Key::AE)) {
+            ForEachPoint(v, board.size, [&](int x, int y) { dead.Set(PointIndex(x, y, board.size)); });
+        }
+    } else {
+        last->updateBoard(board);
+    }
+    for (auto [key, owner]: {std::pair(Key::TB, Colour::BLACK), std::pair(Key::TW, Colour::WHITE)}) {
+        for (auto &v: last->AllValues(key)) {
+            ForEachPoint(v, board.size, [&](int x, int y) {
+                int i = PointIndex(x, y, board.size);
+                if (board.At(i) == Opponent(owner)) {
+                    dead.Set(i);
+                }
+            });
+        }
+    }
+    for (int w = 0; w < Bitboard::WordsFor(board.size); w++) {
+        dead.words[w] &= board.black.words[w] | board.white.words[w];
+    }
+    return ScoreBoard(board, rule, dead);
+}
+
+// ScoreRow is one scored game of a batch. A game that could not be parsed gives
+// a row with only the path, the game number and the error; a file that could
+// not be read gives one with game 0.
+struct ScoreRow {
+    std::string path;
+    size_t game = 0;
+    std::string blackPlayer;
+    std::string whitePlayer;
+    std::string recorded;
+    Score score;
+    std::string error;
+};
+
+// ScoreBulk scores every game of every file in paths concurrently, with
+// ParseBulk. Rows are in the order of paths, then games, with a row for every
+// game that failed; games are 1-based.
+inline std::vector<ScoreRow> ScoreBulk(const std::vector<std::string> &paths, ScoringRule rule,
+                                       const BulkOptions &opts = {}) {
+    std::vector<std::vector<ScoreRow>> found(paths.size());
+    std::mutex mu;
+    auto errors = ParseBulk(paths, opts, [&](size_t f, size_t g, std::shared_ptr<Node> root) {
+        ScoreRow row;
+        row.path = paths[f];
+        row.game = g + 1;
+        row.blackPlayer = root->GetValue(Key::PB);
+        row.whitePlayer = root->GetValue(Key::PW);
+        row.recorded = root->GetValue(Key::RE);
+        row.score = ScoreGame(*root, rule);
+        std::lock_guard<std::mutex> lock(mu);
+        found[f].push_back(std::move(row));
+    });
+    std::vector<ScoreRow> ret;
+    for (size_t f = 0; f < paths.size(); f++) {
+        for (auto &e: errors[f]) {
+            ScoreRow row;
+            row.path = paths[f];
+            row.game = e.game == noGame ? 0 : e.game + 1;
+            row.error = e.what;
+            found[f].push_back(std::move(row));
+        }
+        std::sort(found[f].begin(), found[f].end(),
+                  [](const ScoreRow &a, const ScoreRow &b) { return a.game < b.game; });
+        std::move(found[f].begin(), found[f].end(), std::back_inserter(ret));
+    }
+    return ret;
+}
+
+// csvField quotes a CSV field if it needs it.
+inline std::string csvField(const std::string &v) {
+    if (v.find_first_of(",\"\r\n") == std::string::npos) {
+        return v;
+    }
+    std::string ret = "\"";
+    for (char c: v) {
+        if (c == '"') {
+            ret += '"';
+        }
+        ret += c;
+    }
+    return ret + "\"";
+}
+
+// jsonString quotes a JSON string.
+inline std::string jsonString(const std::string &v) {
+    std::string ret = "\"";
+    for (unsigned char c: v) {
+        switch (c) {
+            case '"':
+                ret += "\\\"";
+                break;
+            case '\\':
+                ret += "\\\\";
+                break;
+            case '\n':
+                ret += "\\n";
+                break;
+            case '\r':
+                ret += "\\r";
+                break;
+            case '\t':
+                ret += "\\t";
+                break;
+            default:
+                if (c < 0x20) {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    ret += buf;
+                } else {
+                    ret += static_cast<char>(c);
+                }
+        }
+    }
+    return ret + "\"";
+}
+
+// WriteScoresCSV writes score rows as CSV with a header line.
+inline void WriteScoresCSV(std::ostream &os, const std::vector<ScoreRow> &rows) {
+    os << "path,game,PB,PW,black,white,result,RE,error\n";
+    for (auto &r: rows) {
+        os << csvField(r.path) << ',' << r.game << ',' << csvField(r.blackPlayer) << ',' << csvField(r.whitePlayer)
+           << ',';
+        if (r.error.empty()) {
+            os << r.score.black << ',' << r.score.white << ',' << r.score.Result();
+        } else {
+            os << ",,";
+        }
+        os << ',' << csvField(r.recorded) << ',' << csvField(r.error) << '\n';
+    }
+}
+
+// WriteScoresJSON writes score rows as a JSON array, one object per line.
+inline void WriteScoresJSON(std::ostream &os, const std::vector<ScoreRow> &rows) {
+    os << "[";
+    for (size_t i = 0; i < rows.size(); i++) {
+        auto &r = rows[i];
+        os << (i ? ",\n " : "\n ") << "{\"path\":" << jsonString(r.path) << ",\"game\":" << r.game;
+        if (!r.error.empty()) {
+            os << ",\"error\":" << jsonString(r.error) << "}";
+            continue;
+        }
+        os << ",\"PB\":" << jsonString(r.blackPlayer) << ",\"PW\":" << jsonString(r.whitePlayer)
+           << ",\"black\":" << r.score.black << ",\"white\":" << r.score.white
+           << ",\"result\":" << jsonString(r.score.Result()) << ",\"RE\":" << jsonString(r.recorded) << "}";
+    }
+    os << (rows.empty() ? "]\n" : "\n]\n");
+}
+
+#endif // CONSOLEGO_SCORE_H
@@ -0,0 +1,337 @@
+#ifndef CONSOLEGO_SEARCH_H
+#define CONSOLEGO_SEARCH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "node.h"
+#include "pool.h"
+
+// ReplayTree calls f(node, board) for every node of the tree below root, in
+// preorder, with the position after that node. A single board is carried
+// through the tree, so the walk copies no boards and never touches the tree's
+// own board cache. A node with later siblings is applied as an undo step, which
+// is taken back once its subtree is done; the rest of a line is played without
+// logging, since the board before it is not needed again.
+template <typename F>
+void ReplayTree(Node &root, F f) {
+    Board board(root.RootBoardSize());
+    std::vector<Node *> line;
+    std::vector<bool> marked;
+    root.Walk(
+            [&](Node *node) {
+                bool branch = !line.empty() && node->hasNextSibling(line.back());
+                if (branch) {
+                    board.Mark();
+                }
+                line.push_back(node);
+                marked.push_back(branch);
+                node->updateBoard(board);
+                f(node, static_cast<const Board &>(board));
+            },
+            [&](Node *) {
+                line.pop_back();
+                if (marked.back()) {
+                    board.Undo();
+                }
+                marked.pop_back();
+            });
+}
+
+// NodePath returns the child indexes that lead from the root to node.
+inline std::vector<uint32_t> NodePath(Node *node) {
+    std::vector<uint32_t> ret;
+    for (Node *parent = node->parentNode(); parent; node = parent, parent = node->parentNode()) {
+        uint32_t i = 0, at = 0;
+        parent->eachChild([&](Node *child) {
+            if (child == node) {
+                at = i;
+            }
+            i++;
+        });
+        ret.push_back(at);
+    }
+    std::reverse(ret.begin(), ret.end());
+    return ret;
+}
+
+// Pattern is a rectangular local shape. Each cell is black, white, empty, or a
+// wildcard that matches anything. Every row is kept as three bitmasks, so a
+// placement is tested against a board row with a few ANDs.
+class Pattern {
+public:
+    // Parse reads a pattern from rows separated by '/' or newlines, with 'X' for
+    // black, 'O' for white, '.' for empty and '?' for any point.
+    static Pattern Parse(std::string_view text) {
+        Pattern p;
+        std::vector<std::string_view> rows;
+        size_t start = 0;
+        for (size_t i = 0; i <= text.size(); i++) {
+            if (i == text.size() || text[i] == '/' || text[i] == '\n') {
+                if (i > start) {
+                    rows.push_back(text.substr(start, i - start));
+                }
+                start = i + 1;
+            }
+        }
+        if (rows.empty() || rows.size() > maxBoardSize) {
+            throw std::invalid_argument("Pattern: bad number of rows");
+        }
+        p.width = static_cast<int>(rows[0].size());
+        p.height = static_cast<int>(rows.size());
+        if (p.width < 1 || p.width > maxBoardSize) {
+            throw std::invalid_argument("Pattern: bad row width");
+        }
+        for (auto row: rows) {
+            if (static_cast<int>(row.size()) != p.width) {
+                throw std::invalid_argument("Pattern: rows differ in width");
+            }
+            Row r;
+            for (int x = 0; x < p.width; x++) {
+                uint64_t bit = uint64_t(1) << x;
+                switch (row[x]) {
+                    case 'X':
+                        r.black |= bit;
+                        break;
+                    case 'O':
+                        r.white |= bit;
+                        break;
+                    case '.':
+                        r.empty |= bit;
+                        break;
+                    case '?':
+                        break;
+                    default:
+                        throw std::invalid_argument("Pattern: bad cell '" + std::string(1, row[x]) + "'");
+                }
+            }
+            p.rows.push_back(r);
+        }
+        return p;
+    }
+
+    int Width() const { return this->width; }
+    int Height() const { return this->height; }
+
+    // MatchAt returns true if the pattern matches with its top left cell at x, y.
+    bool MatchAt(const Board &b, int x, int y) const {
+        return this->fits(b.black, b.white, b.size, x, y, true);
+    }
+
+    // Matches returns the PointIndex of every top left corner where the pattern
+    // matches the board.
+    std::vector<int> Matches(const Board &b) const {
+        std::vector<int> ret;
+        for (int y = 0; y + this->height <= b.size; y++) {
+            for (int x = 0; x + this->width <= b.size; x++) {
+                if (this->MatchAt(b, x, y)) {
+                    ret.push_back(PointIndex(x, y, b.size));
+                }
+            }
+        }
+        return ret;
+    }
+
+    // Possible returns the top left corners where the pattern could match some
+    // position whose black stones are a subset of black and white stones a
+    // subset of white. Empty cells are not checked.
+    std::vector<int> Possible(const Bitboard &black, const Bitboard &white, int size) const {
+        std::vector<int> ret;
+        for (int y = 0; y + this->height <= size; y++) {
+            for (int x = 0; x + this->width <= size; x++) {
+                if (this->fits(black, white, size, x, y, false)) {
+                    ret.push_back(PointIndex(x, y, size));
+                }
+            }
+        }
+        return ret;
+    }
+
+private:
+    struct Row {
+        uint64_t black = 0;
+        uint64_t white = 0;
+        uint64_t empty = 0;
+    };
+
+    int width = 0;
+    int height = 0;
+    std::vector<Row> rows;
+
+    bool fits(const Bitboard &black, const Bitboard &white, int size, int x, int y, bool checkEmpty) const {
+        if (x < 0 || y < 0 || x + this->width > size || y + this->height > size) {
+            return false;
+        }
+        for (int r = 0; r < this->height; r++) {
+            int start = PointIndex(x, y + r, size);
+            uint64_t b = black.Range(start, this->width);
+            uint64_t w = white.Range(start, this->width);
+            const Row &row = this->rows[r];
+            if ((b & row.black) != row.black || (w & row.white) != row.white) {
+                return false;
+            }
+            if (checkEmpty && ((b | w) & row.empty) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// SearchHit is one node of one game that matched a query. For pattern
+// queries x and y are the top left corner of the match.
+struct SearchHit {
+    uint32_t game = 0;
+    std::shared_ptr<Node> node;
+    std::vector<uint32_t> path;
+    int x = 0;
+    int y = 0;
+};
+
+// GameSearch indexes the positions of a collection of games for searching.
+// Building it replays every node of every game once, in parallel, to record a
+// position-hash index for exact position queries and, per game, the union of
+// all points ever held by each colour. Pattern queries use those unions to
+// skip games and placements that cannot match before replaying anything.
+class GameSearch {
+public:
+    explicit GameSearch(std::vector<std::shared_ptr<Node>> collection, unsigned threads = 0) :
+        games(std::move(collection)), summaries(this->games.size()), threads(threads) {
+        std::vector<std::vector<Entry>> found(this->games.size());
+        this->forEachGame([&](uint32_t g) {
+            auto &sum = this->summaries[g];
+            uint32_t order = 0;
+            ReplayTree(*this->games[g], [&](Node *node, const Board &b) {
+                sum.size = b.size;
+                int nwords = Bitboard::WordsFor(b.size);
+                for (int i = 0; i < nwords; i++) {
+                    sum.black.words[i] |= b.black.words[i];
+                    sum.white.words[i] |= b.white.words[i];
+                }
+                found[g].push_back({b.PositionHash(), static_cast<uint16_t>(b.size), g, order++, node});
+            });
+        });
+        size_t total = 0;
+        for (auto &f: found) {
+            total += f.size();
+        }
+        this->positions.reserve(total);
+        for (auto &f: found) {
+            this->positions.insert(this->positions.end(), f.begin(), f.end());
+            std::vector<Entry>().swap(f);
+        }
+        std::sort(this->positions.begin(), this->positions.end());
+    }
+
+    size_t Games() const { return this->games.size(); }
+    size_t Positions() const { return this->positions.size(); }
+
+    // FindPosition returns every node, in game order, whose position has the
+    // same stones as the board.
+    std::vector<SearchHit> FindPosition(const Board &b) const {
+        Entry key{b.PositionHash(), static_cast<uint16_t>(b.size), 0, 0, nullptr};
+        auto it = std::lower_bound(this->positions.begin(), this->positions.end(), key);
+        std::vector<const Entry *> matched;
+        for (; it != this->positions.end() && it->hash == key.hash && it->size == key.size; ++it) {
+            matched.push_back(&*it);
+        }
+        std::sort(matched.begin(), matched.end(), [](const Entry *a, const Entry *c) {
+            return a->game != c->game ? a->game < c->game : a->order < c->order;
+        });
+        std::vector<SearchHit> ret;
+        for (auto e: matched) {
+            ret.push_back({e->game, e->node->self(), NodePath(e->node), 0, 0});
+        }
+        return ret;
+    }
+
+    // FindPattern returns every occurrence of a pattern: each node where it
+    // matches at a placement where it did not match in the parent node. Games
+    // are searched in parallel; hits are in game order, then tree preorder.
+    std::vector<SearchHit> FindPattern(const Pattern &p) const {
+        std::vector<std::vector<SearchHit>> found(this->games.size());
+        this->forEachGame([&](uint32_t g) {
+            auto &sum = this->summaries[g];
+            auto candidates = p.Possible(sum.black, sum.white, sum.size);
+            if (candidates.empty()) {
+                return;
+            }
+            // matched[node] lists the candidates matching at that node, for
+            // comparison by its children.
+            std::unordered_map<Node *, std::vector<int>> matched;
+            ReplayTree(*this->games[g], [&](Node *node, const Board &b) {
+                std::vector<int> here;
+                for (int c: candidates) {
+                    if (p.MatchAt(b, c % b.size, c / b.size)) {
+                        here.push_back(c);
+                    }
+                }
+                Node *parentNode = node->parentNode();
+                auto parent = matched.find(parentNode);
+                for (int c: here) {
+                    if (parent == matched.end() ||
+                        !std::binary_search(parent->second.begin(), parent->second.end(), c)) {
+                        found[g].push_back({g, node->self(), NodePath(node), c % b.size, c / b.size});
+                    }
+                }
+                // Preorder visits the last child after its siblings' subtrees.
+                if (parent != matched.end() && node == parentNode->lastChild()) {
+                    matched.erase(parent);
+                }
+                if (node->firstChild()) {
+                    matched.emplace(node, std::move(here));
+                }
+            });
+        });
+        std::vector<SearchHit> ret;
+        for (auto &f: found) {
+            std::move(f.begin(), f.end(), std::back_inserter(ret));
+        }
+        return ret;
+    }
+
+private:
+    struct Entry {
+        uint64_t hash;
+        uint16_t size;
+        uint32_t game;
+        uint32_t order;
+        Node *node;
+
+        bool operator<(const Entry &o) const {
+            if (this->hash != o.hash) {
+                return this->hash < o.hash;
+            }
+            return this->size < o.size;
+        }
+    };
+
+    struct Summary {
+        int size = 0;
+        Bitboard black;
+        Bitboard white;
+    };
+
+    std::vector<std::shared_ptr<Node>> games;
+    std::vector<Summary> summaries;
+    std::vector<Entry> positions;
+    unsigned threads;
+
+    // forEachGame calls f(game) for every game on a thread pool.
+    template <typename F>
+    void forEachGame(F f) const {
+        ThreadPool pool(this->threads);
+        for (uint32_t g = 0; g < this->games.size(); g++) {
+            pool.Submit([&f, g] { f(g); });
+        }
+        pool.Wait();
+    }
+};
+
+#endif // CONSOLEGO_SEARCH_H
@@ -0,0 +1,151 @@
+#ifndef CONSOLEGO_SYMMETRY_H
+#define CONSOLEGO_SYMMETRY_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "bitboard.h"
+#include "colour.h"
+#include "utils.h"
+#include "zobrist.h"
+
+// A board has eight symmetries, numbered 0 to 7. Bit 0 mirrors left and right,
+// bit 1 mirrors top and bottom, and bit 2 then swaps x and y. Symmetry 0 is the
+// identity.
+constexpr int symmetries = 8;
+
+// SymmetryPoint maps a point through a symmetry.
+inline std::pair<int, int> SymmetryPoint(int x, int y, int size, int s) {
+    if (s & 1) {
+        x = size - 1 - x;
+    }
+    if (s & 2) {
+        y = size - 1 - y;
+    }
+    if (s & 4) {
+        std::swap(x, y);
+    }
+    return {x, y};
+}
+
+// SymmetryTable holds the point permutation of every symmetry of one board
+// size, and the Zobrist keys of each point's image, so the hash of a position
+// under a symmetry can be kept up to date like the plain one.
+struct SymmetryTable {
+    int size;
+    std::array<std::vector<int16_t>, symmetries> point;
+    // inverse[s] is the symmetry that undoes s.
+    std::array<int, symmetries> inverse;
+    // keys[s] holds the black and white keys of point i's image at 2i and 2i+1.
+    std::array<std::vector<uint64_t>, symmetries> keys;
+
+    explicit SymmetryTable(int sz) : size(sz) {
+        int n = sz * sz;
+        for (int s = 0; s < symmetries; s++) {
+            point[s].resize(n);
+            keys[s].resize(2 * n);
+            for (int i = 0; i < n; i++) {
+                auto [x, y] = SymmetryPoint(i % sz, i / sz, sz, s);
+                int to = PointIndex(x, y, sz);
+                point[s][i] = static_cast<int16_t>(to);
+                keys[s][2 * i] = Zobrist().black[to];
+                keys[s][2 * i + 1] = Zobrist().white[to];
+            }
+        }
+        for (int s = 0; s < symmetries; s++) {
+            for (int t = 0; t < symmetries; t++) {
+                if (undoes(s, t)) {
+                    inverse[s] = t;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Map returns the image of point i under symmetry s; noPoint maps to itself.
+    int Map(int i, int s) const { return i == noPoint ? noPoint : this->point[s][i]; }
+
+    // Key returns the Zobrist key of a stone at the image of point i.
+    uint64_t Key(int s, int i, Colour c) const {
+        if (c == Colour::EMPTY) {
+            return 0;
+        }
+        return this->keys[s][2 * i + (c == Colour::WHITE)];
+    }
+
+private:
+    bool undoes(int s, int t) const {
+        for (size_t i = 0; i < this->point[s].size(); i++) {
+            if (this->point[t][this->point[s][i]] != static_cast<int16_t>(i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Symmetries returns the shared symmetry table for a board size.
+inline const SymmetryTable &Symmetries(int size) {
+    static std::array<std::once_flag, maxBoardSize + 1> once;
+    static std::array<std::unique_ptr<SymmetryTable>, maxBoardSize + 1> tables;
+    std::call_once(once[size], [size] { tables[size] = std::make_unique<SymmetryTable>(size); });
+    return *tables[size];
+}
+
+// TransformPoint maps an SGF point through a symmetry. Values that are not a
+// point on the board, such as passes, are returned unchanged.
+inline std::string TransformPoint(std::string_view p, int size, int s) {
+    auto [x, y, onboard] = ParsePoint(p, size);
+    if (!onboard) {
+        return std::string(p);
+    }
+    auto [tx, ty] = SymmetryPoint(x, y, size, s);
+    return Point(tx, ty);
+}
+
+// TransformPointValue is TransformPoint for a value that may also be a
+// compressed rectangle ("aa:cc"), which is written back top left first.
+inline std::string TransformPointValue(std::string_view v, int size, int s) {
+    if (v.size() == 5 && v[2] == ':') {
+        auto [x1, y1, ok1] = ParsePoint(v.substr(0, 2), size);
+        auto [x2, y2, ok2] = ParsePoint(v.substr(3, 2), size);
+        if (!ok1 || !ok2) {
+            return std::string(v);
+        }
+        auto [ax, ay] = SymmetryPoint(x1, y1, size, s);
+        auto [bx, by] = SymmetryPoint(x2, y2, size, s);
+        return Point(std::min(ax, bx), std::min(ay, by)) + ":" + Point(std::max(ax, bx), std::max(ay, by));
+    }
+    return TransformPoint(v, size, s);
+}
+
+// CanonicalLineSymmetry returns the symmetry under which a sequence of moves,
+// given as point indexes with noPoint for passes, is smallest, comparing the
+// mapped indexes in order. Sequences that are symmetric to each other get the
+// same mapped sequence; ties go to the lowest symmetry.
+inline int CanonicalLineSymmetry(const std::vector<int> &moves, int size) {
+    const SymmetryTable &t = Symmetries(size);
+    int best = 0;
+    for (int s = 1; s < symmetries; s++) {
+        for (int m: moves) {
+            int a = t.Map(m, s);
+            int b = t.Map(m, best);
+            if (a != b) {
+                if (a < b) {
+                    best = s;
+                }
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+#endif // CONSOLEGO_SYMMETRY_H
@@ -1,4 +1,23 @@
 #include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <thread>
+#include <unistd.h>
+
+#include "binary.h"
+#include "board.h"
+#include "book.h"
+#include "concurrent.h"
+#include "cursor.h"
+#include "dedup.h"
+#include "estimate.h"
+#include "gamedb.h"
+#include "gtp.h"
+#include "io.h"
+#include "node.h"
+#include "score.h"
+#include "search.h"
 
 
 class GameTest : public ::testing::Test {
@@ -7,6 +26,1355 @@ protected:
     }
 };
 
+TEST_F(GameTest, BoardGetSet) {
+    Board board(19);
+    board.Set("dd", Colour::BLACK);
+    board.Set("pq", Colour::WHITE);
+    EXPECT_EQ(board.Get("dd"), Colour::BLACK);
+    EXPECT_EQ(board.Get("pq"), Colour::WHITE);
+    EXPECT_EQ(board.Get("qp"), Colour::EMPTY);
+    EXPECT_EQ(board.getFast("pq"), Colour::WHITE);
+    EXPECT_THROW(board.Get("tt"), std::invalid_argument);
+    board.Set("dd", Colour::EMPTY);
+    EXPECT_EQ(board.Get("dd"), Colour::EMPTY);
+}
+
+TEST_F(GameTest, BoardCopyEquals) {
+    Board board(52);
+    board.Set("ZZ", Colour::BLACK);
+    board.SetKo("aa");
+    auto copy = board.Copy();
+    EXPECT_TRUE(board.Equals(*copy));
+    EXPECT_EQ(copy->Get("ZZ"), Colour::BLACK);
+    EXPECT_EQ(copy->GetKo(), "aa");
+    copy->Set("ZZ", Colour::WHITE);
+    EXPECT_FALSE(board.Equals(*copy));
+    copy->Set("ZZ", Colour::BLACK);
+    copy->captureBy[Colour::WHITE] = 1;
+    EXPECT_FALSE(board.Equals(*copy));
+
+    // Copies share the chain table until they write to it, and then clone only
+    // the chunks they touch.
+    Board small(19);
+    small.PlayColour("dd", Colour::BLACK);
+    small.PlayColour("de", Colour::BLACK);
+    auto child = small.Copy();
+    EXPECT_LT(child->MemoryUsage(), small.MemoryUsage());
+    child->PlayColour("df", Colour::BLACK);
+    child->PlayColour("pp", Colour::WHITE);
+    EXPECT_EQ(child->Liberties("dd"), 8);
+    EXPECT_EQ(small.Liberties("dd"), 6);
+    EXPECT_EQ(small.Stones("dd").size(), 2u);
+    EXPECT_EQ(small.Liberties("pp"), 0);
+    EXPECT_LT(child->MemoryUsage(), small.MemoryUsage());
+}
+
+TEST_F(GameTest, BoardHashIsIncremental) {
+    Board a(19), b(19);
+    a.Set("dd", Colour::BLACK);
+    a.Set("pp", Colour::WHITE);
+    a.SetKo("cc");
+    a.SetPlayer(Colour::WHITE);
+    b.SetPlayer(Colour::WHITE);
+    b.SetKo("cc");
+    b.Set("pp", Colour::WHITE);
+    b.Set("dd", Colour::BLACK);
+    EXPECT_EQ(a.hash, b.hash);
+    EXPECT_TRUE(a.Equals(b));
+    EXPECT_EQ(a.Copy()->hash, a.hash);
+
+    a.ClearKo();
+    a.SetPlayer(Colour::BLACK);
+    b.Set("dd", Colour::EMPTY);
+    EXPECT_NE(a.hash, b.hash);
+    EXPECT_EQ(a.PositionHash(), b.PositionHash() ^ Zobrist().Stone(b.Index("dd"), Colour::BLACK));
+}
+
+TEST_F(GameTest, BoardSuperkoHistory) {
+    Board board(9);
+    board.RecordHistory();
+    board.Set("ee", Colour::BLACK);
+    board.SetPlayer(Colour::WHITE);
+    board.RecordHistory();
+    uint64_t empty = Board(9).PositionHash();
+    EXPECT_FALSE(board.Repeats(empty, Colour::BLACK));
+    board.superko = Superko::POSITIONAL;
+    EXPECT_TRUE(board.Repeats(empty, Colour::WHITE));
+    board.superko = Superko::SITUATIONAL;
+    EXPECT_TRUE(board.Repeats(empty, Colour::BLACK));
+    EXPECT_FALSE(board.Repeats(empty, Colour::WHITE));
+}
+
+TEST_F(GameTest, BoardCapturesAndKo) {
+    Board board(9);
+    // Black: b1 surround at ab, ba; White stone at aa is captured by ba.
+    board.PlayColour("ab", Colour::BLACK);
+    board.PlayColour("aa", Colour::WHITE);
+    EXPECT_EQ(board.Liberties("aa"), 1);
+    board.PlayColour("ba", Colour::BLACK);
+    EXPECT_EQ(board.Get("aa"), Colour::EMPTY);
+    EXPECT_EQ(board.captureBy[Colour::BLACK], 1);
+    EXPECT_FALSE(board.LegalColour("aa", Colour::WHITE)); // suicide
+
+    // A ko shape around dd / ed.
+    Board ko(9);
+    ko.PlayColour("dc", Colour::BLACK);
+    ko.PlayColour("ec", Colour::WHITE);
+    ko.PlayColour("cd", Colour::BLACK);
+    ko.PlayColour("fd", Colour::WHITE);
+    ko.PlayColour("de", Colour::BLACK);
+    ko.PlayColour("ee", Colour::WHITE);
+    ko.PlayColour("ed", Colour::BLACK);
+    ko.PlayColour("dd", Colour::WHITE);
+    EXPECT_EQ(ko.Get("ed"), Colour::EMPTY);
+    EXPECT_EQ(ko.GetKo(), "ed");
+    EXPECT_FALSE(ko.Legal("ed"));
+    ko.PlayColour("aa", Colour::BLACK);
+    ko.PlayColour("ab", Colour::WHITE);
+    EXPECT_TRUE(ko.Legal("ed"));
+}
+
+TEST_F(GameTest, BoardChainsMatchFloodFill) {
+    std::mt19937 rng(42);
+    Board board(9);
+    for (int ply = 0; ply < 400; ply++) {
+        std::vector<int> legal;
+        for (int i = 0; i < 81; i++) {
+            if (board.legal(i, board.player)) {
+                legal.push_back(i);
+            }
+        }
+        if (legal.empty()) {
+            board.Pass();
+            continue;
+        }
+        board.playMove(legal[rng() % legal.size()], board.player);
+        for (int i = 0; i < 81; i++) {
+            Colour c = board.At(i);
+            if (c == Colour::EMPTY) {
+                continue;
+            }
+            std::vector<int> stack{i};
+            std::vector<bool> seen(81), lib(81);
+            seen[i] = true;
+            int libs = 0, stones = 0;
+            while (!stack.empty()) {
+                int s = stack.back();
+                stack.pop_back();
+                stones++;
+                ASSERT_EQ(board.chains[s].head, board.chains[i].head);
+                const Adjacent &adj = (*board.nbr)[s];
+                for (int k = 0; k < adj.count; k++) {
+                    int n = adj.n[k];
+                    if (board.At(n) == Colour::EMPTY && !lib[n]) {
+                        lib[n] = true;
+                        libs++;
+                    } else if (board.At(n) == c && !seen[n]) {
+                        seen[n] = true;
+                        stack.push_back(n);
+                    }
+                }
+            }
+            ASSERT_EQ(board.libsOf(i), libs);
+            ASSERT_EQ(board.chains[board.chains[i].head].stones, stones);
+        }
+    }
+}
+
+TEST_F(GameTest, BitboardKernels) {
+    std::mt19937_64 rng(7);
+    std::vector<const BitboardKernels *> kernels{&ScalarKernels()};
+    if (AVX2Kernels()) {
+        kernels.push_back(AVX2Kernels());
+    }
+    for (int size: {1, 2, 8, 9, 13, 19, 25, 52}) {
+        const EdgeMasks &e = Edges(size);
+        const NeighbourTable &nbr = Neighbours(size);
+        int points = size * size;
+        for (int round = 0; round < 20; round++) {
+            Bitboard x, within;
+            for (int i = 0; i < points; i++) {
+                if (rng() % 8 == 0) {
+                    x.Set(i);
+                }
+                if (rng() % 3 != 0) {
+                    within.Set(i);
+                }
+            }
+            Bitboard dilated = x;
+            for (int i = 0; i < points; i++) {
+                for (int k = 0; x.Test(i) && k < nbr[i].count; k++) {
+                    dilated.Set(nbr[i].n[k]);
+                }
+            }
+            Bitboard seed;
+            for (int w = 0; w < e.nwords; w++) {
+                seed.words[w] = x.words[w] & within.words[w];
+            }
+            Bitboard filled = seed;
+            std::vector<int> stack;
+            for (int i = 0; i < points; i++) {
+                if (seed.Test(i)) {
+                    stack.push_back(i);
+                }
+            }
+            while (!stack.empty()) {
+                int i = stack.back();
+                stack.pop_back();
+                for (int k = 0; k < nbr[i].count; k++) {
+                    int n = nbr[i].n[k];
+                    if (within.Test(n) && !filled.Test(n)) {
+                        filled.Set(n);
+                        stack.push_back(n);
+                    }
+                }
+            }
+            for (auto *k: kernels) {
+                SCOPED_TRACE(std::string(k->name) + " size " + std::to_string(size));
+                ASSERT_TRUE(k->dilate(x, e).Equals(dilated, bitboardWords));
+                ASSERT_TRUE(k->floodFill(seed, within, e).Equals(filled, bitboardWords));
+            }
+        }
+    }
+
+    Board board(9);
+    for (auto p: {"ba", "ab", "ca", "ac"}) {
+        board.Set(p, Colour::BLACK);
+    }
+    board.Set("bb", Colour::WHITE);
+    EXPECT_EQ(board.koSquareFinder("ba"), "aa");
+    EXPECT_EQ(board.koSquareFinder("ab"), "aa");
+    EXPECT_THROW(board.koSquareFinder("bb"), std::invalid_argument);
+    EXPECT_THROW(board.koSquareFinder("ee"), std::invalid_argument);
+}
+
+TEST_F(GameTest, NodeGetBoardReplaysFromCheckpoints) {
+    auto root = std::make_shared<Node>();
+    root->SetValue("SZ", "9");
+    root->SetBoardCache(8, 4 * Board(9).MemoryUsage());
+
+    std::mt19937 rng(7);
+    Board expected(9);
+    std::vector<std::shared_ptr<Node>> line{root};
+    std::vector<uint64_t> hashes{expected.hash};
+    for (int ply = 0; ply < 120; ply++) {
+        std::vector<int> legal;
+        for (int i = 0; i < 81; i++) {
+            if (expected.legal(i, expected.player)) {
+                legal.push_back(i);
+            }
+        }
+        if (legal.empty()) {
+            break;
+        }
+        int mv = legal[rng() % legal.size()];
+        line.push_back(line.back()->Play(expected.PointName(mv)));
+        expected.playMove(mv, expected.player);
+        hashes.push_back(expected.hash);
+    }
+
+    int cached = 0;
+    for (auto &node: line) {
+        cached += node->board != nullptr;
+    }
+    EXPECT_LE(cached, (int) line.size() / 8 + 1 + 4);
+
+    for (int i = (int) line.size() - 1; i >= 0; i -= 13) {
+        auto b = line[i]->GetBoard();
+        EXPECT_EQ(b->hash, hashes[i]);
+        EXPECT_EQ(b->step, i);
+    }
+    EXPECT_LE(root->boardCache()->bytes, 4 * Board(9).MemoryUsage());
+
+    line[1]->SetValue("B", "ee");
+    for (size_t i = 1; i < line.size(); i++) {
+        EXPECT_EQ(line[i]->board, nullptr);
+    }
+}
+
+TEST_F(GameTest, LoadSGFCollection) {
+    auto roots = LoadSGFCollection("junk (;GM[1]SZ[9]C[a \\] b\\\\];B[ee](;W[cc];B[dd])(;W[gg]))\n"
+                                   "(;SZ[19]AddBlack[aa][bb]AW[cc:dd])");
+    ASSERT_EQ(roots.size(), 2u);
+    auto root = roots[0];
+    EXPECT_EQ(root->GetValue("C"), "a ] b\\");
+    EXPECT_EQ(root->RootBoardSize(), 9);
+    auto b = root->MainChild();
+    ASSERT_NE(b, nullptr);
+    EXPECT_EQ(b->GetValue("B"), "ee");
+    ASSERT_EQ(b->children.size(), 2u);
+    EXPECT_EQ(b->children[0]->GetValue("W"), "cc");
+    EXPECT_EQ(b->children[0]->MainChild()->GetValue("B"), "dd");
+    EXPECT_EQ(b->children[1]->GetValue("W"), "gg");
+    EXPECT_EQ(b->children[0]->MainChild()->GetBoard()->Get("cc"), Colour::WHITE);
+
+    EXPECT_EQ(roots[1]->AllValues("AB"), (std::vector<std::string>{"aa", "bb"}));
+    auto board = roots[1]->GetBoard();
+    EXPECT_EQ(board->Get("dd"), Colour::WHITE);
+    EXPECT_EQ(board->Get("bb"), Colour::BLACK);
+
+    EXPECT_THROW(LoadSGF("(;B[aa]"), std::runtime_error);
+    EXPECT_THROW(LoadSGF("(;SZ[99])"), std::runtime_error);
+}
+
+TEST_F(GameTest, ArenaTreeKeepsNodeAPI) {
+    std::weak_ptr<NodeArena> weak;
+    {
+        auto arena = NodeArena::Create();
+        weak = arena;
+        auto root = LoadSGF("(;SZ[9];B[ee](;W[cc];B[dd])(;W[gg]))", arena);
+        arena.reset();
+        EXPECT_FALSE(weak.expired());
+        EXPECT_NE(root->arena, nullptr);
+        EXPECT_EQ(root->TreeSize(), 5);
+
+        auto b = root->MainChild();
+        auto gg = b->LastChild();
+        EXPECT_EQ(gg->GetValue("W"), "gg");
+        EXPECT_EQ(gg->Parent(), b);
+        EXPECT_EQ(gg->GetRoot(), root);
+        EXPECT_EQ(gg->GetLine().size(), 3u);
+        EXPECT_EQ(root->GetEnd()->GetValue("W"), "gg");
+
+        gg->MakeMainLine();
+        EXPECT_EQ(b->MainChild(), gg);
+        auto dd = b->Play("dd");
+        EXPECT_EQ(dd->arena, root->arena);
+        EXPECT_EQ(b->Children().size(), 3u);
+        EXPECT_EQ(dd->GetBoard()->Get("ee"), Colour::BLACK);
+
+        dd->SetParent(gg);
+        EXPECT_EQ(gg->MainChild(), dd);
+        EXPECT_EQ(b->Children().size(), 2u);
+        EXPECT_THROW(b->SetParent(dd), std::runtime_error);
+        EXPECT_THROW(dd->SetParent(std::make_shared<Node>()), std::runtime_error);
+        EXPECT_EQ(root->SubtreeNodes().size(), 6u);
+    }
+    EXPECT_TRUE(weak.expired());
+}
+
+TEST_F(GameTest, InternedPropertyKeys) {
+    EXPECT_EQ(InternKey("B"), Key::B);
+    EXPECT_EQ(InternKey("SZ"), Key::SZ);
+    EXPECT_EQ(KeyName(Key::AB), "AB");
+    auto custom = InternKey("MULTIGOGM");
+    EXPECT_EQ(InternKey("MULTIGOGM"), custom);
+    EXPECT_EQ(KeyName(custom), "MULTIGOGM");
+
+    auto node = std::make_shared<Node>();
+    std::string comment(100, 'x');
+    node->AddValue("C", comment);
+    node->AddValue(Key::AB, "aa");
+    node->AddValue(Key::AB, "bb");
+    node->AddValue(Key::AB, "aa");
+    node->AddValue(Key::AB, "cc");
+    node->SetValue("MULTIGOGM", "1");
+    EXPECT_EQ(node->GetValue(Key::C), comment);
+    EXPECT_EQ(node->ValueCount("AB"), 3);
+    EXPECT_EQ(node->AllKeys(), (std::vector<std::string>{"C", "AB", "MULTIGOGM"}));
+    node->DeleteValue("AB", "bb");
+    EXPECT_EQ(node->AllValues(Key::AB), (std::vector<std::string>{"aa", "cc"}));
+    node->DeleteValue("AB", "aa");
+    node->DeleteValue("AB", "cc");
+    EXPECT_EQ(node->ValueCount(Key::AB), 0);
+    EXPECT_EQ(node->KeyCount(), 2);
+    EXPECT_EQ(node->WriteTo(), ";C[" + comment + "]MULTIGOGM[1]");
+
+    auto copy = node->Copy();
+    node->DeleteKey(Key::C);
+    EXPECT_EQ(copy->GetValueView(Key::C), comment);
+}
+
+TEST_F(GameTest, SaveRoundTrip) {
+    std::string sgf = "(;GM[1]SZ[9]C[a \\] b\\\\];B[ee](;W[cc];B[dd](;W[aa])(;W[bb]))(;W[gg]))";
+    auto root = LoadSGF(sgf);
+    EXPECT_EQ(root->Save(), sgf);
+    EXPECT_EQ(root->MainChild()->LastChild()->Save(), sgf);
+    EXPECT_EQ(root->SaveCollection({root, nullptr, LoadSGF("(;B[aa])")}), sgf + "\n(;B[aa])");
+
+    std::ostringstream os;
+    WriteSGF(os, root);
+    EXPECT_EQ(os.str(), sgf);
+    EXPECT_EQ(LoadSGF(os.str(), NodeArena::Create())->Save(), sgf);
+
+    // A long main line is written iteratively.
+    auto node = NodeArena::Create()->NewRoot();
+    auto deep = node;
+    for (int i = 0; i < 200000; i++) {
+        deep = Node::NewNode(deep);
+        deep->appendValue(i % 2 ? Key::W : Key::B, "aa");
+    }
+    auto big = node->Save();
+    EXPECT_EQ(big.size(), 2 + 200000 * 6 + 1);
+}
+
+TEST_F(GameTest, LoadBulk) {
+    auto trees = SplitSGFCollection("junk(;C[a (b\\] c)](;B[aa])(;W[bb])) x (;B[cc])(;W[dd]");
+    ASSERT_EQ(trees.size(), 3u);
+    EXPECT_EQ(trees[1], "(;B[cc])");
+    EXPECT_EQ(trees[2], "(;W[dd]");
+
+    auto dir = std::filesystem::temp_directory_path() / ("bulk_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(dir / "sub");
+    std::string big;
+    for (int g = 0; g < 300; g++) {
+        big += "(;GN[" + std::to_string(g) + "];B[aa];W[bb])\n";
+    }
+    std::ofstream(dir / "a.sgf") << big;
+    std::ofstream(dir / "sub" / "b.SGF") << "(;B[aa])(;SZ[99])(;W[cc])(;SZ[99])";
+    std::ofstream(dir / "notes.txt") << "(;B[aa])";
+
+    auto files = FindSGFFiles({dir.string(), (dir / "missing.sgf").string()});
+    ASSERT_EQ(files.size(), 3u);
+    EXPECT_EQ(std::filesystem::path(files[0]).filename(), "a.sgf");
+    EXPECT_EQ(std::filesystem::path(files[1]).filename(), "b.SGF");
+
+    BulkOptions opts;
+    opts.threads = 4;
+    opts.gamesPerTask = 7;
+    auto results = LoadBulk(files, opts);
+    ASSERT_EQ(results.size(), 3u);
+    ASSERT_EQ(results[0].games.size(), 300u);
+    EXPECT_TRUE(results[0].errors.empty());
+    for (int g = 0; g < 300; g++) {
+        EXPECT_EQ(results[0].games[g]->GetValue("GN"), std::to_string(g));
+    }
+    ASSERT_EQ(results[1].games.size(), 2u);
+    EXPECT_EQ(results[1].games[1]->GetValue("W"), "cc");
+    ASSERT_EQ(results[1].errors.size(), 2u);
+    EXPECT_EQ(results[1].errors[0].game, 1u);
+    EXPECT_EQ(results[1].errors[0].Message().rfind("game 2: SGF: board size", 0), 0u);
+    EXPECT_EQ(results[1].errors[1].game, 3u);
+    EXPECT_TRUE(results[2].games.empty());
+    ASSERT_EQ(results[2].errors.size(), 1u);
+    EXPECT_EQ(results[2].errors[0].game, noGame);
+
+    std::filesystem::remove_all(dir);
+}
+
+TEST_F(GameTest, DedupIndex) {
+    std::string moves;
+    for (int i = 0; i < 80; i++) {
+        moves += std::string(i % 2 ? ";W[" : ";B[") + alpha[i % 19] + alpha[i / 19] + "]";
+    }
+    auto game = "(;SZ[19]C[root];C[no move]" + moves + ")";
+    auto root = LoadSGF(game);
+    // Moves 20, 40, 60, 31, 51 and 71 are the 0-based moves 19, 39, 59, 30, 50, 70.
+    EXPECT_EQ(root->Dyer(), "19abbccdlbmcnd");
+    EXPECT_EQ(LoadSGF("(;SZ[9];B[aa];W[])")->Dyer(), "9????????????");
+
+    auto dir = std::filesystem::temp_directory_path() / ("dedup_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(dir);
+    auto indexPath = (dir / "index.bin").string();
+    std::ofstream(dir / "a.sgf") << game << "(;SZ[19];B[aa])";
+    std::ofstream(dir / "b.sgf") << "(;SZ[19]PB[x]" << moves << ")(;SZ[19];B[bb])";
+
+    auto index = DedupIndex::Load(indexPath);
+    auto update = index.Update({dir.string()});
+    EXPECT_EQ(update.filesHashed, 2u);
+    EXPECT_EQ(update.gamesAdded, 4u);
+    auto clusters = index.Clusters();
+    ASSERT_EQ(clusters.size(), 1u);
+    ASSERT_EQ(clusters[0].size(), 2u);
+    EXPECT_EQ(index.Files()[clusters[0][0].file].path, (dir / "a.sgf").string());
+    EXPECT_EQ(clusters[0][0].game, 0u);
+    EXPECT_EQ(clusters[0][1].game, 0u);
+    EXPECT_EQ(index.Lookup(SignGame(*root)).size(), 2u);
+    index.Save(indexPath);
+
+    // Only new files are hashed on the next run.
+    std::ofstream(dir / "c.sgf") << "(;SZ[19];B[aa])";
+    auto again = DedupIndex::Load(indexPath);
+    EXPECT_EQ(again.Records().size(), 4u);
+    update = again.Update({dir.string()});
+    EXPECT_EQ(update.filesHashed, 1u);
+    EXPECT_EQ(again.Clusters().size(), 2u);
+    EXPECT_EQ(again.Update({dir.string()}).filesHashed, 0u);
+
+    // A renamed file is hashed under its new path and its old path is dropped,
+    // so it is not a duplicate of itself; a deleted file is dropped too.
+    std::filesystem::rename(dir / "a.sgf", dir / "d.sgf");
+    update = again.Update({dir.string()});
+    EXPECT_EQ(update.filesDropped, 1u);
+    EXPECT_EQ(update.filesHashed, 1u);
+    EXPECT_EQ(again.Files().size(), 3u);
+    EXPECT_EQ(again.Records().size(), 5u);
+    for (auto &cluster: again.Clusters()) {
+        ASSERT_EQ(cluster.size(), 2u);
+        EXPECT_NE(again.Files()[cluster[0].file].path, again.Files()[cluster[1].file].path);
+    }
+    EXPECT_EQ(again.Clusters().size(), 2u);
+    std::filesystem::remove(dir / "c.sgf");
+    update = again.Update({dir.string()});
+    EXPECT_EQ(update.filesDropped, 1u);
+    EXPECT_EQ(update.filesHashed, 0u);
+    EXPECT_EQ(again.Records().size(), 4u);
+    ASSERT_EQ(again.Clusters().size(), 1u);
+    EXPECT_EQ(again.Files()[again.Clusters()[0][1].file].path, (dir / "d.sgf").string());
+
+    // A file that cannot be read is tried again on the next run.
+    std::ofstream(dir / "b.sgf") << "no game here";
+    update = again.Update({dir.string()});
+    ASSERT_EQ(update.errors.size(), 1u);
+    EXPECT_EQ(again.Records().size(), 2u);
+    EXPECT_EQ(again.Update({dir.string()}).filesHashed, 1u);
+
+    std::filesystem::remove_all(dir);
+}
+
+TEST_F(GameTest, Symmetry) {
+    for (int size: {1, 9, 19}) {
+        const SymmetryTable &t = Symmetries(size);
+        for (int s = 0; s < symmetries; s++) {
+            for (int i = 0; i < size * size; i++) {
+                ASSERT_EQ(t.Map(t.Map(i, s), t.inverse[s]), i);
+            }
+        }
+    }
+
+    std::mt19937 rng(5);
+    Board board(9);
+    board.TrackSymmetries();
+    for (int ply = 0; ply < 120; ply++) {
+        std::vector<int> legal;
+        for (int i = 0; i < 81; i++) {
+            if (board.legal(i, board.player)) {
+                legal.push_back(i);
+            }
+        }
+        board.Apply(legal.empty() ? noPoint : legal[rng() % legal.size()], board.player);
+        if (ply % 7 == 6) {
+            board.Undo();
+        }
+        auto hashes = board.SymmetryHashes();
+        ASSERT_EQ(hashes[0], board.PositionHash());
+        auto untracked = board.Copy();
+        untracked->symmetry = nullptr;
+        ASSERT_EQ(untracked->SymmetryHashes(), hashes);
+        if (ply % 10 != 0) {
+            continue;
+        }
+        for (int s = 0; s < symmetries; s++) {
+            auto moved = board.Transformed(s);
+            ASSERT_EQ(moved->PositionHash(), hashes[s]);
+            ASSERT_EQ(moved->CanonicalHash(), board.CanonicalHash());
+            ASSERT_EQ(moved->Liberties(moved->PointName(Symmetries(9).Map(legal[0], s))),
+                      board.Liberties(board.PointName(legal[0])));
+            ASSERT_TRUE(moved->Transformed(Symmetries(9).inverse[s])->Equals(board));
+        }
+    }
+    EXPECT_THROW(board.Transformed(8), std::invalid_argument);
+
+    // The same opening in all eight orientations has one canonical main line.
+    auto opening = LoadSGF("(;SZ[19];B[pd];W[dp];B[pq];W[dd](;B[fq]LB[fq:A])(;B[qk]AR[aa:cb]AB[ab:bc]))");
+    std::vector<int> canonical;
+    for (int s = 0; s < symmetries; s++) {
+        auto copy = LoadSGF(opening->Save());
+        copy->Transform(s);
+        EXPECT_EQ(copy->Dyer(), opening->Dyer(s));
+        copy->Transform(copy->MainLineSymmetry());
+        if (s == 0) {
+            canonical = copy->MainLineMoves();
+        }
+        EXPECT_EQ(copy->MainLineMoves(), canonical);
+    }
+    EXPECT_EQ(canonical.size(), 5u);
+    auto copy = LoadSGF(opening->Save());
+    copy->Transform(3);
+    EXPECT_EQ(copy->Save(), "(;SZ[19];B[dp];W[pd];B[dc];W[pp](;B[nc]LB[nc:A])(;B[ci]AR[ss:qr]AB[rq:sr]))");
+    copy->Transform(3);
+    EXPECT_EQ(copy->Save(), opening->Save());
+
+    // Rotated and mirrored copies of a game have the same dedup signature.
+    auto game = LoadSGF("(;SZ[19];B[pd];W[dp];B[pq];W[dd];B[fq];W[cn];B[jp];W[qf];B[nc];W[rd])");
+    auto sig = SignGame(*game);
+    for (int s = 1; s < symmetries; s++) {
+        auto moved = LoadSGF(game->Save());
+        moved->Transform(s);
+        auto other = SignGame(*moved);
+        EXPECT_EQ(other.dyer, sig.dyer);
+        EXPECT_EQ(other.position, sig.position);
+    }
+}
+
+TEST_F(GameTest, OpeningBook) {
+    // The first three games are one opening: the second by another move
+    // order, the third mirrored.
+    std::vector<std::string> games{
+            "(;SZ[9]RE[B+R];B[cc];W[gg];B[cg];W[gc];B[ee])",
+            "(;SZ[9]RE[W+1.5];B[cg];W[gc];B[cc];W[gg])",
+            "(;SZ[9]RE[B+2];B[gc];W[cg];B[gg];W[cc])",
+            "(;SZ[9];B[ee];C[no move];W[cc])",
+            "(;SZ[19];B[pd])",
+            "(;SZ[9]HA[2]AB[cc][gg];W[ee])",
+    };
+    OpeningBook book(9);
+    for (auto &g: games) {
+        book.Add(*LoadSGF(g));
+    }
+    EXPECT_EQ(book.Games(), 4u);
+    EXPECT_EQ(book.Skipped(), 2u);
+    // The empty board, one to four corners, the extra tengen, and the two
+    // positions of the fourth game.
+    EXPECT_EQ(book.Positions(), 8u);
+
+    Board board(9);
+    auto moves = book.Moves(board);
+    ASSERT_EQ(moves.size(), 2u);
+    EXPECT_EQ(board.PointName(moves[0].point), "cc");
+    EXPECT_EQ(moves[0].colour, Colour::BLACK);
+    EXPECT_EQ(moves[0].games, 3u);
+    EXPECT_EQ(moves[0].blackWins, 2u);
+    EXPECT_EQ(moves[0].whiteWins, 1u);
+    EXPECT_EQ(board.PointName(moves[1].point), "ee");
+
+    // The moves come back in the orientation of the board asked about.
+    board.Play("gc");
+    board.Play("cg");
+    moves = book.Moves(board);
+    ASSERT_EQ(moves.size(), 1u);
+    EXPECT_TRUE(moves[0].point == board.Index("cc") || moves[0].point == board.Index("gg"));
+    board.Play(board.PointName(moves[0].point));
+    board.Play(board.PointName(book.Moves(board)[0].point));
+    ASSERT_NE(book.Find(board), nullptr);
+    EXPECT_EQ(book.Find(board)->games, 3u);
+    EXPECT_EQ(book.Find(board)->edges.size(), 1u);
+
+    auto exported = book.Export(10, 2);
+    std::vector<std::string> line;
+    for (Node *node: exported->MainLine()) {
+        for (PropKey key: {Key::B, Key::W}) {
+            if (node->key_index(key) != -1) {
+                line.push_back(node->GetValue(key));
+            }
+        }
+    }
+    EXPECT_EQ(line.size(), 4u);
+    EXPECT_EQ(exported->SubtreeSize(), 5u);
+    EXPECT_EQ(exported->MainChild()->GetValue(Key::C), "games 3, black wins 2, white wins 1");
+    EXPECT_EQ(exported->GetEnd()->GetBoard()->CanonicalHash(), board.CanonicalHash());
+    EXPECT_EQ(book.Export(10)->SubtreeSize(), 8u);
+
+    // Files are merged in parallel into the same positions.
+    auto dir = std::filesystem::temp_directory_path() / ("book_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(dir);
+    for (int f = 0; f < 4; f++) {
+        std::ofstream out(dir / ("games" + std::to_string(f) + ".sgf"));
+        for (int g = 0; g < 50; g++) {
+            out << games[g % 4] << "\n";
+        }
+    }
+    OpeningBook merged(9);
+    BulkOptions opts;
+    opts.threads = 4;
+    opts.gamesPerTask = 8;
+    EXPECT_TRUE(merged.AddFiles({dir.string()}, opts).empty());
+    EXPECT_EQ(merged.Games(), 200u);
+    EXPECT_EQ(merged.Positions(), 8u);
+    EXPECT_EQ(merged.Moves(Board(9))[0].games, 152u);
+    std::filesystem::remove_all(dir);
+}
+
+TEST_F(GameTest, SharedTreeStress) {
+    auto root = NodeArena::Create()->NewRoot();
+    root->SetValue(Key::SZ, "9");
+    SharedTree tree(root);
+
+    // Readers walk the whole tree over and over while the writer adds moves
+    // and rewrites comments. A comment is "move <depth>" and a run of dots,
+    // long enough to live on the heap, so a torn one would show.
+    std::atomic<bool> done{false};
+    std::atomic<int> failures{0};
+    std::atomic<int> walks{0};
+    auto reader = [&] {
+        size_t lastSeen = 0;
+        SharedTree::Reader r(tree);
+        do {
+            size_t seen = 0;
+            std::vector<SharedNode> stack{r.Root()};
+            SharedNode deepest = stack[0];
+            while (!stack.empty()) {
+                SharedNode n = stack.back();
+                stack.pop_back();
+                seen++;
+                if (n.Depth() > deepest.Depth()) {
+                    deepest = n;
+                }
+                auto c = n.GetValueView(Key::C);
+                std::string prefix = "move " + std::to_string(n.Depth());
+                if (!c.empty() && (c.substr(0, prefix.size()) != prefix ||
+                                   c.find_first_not_of('.', prefix.size()) != std::string_view::npos)) {
+                    failures++;
+                }
+                for (size_t i = 0; i < n.ChildCount(); i++) {
+                    SharedNode child = n.Child(i);
+                    if (child.Depth() != n.Depth() + 1 || !child.Parent().Same(n) || child.AllKeys().empty()) {
+                        failures++;
+                    }
+                    stack.push_back(child);
+                }
+            }
+            if (deepest.GetBoard()->size != 9) {
+                failures++;
+            }
+            // The writer only ever adds nodes.
+            if (seen < lastSeen) {
+                failures++;
+            }
+            lastSeen = seen;
+            walks++;
+            r.Repin();
+        } while (!done);
+    };
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; i++) {
+        readers.emplace_back(reader);
+    }
+
+    std::mt19937 rng(11);
+    std::vector<std::shared_ptr<Node>> nodes{root};
+    for (int k = 0; k < 3000; k++) {
+        auto at = nodes[rng() % nodes.size()];
+        if (k % 3 == 0) {
+            std::string comment = "move " + std::to_string(at->depth) + std::string(k % 40, '.');
+            tree.SetValue(*at, Key::C, comment);
+        } else {
+            auto child = tree.PlayColour(*at, Point(rng() % 9, rng() % 9), k % 2 ? Colour::WHITE : Colour::BLACK,
+                                         false);
+            nodes.push_back(child);
+        }
+        if (k == 1500) {
+            tree.Write([](Node &r) { r.SetValue(Key::PB, "writer"); });
+        }
+    }
+    done = true;
+    for (auto &t: readers) {
+        t.join();
+    }
+    EXPECT_EQ(failures, 0);
+    EXPECT_GE(walks, 4);
+
+    SharedTree::Reader r(tree);
+    EXPECT_EQ(r.Root().GetValueView(Key::PB), "writer");
+    size_t count = 0;
+    std::vector<SharedNode> stack{r.Root()};
+    while (!stack.empty()) {
+        SharedNode n = stack.back();
+        stack.pop_back();
+        count++;
+        for (size_t i = 0; i < n.ChildCount(); i++) {
+            stack.push_back(n.Child(i));
+        }
+    }
+    EXPECT_EQ(count, root->SubtreeSize());
+    Node *end = root.get();
+    while (Node *child = end->firstChild()) {
+        end = child;
+    }
+    SharedNode view = r.Root();
+    while (view.ChildCount()) {
+        view = view.Child(0);
+    }
+    EXPECT_TRUE(view.GetBoard()->Equals(*end->GetBoard()));
+
+    // Deleted nodes leave the published tree, and a view taken before stays
+    // readable while its reader lives.
+    SharedNode first = r.Root().Child(0);
+    tree.Write([](Node &r) { r.firstChild()->DeleteChildren(); });
+    EXPECT_GT(first.ChildCount(), 0u);
+    EXPECT_EQ(first.Refresh().ChildCount(), 0u);
+    EXPECT_GT(tree.Pending(), 0u);
+    EXPECT_THROW(tree.AddValue(*Node::NewNode(nullptr), Key::C, "x"), std::invalid_argument);
+}
+
+TEST_F(GameTest, SharedTreeRepin) {
+    // A reader that stays alive holds back every version retired since it
+    // pinned, until it repins.
+    auto root = NodeArena::Create()->NewRoot();
+    SharedTree tree(root);
+    SharedTree::Reader reader(tree);
+    for (int k = 0; k < 100; k++) {
+        tree.SetValue(*root, Key::C, std::to_string(k));
+    }
+    EXPECT_EQ(tree.Pending(), 100u);
+    for (int k = 100; k < 1100; k++) {
+        reader.Repin();
+        ASSERT_EQ(reader.Root().GetValueView(Key::C), std::to_string(k - 1));
+        tree.SetValue(*root, Key::C, std::to_string(k));
+        ASSERT_LE(tree.Pending(), 1u);
+    }
+
+    // A node made in a write never takes over the slot of one deleted in it,
+    // even if it is made at the same address.
+    auto heap = Node::NewNode(nullptr);
+    Node::NewNode(heap)->SetValue(Key::C, "old");
+    SharedTree heapTree(heap);
+    SharedTree::Reader heapReader(heapTree);
+    SharedNode old = heapReader.Root().Child(0);
+    heapTree.Write([](Node &r) {
+        r.DeleteChildren();
+        Node::NewNode(r.self())->SetValue(Key::C, "new");
+    });
+    SharedNode made = heapReader.Root().Child(0);
+    EXPECT_EQ(made.GetValueView(Key::C), "new");
+    EXPECT_FALSE(old.Same(made));
+    EXPECT_EQ(old.Refresh().GetValueView(Key::C), "old");
+}
+
+TEST_F(GameTest, GameSearch) {
+    auto games = LoadSGFCollection("(;SZ[9];B[cc];W[gg](;B[cd];W[dc])(;B[gc];W[cd]))"
+                                   "(;SZ[9];B[cd];W[gg];B[cc])"
+                                   "(;SZ[13];B[cc];W[gg];B[cd];W[dc])");
+    GameSearch search(games, 2);
+    EXPECT_EQ(search.Games(), 3u);
+    EXPECT_EQ(search.Positions(), 7u + 4u + 5u);
+
+    // After B[cc] W[gg] B[cd] W[dc] on 9x9: found in the first variation only.
+    auto target = games[0]->MainChild()->MainChild()->MainChild()->MainChild()->GetBoard();
+    auto hits = search.FindPosition(*target);
+    ASSERT_EQ(hits.size(), 1u);
+    EXPECT_EQ(hits[0].game, 0u);
+    EXPECT_EQ(hits[0].path, (std::vector<uint32_t>{0, 0, 0, 0}));
+
+    // Transposed move orders reach the same stones.
+    auto three = games[1]->GetEnd()->GetBoard();
+    hits = search.FindPosition(*three);
+    ASSERT_EQ(hits.size(), 2u);
+    EXPECT_EQ(hits[0].path, (std::vector<uint32_t>{0, 0, 0}));
+    EXPECT_EQ(hits[1].game, 1u);
+
+    auto p = Pattern::Parse("X?/X./??");
+    EXPECT_EQ(p.Width(), 2);
+    EXPECT_EQ(p.Height(), 3);
+    EXPECT_THROW(Pattern::Parse("X?/X"), std::invalid_argument);
+    EXPECT_THROW(Pattern::Parse("XZ"), std::invalid_argument);
+    hits = search.FindPattern(p);
+    // Each shape is reported where it first appears, not again in later nodes.
+    ASSERT_EQ(hits.size(), 3u);
+    EXPECT_EQ(hits[0].path, (std::vector<uint32_t>{0, 0, 0}));
+    EXPECT_EQ(hits[0].x, 2);
+    EXPECT_EQ(hits[0].y, 2);
+    EXPECT_EQ(hits[1].game, 1u);
+    EXPECT_EQ(hits[1].path, (std::vector<uint32_t>{0, 0, 0}));
+    EXPECT_EQ(hits[2].game, 2u);
+    EXPECT_EQ(search.FindPattern(Pattern::Parse("X/X/X")).size(), 0u);
+    EXPECT_EQ(search.FindPattern(Pattern::Parse("X/O")).size(), 1u);
+    EXPECT_TRUE(search.FindPattern(Pattern::Parse("OOO")).empty());
+}
+
+TEST_F(GameTest, EstimateOwnership) {
+    // Black walls off the left side of a 9x9 board and white the right.
+    Board board(9);
+    board.km = 6.5f;
+    for (int y = 0; y < 9; y++) {
+        board.Set(Point(3, y), Colour::BLACK);
+        board.Set(Point(5, y), Colour::WHITE);
+    }
+    EstimateOptions opts;
+    opts.playouts = 200;
+    opts.threads = 3;
+    EXPECT_EQ(Estimate(board, opts), 200);
+    EXPECT_GT(board.ownership[PointIndex(0, 0, 9)], 0.5f);
+    EXPECT_LT(board.ownership[PointIndex(8, 8, 9)], -0.5f);
+    EXPECT_GT(board.bScore, 27.0f);
+    EXPECT_GT(board.wScore, 27.0f + 6.5f);
+    EXPECT_LE(board.bScore + board.wScore - 6.5f, 81.0f);
+    EXPECT_LT(board.controversyCount, 27);
+
+    // The result does not depend on how playouts were spread over threads.
+    std::vector<float> first = board.ownership;
+    opts.threads = 1;
+    Estimate(board, opts);
+    EXPECT_EQ(board.ownership, first);
+
+    // The position itself is left alone.
+    EXPECT_EQ(board.At(PointIndex(4, 4, 9)), Colour::EMPTY);
+    EXPECT_EQ(board.player, Colour::BLACK);
+
+    opts.playouts = 1000000;
+    opts.deadline = std::chrono::milliseconds(20);
+    EXPECT_LT(Estimate(board, opts), 1000000);
+}
+
+TEST_F(GameTest, ScoreGame) {
+    // 5x5: black owns columns a-b, white d-e, with a white stone dead at aa and
+    // one black stone captured earlier.
+    Board board(5);
+    board.km = 0.5f;
+    for (int y = 0; y < 5; y++) {
+        board.Set(Point(1, y), Colour::BLACK);
+        board.Set(Point(3, y), Colour::WHITE);
+    }
+    board.Set("aa", Colour::WHITE);
+    board.captureBy[Colour::WHITE] = 1;
+    Bitboard dead;
+    dead.Set(PointIndex(0, 0, 5));
+
+    auto area = ScoreBoard(board, ScoringRule::AREA, dead);
+    EXPECT_EQ(area.blackStones, 5);
+    EXPECT_EQ(area.blackTerritory, 5);
+    EXPECT_EQ(area.whiteTerritory, 5);
+    EXPECT_EQ(area.dame, 5);
+    EXPECT_FLOAT_EQ(area.black, 10.0f);
+    EXPECT_FLOAT_EQ(area.white, 10.5f);
+    EXPECT_EQ(area.Result(), "W+0.5");
+    EXPECT_FLOAT_EQ(board.wScore, 10.5f);
+
+    auto territory = ScoreBoard(board, ScoringRule::TERRITORY, dead);
+    EXPECT_EQ(territory.blackPrisoners, 1);
+    EXPECT_EQ(territory.whitePrisoners, 1);
+    EXPECT_FLOAT_EQ(territory.black, 6.0f);
+    EXPECT_FLOAT_EQ(territory.white, 6.5f);
+
+    // Without the dead stone, aa splits black's side into two neutral regions.
+    EXPECT_EQ(ScoreBoard(board, ScoringRule::AREA).blackTerritory, 0);
+
+    // The same position from SGF, with the dead stone marked by TB.
+    auto root = LoadSGF("(;SZ[5]KM[0.5]AB[ba][bb][bc][bd][be]AW[da][db][dc][dd][de][aa];TB[aa][ab][ac][ad][ae])");
+    EXPECT_EQ(ScoreGame(*root, ScoringRule::AREA).Result(), "W+0.5");
+    root = LoadSGF("(;SZ[5]KM[0.5]AB[ba][bb][bc][bd][be]AW[da][db][dc][dd][de][aa];AE[aa])");
+    EXPECT_EQ(ScoreGame(*root, ScoringRule::TERRITORY).blackPrisoners, 1);
+    EXPECT_EQ(ScoreGame(*LoadSGF("(;SZ[3]KM[7])"), ScoringRule::AREA).Result(), "W+7");
+
+    std::ostringstream csv, json;
+    std::vector<ScoreRow> rows(2);
+    rows[0].path = "a,b.sgf";
+    rows[0].game = 1;
+    rows[0].score = area;
+    rows[1].path = "c.sgf";
+    rows[1].error = "bad \"quote\"";
+    WriteScoresCSV(csv, rows);
+    EXPECT_EQ(csv.str(), "path,game,PB,PW,black,white,result,RE,error\n"
+                         "\"a,b.sgf\",1,,,10,10.5,W+0.5,,\n"
+                         "c.sgf,0,,,,,,,\"bad \"\"quote\"\"\"\n");
+    WriteScoresJSON(json, rows);
+    EXPECT_EQ(json.str(), "[\n {\"path\":\"a,b.sgf\",\"game\":1,\"PB\":\"\",\"PW\":\"\",\"black\":10,"
+                          "\"white\":10.5,\"result\":\"W+0.5\",\"RE\":\"\"},\n"
+                          " {\"path\":\"c.sgf\",\"game\":0,\"error\":\"bad \\\"quote\\\"\"}\n]\n");
+
+    // Every game that fails to parse gets its own row, in game order.
+    auto path = std::filesystem::temp_directory_path() / ("score_" + std::to_string(::getpid()) + ".sgf");
+    std::ofstream(path) << "(;SZ[99])(;SZ[3]KM[7])(;SZ[0])(;SZ[3];B[bb])";
+    auto bulk = ScoreBulk({path.string(), (path.string() + ".missing")}, ScoringRule::AREA);
+    std::filesystem::remove(path);
+    ASSERT_EQ(bulk.size(), 5u);
+    for (size_t g = 0; g < 4; g++) {
+        EXPECT_EQ(bulk[g].game, g + 1);
+        EXPECT_EQ(bulk[g].error.empty(), g % 2 == 1);
+    }
+    EXPECT_EQ(bulk[1].score.Result(), "W+7");
+    EXPECT_EQ(bulk[4].game, 0u);
+    EXPECT_FALSE(bulk[4].error.empty());
+}
+
+TEST_F(GameTest, TreeWalk) {
+    for (auto arena: {std::shared_ptr<NodeArena>(), NodeArena::Create()}) {
+        auto root = LoadSGF("(;C[r](;B[aa](;W[bb])(;W[cc];B[dd]))(;B[ee]))", arena);
+        std::string pre, post;
+        auto name = [](Node *n) {
+            auto v = n->GetValue(Key::B) + n->GetValue(Key::W) + n->GetValue(Key::C);
+            return v + " ";
+        };
+        EXPECT_TRUE(root->Walk([&](Node *n) { pre += name(n); }, [&](Node *n) { post += name(n); }));
+        EXPECT_EQ(pre, "r aa bb cc dd ee ");
+        EXPECT_EQ(post, "bb dd cc aa ee r ");
+
+        pre.clear();
+        EXPECT_TRUE(root->Walk([&](Node *n) {
+            pre += name(n);
+            return n->GetValue(Key::B) == "aa" ? Visit::SKIP : Visit::CONTINUE;
+        }));
+        EXPECT_EQ(pre, "r aa ee ");
+
+        pre.clear();
+        EXPECT_FALSE(root->Walk([&](Node *n) {
+            pre += name(n);
+            return n->GetValue(Key::W) == "cc" ? Visit::STOP : Visit::CONTINUE;
+        }));
+        EXPECT_EQ(pre, "r aa bb cc ");
+
+        pre.clear();
+        for (Node *n: root->Subtree()) {
+            pre += name(n);
+        }
+        EXPECT_EQ(pre, "r aa bb cc dd ee ");
+        pre.clear();
+        for (Node *n: root->MainChild()->Subtree()) {
+            pre += name(n);
+        }
+        EXPECT_EQ(pre, "aa bb cc dd ");
+        pre.clear();
+        for (Node *n: root->MainLine()) {
+            pre += name(n);
+        }
+        EXPECT_EQ(pre, "r aa bb ");
+        pre.clear();
+        for (Node *n: root->GetEnd()->Ancestors()) {
+            pre += name(n);
+        }
+        EXPECT_EQ(pre, "r ");
+        EXPECT_EQ(std::distance(root->Subtree().begin(), root->Subtree().end()), 6);
+        EXPECT_EQ(root->SubTreeKeyValueCount(), std::make_pair(6, 6));
+    }
+
+    // Half a million heap nodes in one line: statistics, ranges and the
+    // destructor all run without recursion.
+    auto root = std::make_shared<Node>();
+    auto node = root;
+    for (int i = 0; i < 500000; i++) {
+        node = Node::NewNode(node);
+        node->appendValue(i % 2 ? Key::W : Key::B, "aa");
+    }
+    EXPECT_EQ(root->SubtreeSize(), 500001);
+    EXPECT_EQ(root->SubtreeNodes().size(), 500001u);
+    EXPECT_EQ(root->TreeKeyValueCount(), std::make_pair(500000, 500000));
+    EXPECT_EQ(std::distance(node->Ancestors().begin(), node->Ancestors().end()), 500000);
+    node.reset();
+    root.reset();
+}
+
+TEST_F(GameTest, AncestorQueries) {
+    for (auto arena: {std::shared_ptr<NodeArena>(), NodeArena::Create()}) {
+        auto root = LoadSGF("(;SZ[9](;B[aa](;W[bb];B[cc])(;W[dd];B[ee];W[ff]))(;B[gg]))", arena);
+        auto aa = root->MainChild();
+        auto cc = aa->MainChild()->MainChild();
+        auto ff = aa->LastChild()->GetEnd();
+        auto gg = root->LastChild();
+        EXPECT_EQ(root->Depth(), 0u);
+        EXPECT_EQ(ff->Depth(), 4u);
+        EXPECT_EQ(ff->Ancestor(3), aa);
+        EXPECT_EQ(ff->Ancestor(4), root);
+        EXPECT_EQ(ff->Ancestor(5), nullptr);
+        EXPECT_EQ(cc->CommonAncestor(ff), aa);
+        EXPECT_EQ(cc->CommonAncestor(gg), root);
+        EXPECT_EQ(aa->CommonAncestor(cc), aa);
+        EXPECT_EQ(cc->CommonAncestor(LoadSGF("(;B[aa])", arena)), nullptr);
+
+        auto b = cc->ReplayFrom(*ff, ff->GetBoard()->Copy());
+        EXPECT_TRUE(b->Equals(*cc->GetBoard()));
+        EXPECT_EQ(b->step, 3);
+        auto moved = ff->ReplayFrom(*root, root->GetBoard()->Copy());
+        EXPECT_TRUE(moved->Equals(*ff->GetBoard()));
+
+        ff->SetParent(gg);
+        EXPECT_EQ(ff->Depth(), 2u);
+        EXPECT_EQ(ff->GetLine().size(), 3u);
+        EXPECT_EQ(ff->CommonAncestor(cc), root);
+        aa->DeleteChildren();
+        if (arena) {
+            EXPECT_EQ(cc->Ancestor(1)->Depth(), 0u);
+            EXPECT_EQ(cc->GetRoot(), cc->Ancestor(1));
+        }
+    }
+
+    // Ancestors of a long line with a random branch agree with stepping up one
+    // parent at a time.
+    std::mt19937 rng(3);
+    std::vector<std::shared_ptr<Node>> line{std::make_shared<Node>()};
+    for (int i = 0; i < 5000; i++) {
+        line.push_back(Node::NewNode(line.back()));
+    }
+    auto branch = Node::NewNode(line[1234]);
+    for (int i = 0; i < 3000; i++) {
+        branch = Node::NewNode(branch);
+    }
+    for (int i = 0; i < 200; i++) {
+        uint32_t k = rng() % 5001;
+        EXPECT_EQ(line[5000]->Ancestor(k), line[5000 - k]);
+        uint32_t j = rng() % 5001;
+        EXPECT_EQ(branch->CommonAncestor(line[j])->Depth(), std::min<uint32_t>(j, 1234));
+    }
+
+    // Subtrees that outlive their tree become roots.
+    auto kept = line[3000];
+    while (!line.empty()) {
+        line.pop_back();
+    }
+    EXPECT_EQ(kept->Depth(), 0u);
+    EXPECT_EQ(kept->GetEnd()->Depth(), 2000u);
+    EXPECT_EQ(kept->GetEnd()->GetRoot(), kept);
+    EXPECT_EQ(branch->Depth(), 0u);
+}
+
+TEST_F(GameTest, CursorApplyUndo) {
+    // Undo restores stones, chains, captures and the ko square exactly.
+    Board board(5);
+    for (auto p: {"bb", "cb", "ac", "dc", "bd", "cd"}) {
+        board.PlayColour(p, board.player);
+    }
+    board.PlayColour("cc", Colour::BLACK);
+    auto before = board.Copy();
+    board.Apply(board.Index("bc"), Colour::WHITE);
+    EXPECT_EQ(board.Get("cc"), Colour::EMPTY);
+    EXPECT_EQ(board.GetKo(), "cc");
+    board.Apply(noPoint, Colour::BLACK);
+    EXPECT_EQ(board.UndoDepth(), 2u);
+    EXPECT_TRUE(board.Undo());
+    EXPECT_TRUE(board.Undo());
+    EXPECT_FALSE(board.Undo());
+    EXPECT_TRUE(board.Equals(*before));
+    EXPECT_EQ(board.Liberties("cc"), before->Liberties("cc"));
+    EXPECT_EQ(board.Stones("bb"), before->Stones("bb"));
+
+    // A cursor agrees with GetBoard() everywhere, moving down, up and across.
+    auto root = LoadSGF("(;SZ[9];B[cc];W[dc](;B[dd];W[cd];B[ce];W[ed])(;B[cd];W[dd];AB[ee];B[ff]))");
+    auto line = root->MainChild()->MainChild();
+    auto end1 = line->MainChild()->GetEnd();
+    auto end2 = line->LastChild()->GetEnd();
+    Cursor cursor(end1);
+    EXPECT_EQ(cursor.Current(), end1.get());
+    EXPECT_TRUE(cursor.GetBoard().Equals(*end1->GetBoard()));
+    EXPECT_EQ(cursor.GetBoard().step, 6);
+    cursor.Jump(*end2);
+    EXPECT_TRUE(cursor.GetBoard().Equals(*end2->GetBoard()));
+    EXPECT_EQ(cursor.GetBoard().At(PointIndex(4, 4, 9)), Colour::BLACK);
+    while (cursor.Prev()) {
+        EXPECT_TRUE(cursor.GetBoard().Equals(*cursor.Current()->GetBoard()));
+    }
+    EXPECT_EQ(cursor.Current(), root.get());
+    EXPECT_TRUE(cursor.Next());
+    EXPECT_TRUE(cursor.Next());
+    EXPECT_TRUE(cursor.Next(1));
+    EXPECT_FALSE(cursor.Next(1));
+    EXPECT_EQ(cursor.Current(), line->LastChild().get());
+    EXPECT_TRUE(cursor.GetBoard().Equals(*cursor.Current()->GetBoard()));
+    EXPECT_THROW(cursor.Jump(*LoadSGF("(;B[aa])")), std::invalid_argument);
+}
+
+TEST_F(GameTest, GTPEngine) {
+    EXPECT_EQ(ParseGTPVertex("j9", 19), PointIndex(8, 10, 19));
+    EXPECT_EQ(GTPVertex(PointIndex(8, 10, 19), 19), "J9");
+    EXPECT_EQ(ParseGTPVertex("PASS", 19), noPoint);
+    EXPECT_THROW(ParseGTPVertex("I5", 19), std::invalid_argument);
+    EXPECT_THROW(ParseGTPVertex("T20", 19), std::invalid_argument);
+
+    GTPEngine gtp;
+    EXPECT_EQ(gtp.Execute("1 protocol_version"), "=1 2\n\n");
+    EXPECT_EQ(gtp.Execute("  # comment"), "");
+    EXPECT_EQ(gtp.Execute("known_command\tgenmove"), "= true\n\n");
+    EXPECT_EQ(gtp.Execute("7 frobnicate"), "?7 unknown command\n\n");
+    EXPECT_EQ(gtp.Execute("boardsize 26"), "? unacceptable size\n\n");
+    EXPECT_EQ(gtp.Execute("boardsize abc"), "? syntax error\n\n");
+    EXPECT_EQ(gtp.Execute("boardsize 9x"), "? syntax error\n\n");
+    EXPECT_EQ(gtp.Execute("komi abc"), "? syntax error\n\n");
+    EXPECT_EQ(gtp.Execute("boardsize 5"), "=\n\n");
+
+    // White takes a ko at C4, so black may not retake at once. Undo puts the
+    // captured stone back.
+    for (auto m: {"b B5", "w C5", "b A4", "w D4", "b B3", "w C3", "b C4", "w B4"}) {
+        ASSERT_EQ(gtp.Execute(std::string("play ") + m), "=\n\n") << m;
+    }
+    EXPECT_EQ(gtp.GetBoard().At(PointIndex(2, 1, 5)), Colour::EMPTY);
+    EXPECT_EQ(gtp.Execute("play b C4"), "? illegal move\n\n");
+    EXPECT_EQ(gtp.Execute("play b Z4"), "? invalid vertex\n\n");
+    EXPECT_EQ(gtp.Current()->Depth(), 8u);
+    EXPECT_EQ(gtp.Execute("undo"), "=\n\n");
+    EXPECT_EQ(gtp.GetBoard().At(PointIndex(2, 1, 5)), Colour::BLACK);
+    EXPECT_EQ(gtp.Current()->Depth(), 7u);
+    EXPECT_TRUE(gtp.GetBoard().Equals(*gtp.Current()->GetBoard()));
+    auto genmove = gtp.Execute("genmove w");
+    ASSERT_EQ(genmove.substr(0, 2), "= ");
+    int move = ParseGTPVertex(genmove.substr(2, genmove.size() - 4), 5);
+    EXPECT_EQ(gtp.GetBoard().At(move), Colour::WHITE);
+    EXPECT_TRUE(gtp.GetBoard().Equals(*gtp.Current()->GetBoard()));
+    auto board = gtp.Execute("showboard");
+    EXPECT_EQ(board.rfind("= \n", 0), 0u);
+    EXPECT_NE(board.find(" X O"), std::string::npos);
+
+    // A white stone inside black's area is dead at the end.
+    gtp.Execute("clear_board");
+    gtp.Execute("komi 0");
+    for (int row = 1; row <= 5; row++) {
+        gtp.Execute("play b C" + std::to_string(row));
+        gtp.Execute("play w D" + std::to_string(row));
+    }
+    gtp.Execute("play w A3");
+    EXPECT_EQ(gtp.Execute("final_status_list dead"), "= A3\n\n");
+    EXPECT_EQ(gtp.Execute("final_score"), "= B+5\n\n");
+    gtp.Execute("play b pass");
+    EXPECT_EQ(gtp.Current()->Depth(), 12u);
+
+    auto path = std::filesystem::temp_directory_path() / ("gtp_" + std::to_string(::getpid()) + ".sgf");
+    std::ofstream(path) << "(;SZ[9]KM[6.5];B[cc];W[dd];B[ee])";
+    EXPECT_EQ(gtp.Execute("loadsgf " + path.string() + " 3"), "=\n\n");
+    EXPECT_EQ(gtp.GetBoard().size, 9);
+    EXPECT_EQ(gtp.GetBoard().km, 6.5f);
+    EXPECT_EQ(gtp.GetBoard().At(ParseGTPVertex("C7", 9)), Colour::BLACK);
+    EXPECT_EQ(gtp.GetBoard().At(ParseGTPVertex("E5", 9)), Colour::EMPTY);
+    EXPECT_EQ(gtp.Execute("undo"), "=\n\n");
+    EXPECT_EQ(gtp.Execute("undo"), "=\n\n");
+    EXPECT_EQ(gtp.Execute("undo"), "? cannot undo\n\n");
+    EXPECT_EQ(gtp.Execute("loadsgf " + path.string() + ".missing"), "? cannot load file\n\n");
+    std::filesystem::remove(path);
+    EXPECT_EQ(gtp.Execute("quit"), "=\n\n");
+    EXPECT_TRUE(gtp.Quit());
+
+    // Run answers each command in order, pondering between them, until the
+    // input ends.
+    GTPEngine run;
+    std::istringstream in("1 name\nboardsize 9\n\nplay b E5\n2 genmove w\nfinal_score\n");
+    std::ostringstream out;
+    EXPECT_EQ(run.Run(in, out), 0);
+    auto answers = out.str();
+    EXPECT_EQ(answers.rfind("=1 consoleGo\n\n=\n\n=\n\n=2 ", 0), 0u);
+    EXPECT_EQ(std::count(answers.begin(), answers.end(), '='), 5);
+    EXPECT_EQ(run.Current()->Depth(), 2u);
+}
+
+TEST_F(GameTest, BinaryRoundTrip) {
+    std::vector<std::string> games = {
+            "(;GM[1]SZ[9]C[a \\] b\\\\];B[ee](;W[cc];B[dd](;W[aa])(;W[bb]))(;W[gg]))",
+            "(;SZ[19]HA[2]AB[dd][pp]PL[W];W[pd];B[];W[tt];W[dp]C[two in a row];;B[qq]TR[aa][bb]MULTIGOGM[1];B[ss])",
+            "(;SZ[52];B[AZ];W[zA];B[ZZ](;W[aa])(;W[bb])(;W[cc]))",
+            "(;FF[4])",
+    };
+    for (auto &sgf: games) {
+        auto root = LoadSGF(sgf);
+        auto data = EncodeBinary(root);
+        EXPECT_EQ(DecodeBinary(data)->Save(), sgf);
+        auto arenaRoot = DecodeBinary(data, NodeArena::Create());
+        EXPECT_EQ(arenaRoot->Save(), sgf);
+        EXPECT_EQ(EncodeBinary(arenaRoot), data);
+    }
+    auto decoded = DecodeBinary(EncodeBinary(LoadSGF(games[0])));
+    Node *end = decoded.get();
+    while (Node *child = end->firstChild()) {
+        end = child;
+    }
+    EXPECT_EQ(end->Depth(), 4u);
+    EXPECT_EQ(end->GetBoard()->At(PointIndex(0, 0, 9)), Colour::WHITE);
+
+    std::vector<std::shared_ptr<Node>> roots;
+    for (auto &sgf: games) {
+        roots.push_back(LoadSGF(sgf));
+    }
+    auto collection = DecodeBinaryCollection(EncodeBinaryCollection(roots));
+    ASSERT_EQ(collection.size(), games.size());
+    for (size_t g = 0; g < games.size(); g++) {
+        EXPECT_EQ(collection[g]->Save(), games[g]);
+    }
+    EXPECT_TRUE(DecodeBinaryCollection(EncodeBinaryCollection({})).empty());
+
+    // A plain game record is one 9-bit token per move on 19x19, and one to
+    // end the line.
+    std::mt19937 rng(5);
+    auto game = Node::NewNode(nullptr);
+    auto node = game;
+    for (int m = 0; m < 300; m++) {
+        node = Node::NewNode(node);
+        node->appendValue(m % 2 ? Key::W : Key::B, Point(rng() % 19, rng() % 19));
+    }
+    auto data = EncodeBinary(game);
+    EXPECT_LT(data.size() * 5, game->Save().size());
+    EXPECT_EQ(data.size(), 17 + (301 * 9 + 7) / 8);
+    EXPECT_EQ(DecodeBinary(data)->Save(), game->Save());
+
+    auto path = std::filesystem::temp_directory_path() / ("binary_" + std::to_string(::getpid()) + ".wgo");
+    SaveBinaryCollectionFile(path.string(), roots);
+    EXPECT_EQ(LoadBinary(path.string())->Save(), games[0]);
+    EXPECT_EQ(LoadBinaryCollection(path.string()).size(), games.size());
+    std::filesystem::remove(path);
+
+    EXPECT_THROW(DecodeBinary("(;B[aa])"), std::runtime_error);
+    for (size_t cut = 8; cut < data.size(); cut += 37) {
+        EXPECT_THROW(DecodeBinary(data.substr(0, cut)), std::runtime_error) << cut;
+    }
+    auto corrupt = data;
+    corrupt[20] = static_cast<char>(0xff);
+    corrupt[21] = static_cast<char>(0xff);
+    EXPECT_THROW(DecodeBinary(corrupt), std::runtime_error);
+}
+
+TEST_F(GameTest, GameDatabase) {
+    EXPECT_EQ(parseGameDate("2024-03-05,06"), 20240305u);
+    EXPECT_EQ(parseGameDate("1999-12"), 19991200u);
+    EXPECT_EQ(parseGameDate("1999"), 19990000u);
+    EXPECT_EQ(parseGameDate("May 1999"), 0u);
+
+    std::vector<std::string> games = {
+            "(;SZ[19]KM[6.5]PB[Lee]PW[Ke]BR[9p]DT[2016-03-09]RE[W+R];B[pd];W[dd](;B[pp])(;B[dp]C[x]))",
+            "(;SZ[9]KM[7]PB[Ke]PW[Cho]DT[2017-05-23]RE[B+0.5];B[ee])",
+            "(;PB[Lee]PW[Cho]EV[Cup]RE[Draw])",
+            "(;SZ[13]KM[0.5]PB[Cho]PW[Lee]DT[2016-12-01]RE[W+3.5])",
+    };
+    GameDBWriter writer;
+    for (size_t g = 0; g < games.size(); g++) {
+        writer.Add(*LoadSGF(games[g]), "mem.sgf", static_cast<uint32_t>(g));
+    }
+    auto path = std::filesystem::temp_directory_path() / ("gamedb_" + std::to_string(::getpid()));
+    writer.Save(path.string());
+
+    GameDB db(path.string());
+    ASSERT_EQ(db.Size(), games.size());
+    for (size_t g = 0; g < games.size(); g++) {
+        EXPECT_EQ(db.Game(g)->Save(), games[g]);
+        EXPECT_EQ(db.Source(g), std::make_pair(std::string_view("mem.sgf"), static_cast<uint32_t>(g)));
+    }
+    EXPECT_EQ(db.Value(0, Key::PB), "Lee");
+    EXPECT_EQ(db.Value(2, shortKey("EV")), "Cup");
+    EXPECT_EQ(db.Value(2, Key::BR), "");
+    EXPECT_EQ(db.BoardSize(1), 9);
+    EXPECT_EQ(db.BoardSize(2), 19);
+    EXPECT_FLOAT_EQ(db.Komi(0), 6.5f);
+    EXPECT_TRUE(std::isnan(db.Komi(2)));
+    EXPECT_EQ(db.Date(3), 20161201u);
+    EXPECT_EQ(db.Winner(1), Colour::BLACK);
+    EXPECT_EQ(db.Winner(2), Colour::EMPTY);
+    EXPECT_THROW(db.Value(0, Key::KM), std::invalid_argument);
+    EXPECT_THROW(db.Game(4), std::out_of_range);
+
+    auto find = [&db](GameQuery q) { return db.Find(q); };
+    using ids = std::vector<uint32_t>;
+    EXPECT_EQ(find({}), (ids{0, 1, 2, 3}));
+    GameQuery q;
+    q.player = "Lee";
+    EXPECT_EQ(find(q), (ids{0, 2, 3}));
+    q.winner = Colour::WHITE;
+    EXPECT_EQ(find(q), (ids{0, 3}));
+    q.fromDate = 20160601;
+    EXPECT_EQ(find(q), (ids{3}));
+    q = {};
+    q.equals = {{Key::PW, "Cho"}};
+    EXPECT_EQ(find(q), (ids{1, 2}));
+    q.equals = {{Key::PW, "Nobody"}};
+    EXPECT_EQ(find(q), ids{});
+    q = {};
+    q.minKomi = 1;
+    EXPECT_EQ(find(q), (ids{0, 1}));
+    q.maxKomi = 7;
+    q.size = 9;
+    EXPECT_EQ(find(q), (ids{1}));
+    q = {};
+    q.toDate = 20161231;
+    EXPECT_EQ(find(q), (ids{0, 3}));
+
+    // Files are added in order, whatever order the workers finish in.
+    auto dir = std::filesystem::temp_directory_path() / ("gamedb_dir_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(dir);
+    std::ofstream(dir / "a.sgf") << games[0] << games[1];
+    std::ofstream(dir / "b.sgf") << games[2] << "(;SZ[99])" << games[3] << "(;SZ[99])";
+    BulkOptions opts;
+    opts.threads = 3;
+    opts.gamesPerTask = 1;
+    GameDBWriter files;
+    auto errors = files.AddFiles({dir.string()}, opts);
+    ASSERT_EQ(errors.size(), 2u);
+    EXPECT_EQ(std::filesystem::path(errors[0].first).filename(), "b.sgf");
+    EXPECT_EQ(errors[0].second.rfind("game 2: ", 0), 0u);
+    EXPECT_EQ(errors[1].second.rfind("game 4: ", 0), 0u);
+    files.Save(path.string());
+    GameDB fromFiles(path.string());
+    ASSERT_EQ(fromFiles.Size(), 4u);
+    EXPECT_EQ(fromFiles.Game(3)->Save(), games[3]);
+    EXPECT_EQ(fromFiles.Source(3).second, 2u);
+    EXPECT_EQ(std::filesystem::path(std::string(fromFiles.Source(2).first)).filename(), "b.sgf");
+
+    std::filesystem::resize_file(path, 100);
+    EXPECT_THROW(GameDB(path.string()), std::runtime_error);
+    std::filesystem::remove(path);
+    std::filesystem::remove_all(dir);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -1,34 +1,97 @@
+#ifndef CONSOLEGO_UTILS_H
+#define CONSOLEGO_UTILS_H
+
+#include <algorithm>
 #include <array>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
 
 // alpha表，和Go版一致
 constexpr char alpha[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
 
-#ifndef CONSOLEGO_UTILS_H
-#define CONSOLEGO_UTILS_H
+inline std::string byte_to_string(char b) { return std::string(1, b); }
 
-#include <string>
-#include <tuple>
-#include <vector>
+// alphaIndex converts a single SGF coordinate character to its 0-based index,
+// or -1 if the character is not a valid coordinate.
+inline int alphaIndex(char c) {
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a';
+    }
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A' + 26;
+    }
+    return -1;
+}
 
-// TODO: complete it
-bool ValidPoint(std::string p, int size) { return false; }
+// ParsePoint takes an SGF coordinate, e.g. "dd", and a board size, and returns
+// the x and y coordinates, plus a bool indicating whether the point was on the
+// board.
+inline std::tuple<int, int, bool> ParsePoint(std::string_view p, int size) {
+    if (p.size() != 2) {
+        return std::make_tuple(-1, -1, false);
+    }
+    int x = alphaIndex(p[0]);
+    int y = alphaIndex(p[1]);
+    bool onboard = x >= 0 && x < size && y >= 0 && y < size;
+    return std::make_tuple(x, y, onboard);
+}
+
+// ValidPoint returns true if the point is an SGF coordinate on the board.
+inline bool ValidPoint(std::string_view p, int size) { return std::get<2>(ParsePoint(p, size)); }
 
-std::tuple<int, int, bool> ParsePoint(std::string p, int size) { return std::make_tuple(0, 0, false); }
+// IsStarPoint returns true if the point is a hoshi on a board of the given
+// size.
+inline bool IsStarPoint(std::string_view p, int size) {
+    auto [x, y, onboard] = ParsePoint(p, size);
+    if (!onboard || size < 7) {
+        return false;
+    }
+    int edge = size >= 13 ? 3 : 2;
+    auto good = [&](int v) { return v == edge || v == size - 1 - edge || (size % 2 == 1 && v == size / 2); };
+    if (!good(x) || !good(y)) {
+        return false;
+    }
+    // Small boards only get the centre and the four corner points.
+    if (size < 13 && (x == size / 2) != (y == size / 2)) {
+        return false;
+    }
+    return true;
+}
 
-// TODO: complete it
-bool IsStarPoint(std::string p, int size) { return false; }
+// ForEachPoint calls f(x, y) for every on-board point named by an SGF point
+// value, which is either a single point ("dd") or a compressed rectangle
+// ("aa:cc").
+template <typename F>
+void ForEachPoint(std::string_view v, int size, F f) {
+    if (v.size() == 5 && v[2] == ':') {
+        auto [x1, y1, ok1] = ParsePoint(v.substr(0, 2), size);
+        auto [x2, y2, ok2] = ParsePoint(v.substr(3, 2), size);
+        if (!ok1 || !ok2) {
+            return;
+        }
+        for (int y = std::min(y1, y2); y <= std::max(y1, y2); y++) {
+            for (int x = std::min(x1, x2); x <= std::max(x1, x2); x++) {
+                f(x, y);
+            }
+        }
+        return;
+    }
+    auto [x, y, onboard] = ParsePoint(v, size);
+    if (onboard) {
+        f(x, y);
+    }
+}
 
-std::string Point(int x, int y) {
+inline std::string Point(int x, int y) {
     if (x < 0 || x >= 52 || y < 0 || y >= 52) {
         return "";
     }
     return byte_to_string(alpha[x]) + byte_to_string(alpha[y]);
 }
 
-std::string byte_to_string(char b) { return std::string(1, b); }
-
-std::vector<std::string> AdjacentPoints(std::string p, int size) {
+inline std::vector<std::string> AdjacentPoints(std::string p, int size) {
     auto [x, y, onboard] = ParsePoint(p, size);
     if (!onboard) {
         return {};
@@ -0,0 +1,52 @@
+#ifndef CONSOLEGO_ZOBRIST_H
+#define CONSOLEGO_ZOBRIST_H
+
+#include <array>
+#include <cstdint>
+
+#include "bitboard.h"
+#include "colour.h"
+
+// ZobristTable holds the random keys used to hash board positions. The keys are
+// generated from a fixed seed, so hashes are stable across runs and can be
+// stored on disk.
+struct ZobristTable {
+    std::array<uint64_t, maxPoints> black;
+    std::array<uint64_t, maxPoints> white;
+    std::array<uint64_t, maxPoints> ko;
+    uint64_t whiteToMove;
+
+    ZobristTable() {
+        uint64_t seed = 0x5a6f627269737421ULL;
+        for (int i = 0; i < maxPoints; i++) {
+            black[i] = splitmix64(seed);
+            white[i] = splitmix64(seed);
+            ko[i] = splitmix64(seed);
+        }
+        whiteToMove = splitmix64(seed);
+    }
+
+    uint64_t Stone(int i, Colour c) const {
+        if (c == Colour::BLACK) {
+            return black[i];
+        }
+        if (c == Colour::WHITE) {
+            return white[i];
+        }
+        return 0;
+    }
+
+    static uint64_t splitmix64(uint64_t &state) {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+};
+
+inline const ZobristTable &Zobrist() {
+    static const ZobristTable table;
+    return table;
+}
+
+#endif // CONSOLEGO_ZOBRIST_H